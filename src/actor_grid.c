@@ -0,0 +1,187 @@
+#include <assert.h>
+#include <math.h>
+
+#define IN_ACTOR_GRID
+#include "overview.h"
+
+// About as far as two actors can reach to hold hands
+const float actor_grid_cell_size = 4.f;
+
+typedef struct grid_cell_ { int x, z; } grid_cell_t;
+
+grid_cell_t get_grid_cell(vec3_t pos, float cell_size);
+unsigned get_grid_bucket(grid_cell_t);
+void insert_nearest_actor(uint16_t, float, size_t k, uint16_t nearest[], float distances[], size_t *num);
+
+
+//// Actor grid ////
+
+/**
+Sort all actors into the buckets of their cells (counting sort, so linear time).
+
+Rebuild whenever actors have moved.
+**/
+void build_actor_grid(float cell_size, const actor_table_t *actors, actor_grid_t *grid) {
+	assert(cell_size > 0);
+	grid->cell_size = cell_size;
+	grid->num_actors = actors->num_rows;
+
+	// Count actors per bucket
+	FOR_IN(b, num_actor_grid_buckets + 1) { grid->bucket_start[b] = 0; }
+	unsigned bucket_of[max_actor_table_rows];
+	FOR_ROWS(a, *actors) {
+		bucket_of[a] = get_grid_bucket(get_grid_cell(actors->location[a].position, cell_size));
+		grid->bucket_start[bucket_of[a] + 1]++;
+	}
+
+	// Where each bucket starts
+	FOR_IN(b, num_actor_grid_buckets) {
+		grid->bucket_start[b + 1] += grid->bucket_start[b];
+	}
+
+	// Distribute
+	uint16_t cursor[num_actor_grid_buckets];
+	FOR_IN(b, num_actor_grid_buckets) { cursor[b] = grid->bucket_start[b]; }
+	FOR_ROWS(a, *actors) {
+		grid->actor_index[cursor[bucket_of[a]]++] = a;
+	}
+}
+
+
+/**
+Find (indices of) all actors within the radius from the position.
+
+Returns the number of actors found (no more than max).
+**/
+size_t find_actors_within(
+		vec3_t pos, float radius, const actor_table_t *actors, const actor_grid_t *grid,
+		uint16_t out[], size_t max) {
+
+	assert(grid->num_actors == actors->num_rows);
+	float s = grid->cell_size;
+	grid_cell_t lo = get_grid_cell(vec3(pos.x - radius, 0, pos.z - radius), s);
+	grid_cell_t hi = get_grid_cell(vec3(pos.x + radius, 0, pos.z + radius), s);
+
+	// Give up on cells if it's cheaper to check every actor
+	// (Also keeps far too large radii from looping for ever)
+	if ((float) (hi.x - lo.x + 1) * (float) (hi.z - lo.z + 1) > actors->num_rows) {
+		size_t num = 0;
+		FOR_ROWS(a, *actors) {
+			if (num >= max) { break; }
+			if (vec3_distance(actors->location[a].position, pos) <= radius) { out[num++] = a; }
+		}
+		return num;
+	}
+
+	size_t num = 0;
+	for (int cx = lo.x; cx <= hi.x; cx++) {
+		for (int cz = lo.z; cz <= hi.z; cz++) {
+			grid_cell_t cell = { cx, cz };
+			unsigned b = get_grid_bucket(cell);
+			FOR_RANGE(i, grid->bucket_start[b], grid->bucket_start[b + 1]) {
+				uint16_t a = grid->actor_index[i];
+				vec3_t actor_pos = actors->location[a].position;
+
+				// Other cells may share the bucket
+				grid_cell_t actor_cell = get_grid_cell(actor_pos, s);
+				if (actor_cell.x != cx || actor_cell.z != cz) { continue; }
+
+				if (num >= max) { return num; }
+				if (vec3_distance(actor_pos, pos) <= radius) { out[num++] = a; }
+			}
+		}
+	}
+	return num;
+}
+
+
+/**
+Find (indices of) the k actors closest to the position, closest first.
+
+Searches rings of cells around the position until nothing further out
+can be closer. Returns the number of actors found (less than k only if
+there are fewer actors).
+**/
+size_t find_nearest_actors(
+		vec3_t pos, size_t k, const actor_table_t *actors, const actor_grid_t *grid,
+		uint16_t out[]) {
+
+	assert(grid->num_actors == actors->num_rows);
+	float s = grid->cell_size;
+	grid_cell_t center = get_grid_cell(pos, s);
+	float distances[max_actor_table_rows];
+	size_t num = 0, num_visited = 0;
+	if (k > actors->num_rows) { k = actors->num_rows; }
+	if (k == 0) { return 0; }
+
+	for (int ring = 0; num_visited < actors->num_rows; ring++) {
+		// Anything outside of the rings so far is at least this far away
+		float covered = (ring - 1) * s;
+		if (num == k && distances[num - 1] <= covered) { break; }
+
+		// Give up on cells if it's cheaper to check every actor
+		if ((float) (2 * ring + 1) * (float) (2 * ring + 1) > actors->num_rows) {
+			num = 0;
+			FOR_ROWS(a, *actors) {
+				float d = vec3_distance(actors->location[a].position, pos);
+				insert_nearest_actor(a, d, k, out, distances, &num);
+			}
+			break;
+		}
+
+		// Go through the cells on the edge of the ring
+		for (int cx = center.x - ring; cx <= center.x + ring; cx++) {
+			bool on_edge_x = (cx == center.x - ring || cx == center.x + ring);
+			int step_z = (on_edge_x || ring == 0 ? 1 : 2 * ring);
+			for (int cz = center.z - ring; cz <= center.z + ring; cz += step_z) {
+				grid_cell_t cell = { cx, cz };
+				unsigned b = get_grid_bucket(cell);
+				FOR_RANGE(i, grid->bucket_start[b], grid->bucket_start[b + 1]) {
+					uint16_t a = grid->actor_index[i];
+					vec3_t actor_pos = actors->location[a].position;
+
+					// Other cells may share the bucket
+					grid_cell_t actor_cell = get_grid_cell(actor_pos, s);
+					if (actor_cell.x != cx || actor_cell.z != cz) { continue; }
+					num_visited++;
+
+					insert_nearest_actor(a, vec3_distance(actor_pos, pos), k, out, distances, &num);
+				}
+			}
+		}
+	}
+	return num;
+}
+
+
+/**
+Keep the actor among the k nearest found so far (if it's near enough).
+**/
+void insert_nearest_actor(
+		uint16_t actor_index, float distance, size_t k,
+		uint16_t nearest[], float distances[], size_t *num) {
+
+	if (*num == k && distance >= distances[*num - 1]) { return; }
+	size_t j = (*num < k ? (*num)++ : *num - 1);
+	while (j > 0 && distances[j - 1] > distance) {
+		distances[j] = distances[j - 1];
+		nearest[j] = nearest[j - 1];
+		j--;
+	}
+	distances[j] = distance;
+	nearest[j] = actor_index;
+}
+
+
+//// Grid cells ////
+
+grid_cell_t get_grid_cell(vec3_t pos, float cell_size) {
+	grid_cell_t cell = { (int) floorf(pos.x / cell_size), (int) floorf(pos.z / cell_size) };
+	return cell;
+}
+
+
+unsigned get_grid_bucket(grid_cell_t cell) {
+	unsigned h = ((unsigned) cell.x * 73856093u) ^ ((unsigned) cell.z * 19349663u);
+	return h % num_actor_grid_buckets;
+}
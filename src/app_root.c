@@ -1,21 +1,165 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #include <raylib.h>
 
 #define IN_APP_ROOT
 #include "overview.h"
 
 static const float step_time = 1.f/60.f;
+static const unsigned max_steps_per_frame = 4;
 static app_t app= { 0 };
 
+// Simulation thread
+void *run_simulation_thread(void *);
+void take_simulation_step(app_t *);
+static atomic_bool keep_simulating;
+static FILE *ik_metrics_file; // IK metrics of every step go here (if anywhere)
+static pose_export_t *pose_export; // Poses of every step go here (if anywhere)
+void finish_pose_export(const char *path);
+
+// How IK is done (set up from the command line)
+static ik_pool_t *ik_pool;
+static ik_budget_t ik_budget = { .focus_radius = 10 };
+void set_up_ik(app_t *);
+
+// Terrain streamed from disk (if asked for)
+static terrain_stream_t *terrain_stream;
+void set_up_terrain(app_t *, bool blocking);
+
+// Walk cycles baked at startup, played back away from the cursor (if asked for)
+static gait_pose_table_t *gait_poses;
+static float gait_pose_radius = 10;
+void set_up_gait_poses(app_t *);
+
+// Input commands (render thread -> simulation thread)
+enum { max_queued_input_commands = 256 };
+static input_command_t input_command_queue[max_queued_input_commands];
+static atomic_uint input_command_head, input_command_tail;
+bool push_input_command(const input_command_t *);
+bool pop_input_command(input_command_t *);
+
+// Finished frames (simulation thread -> render thread)
+static app_frame_t frame_buffers[3];
+static atomic_uint frame_exchange = 2;
+static unsigned back_frame = 1, front_frame = 0;
+enum { fresh_frame_bit = 4 };
+void publish_frame(const app_t *);
+app_frame_t *acquire_latest_frame(void);
+
+// Headless batch runs
+int run_gait_sweep(unsigned num_worlds, unsigned num_steps, unsigned num_threads);
+int replay_input_recording(const char *path);
+int run_ik_benchmark(unsigned max_threads, unsigned num_rounds);
+
 
 int main(int argc, char** argv) {
-#define PRINT_SIZE_OF(t) printf("%s: %zub\n", #t, sizeof(t))
-	PRINT_SIZE_OF(vec3_t);
-	PRINT_SIZE_OF(vec4_t);
-	PRINT_SIZE_OF(mat4_t);
-	PRINT_SIZE_OF(limb_table_t);
-	PRINT_SIZE_OF(app_t);
+	// Simulate on a thread of its own (unless told otherwise)
+	bool single_threaded = false;
+	unsigned num_batch_worlds = 0, num_batch_steps = 600;
+	unsigned num_batch_threads = (unsigned) sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned num_ik_threads = 1;
+	bool bench_ik = false;
+	const char *record_path = NULL, *replay_path = NULL, *ik_metrics_path = NULL;
+	const char *terrain_path = NULL, *bake_terrain_path = NULL, *export_poses_path = NULL;
+	float terrain_radius = 16, terrain_budget_mb = 4;
+	bool bake_gaits = false;
+	FOR_RANGE(i, 1, argc) {
+		bool has_value = i + 1 < argc;
+		if (strcmp(argv[i], "--single-threaded") == 0) { single_threaded = true; }
+		if (strcmp(argv[i], "--batch") == 0 && has_value) { num_batch_worlds = atoi(argv[++i]); }
+		else if (strcmp(argv[i], "--steps") == 0 && has_value) { num_batch_steps = atoi(argv[++i]); }
+		else if (strcmp(argv[i], "--threads") == 0 && has_value) { num_batch_threads = atoi(argv[++i]); }
+		else if (strcmp(argv[i], "--record") == 0 && has_value) { record_path = argv[++i]; }
+		else if (strcmp(argv[i], "--replay") == 0 && has_value) { replay_path = argv[++i]; }
+		else if (strcmp(argv[i], "--ik-threads") == 0 && has_value) { num_ik_threads = atoi(argv[++i]); }
+		else if (strcmp(argv[i], "--ik-budget") == 0 && has_value) { ik_budget.max_bones = atoi(argv[++i]); }
+		else if (strcmp(argv[i], "--ik-budget-ms") == 0 && has_value) { ik_budget.max_time = atof(argv[++i]) / 1000; }
+		else if (strcmp(argv[i], "--bench-ik") == 0) { bench_ik = true; }
+		else if (strcmp(argv[i], "--ik-metrics") == 0 && has_value) { ik_metrics_path = argv[++i]; }
+		else if (strcmp(argv[i], "--terrain") == 0 && has_value) { terrain_path = argv[++i]; }
+		else if (strcmp(argv[i], "--terrain-radius") == 0 && has_value) { terrain_radius = atof(argv[++i]); }
+		else if (strcmp(argv[i], "--terrain-budget-mb") == 0 && has_value) { terrain_budget_mb = atof(argv[++i]); }
+		else if (strcmp(argv[i], "--bake-terrain") == 0 && has_value) { bake_terrain_path = argv[++i]; }
+		else if (strcmp(argv[i], "--gait-poses") == 0) { bake_gaits = true; }
+		else if (strcmp(argv[i], "--gait-pose-radius") == 0 && has_value) { gait_pose_radius = atof(argv[++i]); }
+		else if (strcmp(argv[i], "--export-poses") == 0 && has_value) { export_poses_path = argv[++i]; }
+	}
+
+	// Bake the terrain of the app into tiles (512 by 512 m, mostly flat) and be done
+	if (bake_terrain_path) {
+		static landscape_t land;
+		create_some_terrain(&land);
+		bool ok = bake_terrain_tiles(bake_terrain_path, &land.ground, -256, -256, 8, 64, 64, 32);
+		printf(ok ? "Baked terrain tiles to '%s'\n" : "Could not bake terrain tiles to '%s'\n", bake_terrain_path);
+		return (ok ? 0 : 1);
+	}
+
+	// Or see how IK scales with threads (without a window)
+	if (bench_ik) {
+		return run_ik_benchmark(num_batch_threads, num_batch_steps);
+	}
+
+	// Share IK out over threads (if asked to)
+	ik_pool = (num_ik_threads > 1 ? create_ik_pool(num_ik_threads) : NULL);
+
+	// Or just crunch through a batch of worlds (without a window)
+	if (num_batch_worlds > 0) {
+		return run_gait_sweep(num_batch_worlds, num_batch_steps, num_batch_threads);
+	}
+
+	// Stream terrain from disk
+	if (terrain_path) {
+		terrain_stream = open_terrain_stream(terrain_path, terrain_radius, (size_t) (terrain_budget_mb * 1024 * 1024));
+		if (!terrain_stream) {
+			printf("Could not stream terrain from '%s' (with room for %.2f MB of tiles)\n", terrain_path, terrain_budget_mb);
+		}
+	}
+
+	// Bake walk cycles to play back (from half a step up to three per second)
+	if (bake_gaits) {
+		static const float speeds[] = { 0.5f, 1.0f, 1.5f, 2.0f, 2.5f, 3.0f };
+		gait_poses = malloc(sizeof(gait_pose_table_t));
+		if (!bake_gait_poses(&default_gait_params, speeds, 6, step_time, gait_poses)) {
+			printf("Could not bake gait poses\n");
+			free(gait_poses);
+			gait_poses = NULL;
+		}
+	}
+
+	// Export poses (with a keyframe every second)
+	if (export_poses_path) {
+		pose_export = start_pose_export(export_poses_path, 60);
+		if (!pose_export) {
+			printf("Could not export poses to '%s'\n", export_poses_path);
+		}
+	}
+
+	// Keep track of how well IK does (in the steps taken from here on)
+	if (ik_metrics_path) {
+		ik_metrics_file = fopen(ik_metrics_path, "w");
+		if (ik_metrics_file) {
+			write_ik_metrics_csv_header(ik_metrics_file);
+		} else {
+			printf("Could not write IK metrics to '%s'\n", ik_metrics_path);
+		}
+	}
+
+	// Or replay a recorded session (without a window)
+	if (replay_path) {
+		int result = replay_input_recording(replay_path);
+		destroy_ik_pool(ik_pool);
+		close_terrain_stream(terrain_stream);
+		free(gait_poses);
+		if (ik_metrics_file) { fclose(ik_metrics_file); }
+		finish_pose_export(export_poses_path);
+		return result;
+	}
 
 	// Get things up and running
 	InitWindow(1024, 768, "Hello, Promenad!");
@@ -32,90 +176,487 @@ int main(int argc, char** argv) {
 	UpdateCamera(&camera);
 
 	// App setup
+	get_profile_clock();
 	init_app(am_actor_pair, &app);
+	set_up_ik(&app);
+	set_up_terrain(&app, false);
+	set_up_gait_poses(&app);
+	load_app_assets(&app);
+	publish_frame(&app);
+
+	// Record input (for replaying)
+	static input_recording_t recording;
+	if (record_path) {
+		if (start_input_recording(record_path, app.mode, &recording)) {
+			app.recording = &recording;
+		} else {
+			printf("Could not record input to '%s'\n", record_path);
+		}
+	}
+
+	// Start simulating
+	pthread_t simulation_thread;
+	if (!single_threaded) {
+		atomic_store(&keep_simulating, true);
+		if (pthread_create(&simulation_thread, NULL, run_simulation_thread, NULL) != 0) {
+			printf("Could not start simulation thread (simulating on the main thread instead)\n");
+			single_threaded = true;
+		}
+	}
 
 	// Ah-Gogogoggogogogo!
 	while(!WindowShouldClose()) {
 		// Update
-		float dt = maxf(GetFrameTime(), 1.f/30.f);
-		process_input(dt, &app);
-		update_app(dt, &app);
+		float dt = GetFrameTime();
+		if (single_threaded) {
+			process_input(dt, &app);
+			update_app(dt, &app);
+			publish_frame(&app);
+		} else {
+			input_command_t commands[max_input_commands_per_frame];
+			size_t num_commands = gather_input_commands(dt, commands, max_input_commands_per_frame);
+			FOR_IN(i, num_commands) {
+				if (!push_input_command(&commands[i])) { break; }
+			}
+		}
+
+		// Catch up with the simulation
+		app_frame_t *frame = acquire_latest_frame();
+		frame->step_fraction = frame->buffered_fraction;
+		if (!frame->paused) {
+			float since_capture = get_profile_clock() - frame->captured_at;
+			frame->step_fraction = minf(frame->buffered_fraction + since_capture / step_time, 1.f);
+		}
 
 		// Render
 		UpdateCamera(&camera);
 		BeginDrawing();
 		ClearBackground(RAYWHITE);
-		render_app(&camera, &app);
+		PROFILE_SCOPE("render_app") {
+			render_app(&camera, &app, frame);
+		}
 		DrawFPS(0,0);
 		EndDrawing();
 	}
 
+	// Stop simulating
+	if (!single_threaded) {
+		atomic_store(&keep_simulating, false);
+		pthread_join(simulation_thread, NULL);
+	}
+
 	// K, thx, bye
+#if ENABLE_PROFILING
+	if (write_profile_as_chrome_trace("promenad_trace.json")) {
+		printf("Wrote %zu profile events to 'promenad_trace.json'\n", count_profile_events());
+	}
+#endif
+	if (write_log("promenad_log.txt")) {
+		printf("Wrote %zu log records to 'promenad_log.txt'\n", count_log_records());
+	}
+	if (app.recording) {
+		size_t num_records = app.recording->num_records;
+		if (stop_input_recording(app.num_steps_taken, app.recording)) {
+			printf("Recorded %zu input commands over %llu steps to '%s'\n",
+				num_records, (unsigned long long) app.num_steps_taken, record_path);
+		}
+		app.recording = NULL;
+	}
+	if (ik_metrics_file) {
+		fclose(ik_metrics_file);
+		printf("Wrote IK metrics of %llu steps to '%s'\n", (unsigned long long) app.num_steps_taken, ik_metrics_path);
+	}
+	finish_pose_export(export_poses_path);
 	term_app(&app);
+	destroy_ik_pool(ik_pool);
+	close_terrain_stream(terrain_stream);
+	free(gait_poses);
 	CloseWindow();
 	return 0;
 }
 
 
+//// Simulation thread ////
+
+/**
+Keep simulating in real time until told to stop.
+
+Only this thread touches the app once it has started. The render thread
+talks to it through the input command queue and reads finished frames.
+**/
+void *run_simulation_thread(void *arg) {
+	(void) arg;
+	double prev_time = get_profile_clock();
+
+	while (atomic_load(&keep_simulating)) {
+		// Apply input
+		input_command_t command;
+		while (pop_input_command(&command)) {
+			apply_input_command(&command, &app);
+		}
+
+		// Simulate
+		double now = get_profile_clock();
+		update_app(now - prev_time, &app);
+		prev_time = now;
+		publish_frame(&app);
+
+		// Rest until the next step is due
+		double until_next_step = (1.f - app.step_fraction) * step_time;
+		if (app.paused) { until_next_step = step_time; }
+		struct timespec rest = { 0, (long) (until_next_step * 1e9) };
+		nanosleep(&rest, NULL);
+	}
+
+	return NULL;
+}
+
+
+/**
+Have the (first) population of the app do IK the way the command line asked for.
+
+(Later populations are copies, so they do it the same way)
+**/
+void set_up_ik(app_t *app) {
+	population_t *pop = &app->population_history[app->frame_count % max_pop_history_frames];
+	pop->ik_pool = ik_pool;
+	pop->ik_budget = ik_budget;
+}
+
+
+/**
+Stand the app on the streamed terrain (if there is any).
+
+Blocking streams wait for tiles to load, so that the simulation comes out
+the same however long loading takes.
+**/
+void set_up_terrain(app_t *app, bool blocking) {
+	if (!terrain_stream) { return; }
+	set_terrain_stream_blocking(blocking, terrain_stream);
+	app->landscape.ground.stream = terrain_stream;
+}
+
+
+/**
+Have the (first) population of the app play back baked walk cycles (if they were baked).
+**/
+void set_up_gait_poses(app_t *app) {
+	if (!gait_poses) { return; }
+	population_t *pop = &app->population_history[app->frame_count % max_pop_history_frames];
+	pop->gait_playback.poses = gait_poses;
+	pop->gait_playback.focus_radius = gait_pose_radius;
+}
+
+
+/**
+Write the last of the exported poses and tell how it went.
+**/
+void finish_pose_export(const char *path) {
+	if (!pose_export) { return; }
+	pose_export_stats_t stats;
+	bool ok = stop_pose_export(pose_export, &stats);
+	pose_export = NULL;
+	if (!ok) {
+		printf("Could not write all poses to '%s'\n", path);
+		return;
+	}
+	printf("Exported poses of %llu steps (%llu dropped) to '%s' in %llu bytes (%.1f%% of plain floats)\n",
+		(unsigned long long) stats.num_steps, (unsigned long long) stats.num_dropped_steps, path,
+		(unsigned long long) stats.num_bytes, 100.0 * stats.num_bytes / (stats.num_raw_bytes ? stats.num_raw_bytes : 1));
+}
+
+
+//// Batch runs ////
+
+/**
+Walk rows of actors with different step heights (one world each) and
+print how every world ended up.
+**/
+int run_gait_sweep(unsigned num_worlds, unsigned num_steps, unsigned num_threads) {
+	world_t *worlds = calloc(num_worlds, sizeof(world_t));
+	if (!worlds) {
+		printf("Could not allocate %u worlds\n", num_worlds);
+		return 1;
+	}
+
+	// Step heights from low to high
+	FOR_IN(w, num_worlds) {
+		init_world(am_actor_row, &worlds[w].landscape, &worlds[w].population);
+		float s = (num_worlds > 1 ? (float) w / (num_worlds - 1) : 0.5f);
+		worlds[w].landscape.gait_params.step_height = 0.25f + 0.5f * s;
+	}
+
+	printf("Stepping %u worlds %u times on %u threads\n", num_worlds, num_steps, num_threads);
+	double start = get_profile_clock();
+	run_worlds(worlds, num_worlds, num_steps, step_time, num_threads);
+	double wall_time = get_profile_clock() - start;
+
+	double busy_time = 0;
+	FOR_IN(w, num_worlds) {
+		const world_result_t *r = &worlds[w].result;
+		vec3_t p = r->mean_actor_position;
+		printf("World %3d: step height %.3f, %u steps (%.2fs) in %.3fs, mean actor at (%.2f, %.2f, %.2f), checksum %016llx\n",
+			w, worlds[w].landscape.gait_params.step_height, r->num_steps, r->sim_time, r->busy_time,
+			p.x, p.y, p.z, (unsigned long long) r->checksum);
+		busy_time += r->busy_time;
+	}
+	printf("Done in %.3fs (%.0f steps per second, %.1fx parallel)\n",
+		wall_time, num_worlds * num_steps / wall_time, busy_time / wall_time);
+
+	// (Every world is set up the same way, so the first one will do)
+	memory_report_t report;
+	report_memory(&worlds[0].population, &report);
+	printf("Memory of world 0 (of %zu bytes each):\n", sizeof(world_t));
+	print_memory_report(&report, stdout);
+
+	free(worlds);
+	return 0;
+}
+
+
+/**
+Feed a recorded session back into the app as fast as possible (no window, no
+real time) and print how long it took and where everything ended up.
+
+Commands get applied between the same steps as when recorded, so the result
+is the same on every run (and build) that simulates the same way.
+**/
+int replay_input_recording(const char *path) {
+	input_replay_t replay;
+	if (!open_input_replay(path, &replay)) {
+		printf("Could not replay '%s'\n", path);
+		return 1;
+	}
+	init_app(replay.mode, &app);
+	set_up_ik(&app);
+	set_up_terrain(&app, true);
+	set_up_gait_poses(&app);
+
+	size_t num_commands = 0;
+	double start = get_profile_clock();
+	input_command_t command;
+	while (true) {
+		bool has_command = read_input_record(&replay, &command);
+		while (app.num_steps_taken < replay.step) {
+			take_simulation_step(&app);
+		}
+		if (!has_command) { break; }
+		apply_input_command(&command, &app);
+		num_commands++;
+	}
+	double wall_time = get_profile_clock() - start;
+	close_input_replay(&replay);
+
+	const population_t *pop = &app.population_history[app.frame_count % max_pop_history_frames];
+	printf("Replayed %zu commands over %llu steps in %.3fs (%.0f steps per second)\n",
+		num_commands, (unsigned long long) app.num_steps_taken, wall_time, app.num_steps_taken / wall_time);
+	printf("Final population checksum %016llx\n", (unsigned long long) hash_population(pop));
+
+	memory_report_t report;
+	report_memory(pop, &report);
+	print_memory_report(&report, stdout);
+	return 0;
+}
+
+
+/**
+Time IK of the limb forest (end effectors swaying about) on pools of 1 to
+max_threads threads, checking that every pool moves the limbs exactly like
+a single thread does.
+**/
+int run_ik_benchmark(unsigned max_threads, unsigned num_rounds) {
+	static landscape_t land;
+	static population_t pop;
+	static limb_table_t serial, start;
+	init_world(am_limb_forest, &land, &pop);
+	start = pop.limbs;
+
+	// Where each limb reaches at rest
+	vec3_t rest_tip[max_limb_table_rows];
+	uint16_t all[max_limb_table_rows];
+	FOR_ROWS(l, start) {
+		rest_tip[l] = get_limb_tip_position(start.dense_id[l], &start);
+		all[l] = l;
+	}
+
+	unsigned num_bones = 0;
+	bone_t bones[32];
+	FOR_ROWS(l, start) { num_bones += collect_bones(start.dense_id[l], &start, bones, 32); }
+	printf("IK of %u limbs (%u bones) for %u rounds\n", start.num_rows, num_bones, num_rounds);
+
+	double single_time = 0;
+	FOR_RANGE(t, 0, max_threads + 1) {
+		// (Zero threads: on this thread, the plain way)
+		ik_pool_t *pool = (t > 0 ? create_ik_pool(t) : NULL);
+		limb_table_t *limbs = &pop.limbs;
+		*limbs = start;
+
+		double begin = get_profile_clock();
+		FOR_IN(r, num_rounds) {
+			FOR_ROWS(l, *limbs) {
+				float a = 0.05f * r + l;
+				limbs->end_effector[l] = vec3_add(rest_tip[l], vec3(sinf(a), cosf(a) - 1, cosf(a)));
+			}
+			if (pool) {
+				move_limbs_to_end_effectors_in_parallel(pool, all, limbs->num_rows, limbs);
+			} else {
+				move_limbs_directly_to_end_effectors(limbs);
+			}
+		}
+		double time = get_profile_clock() - begin;
+		destroy_ik_pool(pool);
+
+		if (t == 0) {
+			serial = *limbs;
+			printf("Serial:     %8.1f us per round\n", 1e6 * time / num_rounds);
+			continue;
+		}
+		if (t == 1) { single_time = time; }
+		bool same = memcmp(limbs->bones, serial.bones, sizeof(serial.bones)) == 0;
+		printf("%2u threads: %8.1f us per round, %.2fx of one thread, %s\n",
+			t, 1e6 * time / num_rounds, single_time / time, (same ? "same as serial" : "DIFFERENT FROM SERIAL"));
+	}
+	return 0;
+}
+
+
+//// Input command queue ////
+// (Single producer, single consumer)
+
+bool push_input_command(const input_command_t *command) {
+	unsigned head = atomic_load_explicit(&input_command_head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&input_command_tail, memory_order_acquire);
+	if (head - tail >= max_queued_input_commands) { return false; }
+
+	input_command_queue[head % max_queued_input_commands] = *command;
+	atomic_store_explicit(&input_command_head, head + 1, memory_order_release);
+	return true;
+}
+
+
+bool pop_input_command(input_command_t *command) {
+	unsigned tail = atomic_load_explicit(&input_command_tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(&input_command_head, memory_order_acquire);
+	if (tail == head) { return false; }
+
+	*command = input_command_queue[tail % max_queued_input_commands];
+	atomic_store_explicit(&input_command_tail, tail + 1, memory_order_release);
+	return true;
+}
+
+
+//// Frame triple buffer ////
+// (The writer owns the back frame, the reader owns the front frame
+// and the third one is in the exchange)
+
+/**
+Capture the app state into the back frame and make it the latest one.
+**/
+void publish_frame(const app_t *app) {
+	capture_app_frame(app, &frame_buffers[back_frame]);
+	unsigned prev = atomic_exchange_explicit(&frame_exchange, back_frame | fresh_frame_bit, memory_order_acq_rel);
+	back_frame = prev & ~fresh_frame_bit;
+}
+
+
+/**
+Get the latest published frame (which stays put until the next call).
+**/
+app_frame_t *acquire_latest_frame(void) {
+	if (atomic_load_explicit(&frame_exchange, memory_order_relaxed) & fresh_frame_bit) {
+		unsigned prev = atomic_exchange_explicit(&frame_exchange, front_frame, memory_order_acq_rel);
+		front_frame = prev & ~fresh_frame_bit;
+	}
+	return &frame_buffers[front_frame];
+}
+
+
+/**
+Copy what the renderer needs from the app.
+**/
+void capture_app_frame(const app_t *app, app_frame_t *frame) {
+	frame->frame_count = app->frame_count;
+	frame->paused = app->paused;
+	frame->show_profile = app->show_profile;
+	frame->show_memory_report = app->show_memory_report;
+	frame->buffered_fraction = app->step_fraction;
+	frame->step_fraction = app->step_fraction;
+	frame->dropped_time = app->dropped_time;
+	frame->captured_at = get_profile_clock();
+	frame->world_cursor = app->world_cursor;
+
+	// Two latest frames (for interpolation)
+	unsigned curr = app->frame_count % max_pop_history_frames;
+	unsigned prev = (app->frame_count > 0 ? app->frame_count - 1 : 0) % max_pop_history_frames;
+	frame->curr = app->population_history[curr];
+	frame->prev = app->population_history[prev];
+
+	// Phase timings of the capturing thread
+	frame->num_sim_phases = collect_profile_phases(frame->sim_phases, max_profile_phases);
+}
+
+
 /**
 Update all the things.
+
+Simulates as many fixed time steps as needed to catch up with real time,
+but never more than 'max_steps_per_frame'. Time beyond that is dropped
+(and accounted for in 'dropped_time') rather than piling up.
 **/
 void update_app(float dt, app_t *app) {
 	if (app->step_once) {
-		dt += step_time;
 		app->step_once = false;
+		take_simulation_step(app);
+		app->step_fraction = 1.f;
+		return;
 	} else if (app->paused) {
+		app->step_fraction = 1.f;
 		return;
 	}
 
 	// Simulate in a fixed time step
 	app->buffered_time += dt;
-	if (app->buffered_time < step_time) {
-		return;
-	} else {
+	unsigned num_steps = 0;
+	while (app->buffered_time >= step_time && num_steps < max_steps_per_frame) {
 		app->buffered_time -= step_time;
+		take_simulation_step(app);
+		num_steps++;
+	}
+
+	// Give up on time we could not catch up with
+	if (app->buffered_time >= step_time) {
+		float excess = app->buffered_time - fmodf(app->buffered_time, step_time);
+		app->dropped_time += excess;
+		app->buffered_time -= excess;
 	}
 
+	// How far we are between the two latest frames
+	app->step_fraction = app->buffered_time / step_time;
+}
+
+
+/**
+Advance the simulation one fixed time step (and keep history).
+**/
+void take_simulation_step(app_t *app) {
 	// Keep history
 	unsigned old_frame = app->frame_count % max_pop_history_frames;
 	app->frame_count++;
 	unsigned new_frame = (app->frame_count % max_pop_history_frames);
 	app->population_history[new_frame] = app->population_history[old_frame];
 	population_t *pop = &app->population_history[new_frame];
+	app->num_steps_taken++;
 
 	// Update world
-	update_population(step_time, &app->landscape, pop);
-}
-
-
-/**
-Update the dynamically changing part of the simulation.
-**/
-void update_population(float dt, const landscape_t *land, population_t *pop) {
-
-	// Move whole actors
-	move_actors(dt, &pop->actors);
-	calculate_actor_transforms(&pop->actors);
-
-	// Move limbs attached to actors
-	reposition_attached_limbs(&pop->arms, &pop->actors, &pop->limbs);
-	reposition_attached_limbs(&pop->legs, &pop->actors, &pop->limbs);
-
-	// Animate actors
-	animation_env_i anim_env = {
-		&pop->actors,
-		&pop->arms, &pop->legs,
-		&land->ground,
-		&pop->limbs, &pop->limb_goals
-	};
-	animate_walking_actor_legs(dt, &anim_env);
-	keep_actors_actors_above_ground(3.0, &land->ground, &pop->actors);
-
-	// Update (secondary) kinematics
-	perpetuate_limb_momentums(dt, &pop->limb_swings, &pop->limbs);
-	move_limbs_toward_goals(dt, &pop->limb_goals, &pop->limbs);
-	move_limb_tips_to_their_linked_partners(&pop->limb_tip_links, &pop->limbs);
-	apply_gravity_to_limbs(dt, vec3(0,-4,0), &pop->limb_swings, &pop->limbs);
-	move_limbs_directly_to_end_effectors(&pop->limbs);
-	delete_accomplished_limb_goals(&pop->limbs, &pop->limb_goals);
+	PROFILE_SCOPE("update_population") {
+		pop->ik_budget.focus = app->world_cursor;
+		pop->gait_playback.focus = app->world_cursor;
+		update_population(step_time, &app->landscape, pop);
+	}
+	if (ik_metrics_file) {
+		write_ik_metrics_csv_row(&pop->ik_metrics, ik_metrics_file);
+	}
+	if (pose_export) {
+		export_population_poses(pop, pose_export);
+	}
 }
@@ -0,0 +1,240 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define IN_BATCH
+#include "overview.h"
+
+// Steps a world takes before it's back in its queue (where idle workers may steal it)
+enum { batch_chunk_steps = 60 };
+enum { max_batch_threads = 64 };
+
+/**
+Worlds (by index) waiting for a worker.
+
+The owner pushes and pops at the bottom, others steal from the top.
+**/
+typedef struct world_deque_ {
+	pthread_mutex_t lock;
+	uint32_t *worlds; // Ring of 'capacity'
+	size_t capacity;
+	size_t top, bottom; // (Only ever growing)
+} world_deque_t;
+
+typedef struct batch_ {
+	world_t *worlds;
+	size_t num_worlds;
+	unsigned num_steps;
+	float dt;
+	world_deque_t deques[max_batch_threads];
+	unsigned num_threads;
+	atomic_size_t num_worlds_left;
+} batch_t;
+
+typedef struct batch_worker_ {
+	batch_t *batch;
+	unsigned index;
+} batch_worker_t;
+
+void *run_batch_worker(void *);
+bool take_batch_world(unsigned worker, batch_t *, uint32_t *world);
+void push_world_bottom(uint32_t world, world_deque_t *);
+bool pop_world_bottom(world_deque_t *, uint32_t *world);
+bool steal_world_top(world_deque_t *, uint32_t *world);
+void collect_world_result(world_t *);
+
+
+//// Batch runs ////
+
+/**
+Step every world the same number of times (on up to 'num_threads' threads).
+
+Worlds are independent, so each one ends up exactly as if it was stepped on
+its own. Results (in each world) are collected once all worlds are done.
+**/
+void run_worlds(world_t worlds[], size_t num_worlds, unsigned num_steps, float dt, unsigned num_threads) {
+	assert(num_worlds < UINT32_MAX);
+	if (num_threads < 1) { num_threads = 1; }
+	if (num_threads > max_batch_threads) { num_threads = max_batch_threads; }
+	if (num_threads > num_worlds && num_worlds > 0) { num_threads = num_worlds; }
+
+	batch_t *batch = malloc(sizeof(batch_t));
+	batch->worlds = worlds;
+	batch->num_worlds = num_worlds;
+	batch->num_steps = num_steps;
+	batch->dt = dt;
+	batch->num_threads = num_threads;
+	atomic_init(&batch->num_worlds_left, num_worlds);
+
+	// Deal out the worlds
+	FOR_IN(t, num_threads) {
+		world_deque_t *deque = &batch->deques[t];
+		pthread_mutex_init(&deque->lock, NULL);
+		deque->capacity = num_worlds;
+		deque->worlds = malloc((num_worlds > 0 ? num_worlds : 1) * sizeof(uint32_t));
+		deque->top = deque->bottom = 0;
+	}
+	FOR_IN(w, num_worlds) {
+		memset(&worlds[w].result, 0, sizeof(world_result_t));
+		push_world_bottom(w, &batch->deques[w % num_threads]);
+	}
+
+	// This thread is the first worker
+	// (worlds of workers that fail to start get stolen by the others)
+	pthread_t threads[max_batch_threads];
+	batch_worker_t workers[max_batch_threads];
+	bool started[max_batch_threads] = { false };
+	FOR_IN(t, num_threads) {
+		workers[t].batch = batch;
+		workers[t].index = t;
+		if (t > 0) {
+			started[t] = pthread_create(&threads[t], NULL, run_batch_worker, &workers[t]) == 0;
+		}
+	}
+	run_batch_worker(&workers[0]);
+	FOR_RANGE(t, 1, num_threads) {
+		if (started[t]) { pthread_join(threads[t], NULL); }
+	}
+
+	// Collect results
+	FOR_IN(w, num_worlds) {
+		collect_world_result(&worlds[w]);
+	}
+
+	FOR_IN(t, num_threads) {
+		pthread_mutex_destroy(&batch->deques[t].lock);
+		free(batch->deques[t].worlds);
+	}
+	free(batch);
+}
+
+
+/**
+Step a single world (keeping track of how long it took).
+**/
+void step_world(unsigned num_steps, float dt, world_t *world) {
+	double start = get_profile_clock();
+	FOR_IN(s, num_steps) {
+		update_population(dt, &world->landscape, &world->population);
+	}
+	world->result.num_steps += num_steps;
+	world->result.sim_time += num_steps * dt;
+	world->result.busy_time += get_profile_clock() - start;
+}
+
+
+/**
+Fingerprint of where everything in the population is (FNV-1a).
+
+Equal populations hash equal, so runs can be compared without keeping them around.
+**/
+uint64_t hash_population(const population_t *pop) {
+	uint64_t h = 14695981039346656037ull;
+#define HASH_BYTES(p, n) FOR_IN(b, (n)) { h = (h ^ ((const uint8_t *) (p))[b]) * 1099511628211ull; }
+	FOR_ROWS(a, pop->actors) {
+		HASH_BYTES(&pop->actors.location[a], sizeof(location_t));
+	}
+	FOR_ROWS(l, pop->limbs) {
+		HASH_BYTES(&pop->limbs.end_effector[l], sizeof(vec3_t));
+	}
+#undef HASH_BYTES
+	return h;
+}
+
+
+/**
+Fill in what the world looks like after its steps.
+**/
+void collect_world_result(world_t *world) {
+	const population_t *pop = &world->population;
+	world_result_t *result = &world->result;
+
+	result->num_actors = pop->actors.num_rows;
+	result->mean_actor_position = vec3_origo;
+	FOR_ROWS(a, pop->actors) {
+		result->mean_actor_position = vec3_add(result->mean_actor_position, pop->actors.location[a].position);
+	}
+	if (pop->actors.num_rows > 0) {
+		result->mean_actor_position = vec3_mul(result->mean_actor_position, 1.f / pop->actors.num_rows);
+	}
+	result->checksum = hash_population(pop);
+}
+
+
+//// Batch workers ////
+
+/**
+Keep stepping worlds (a chunk at the time) until every world is done.
+**/
+void *run_batch_worker(void *arg) {
+	const batch_worker_t *worker = arg;
+	batch_t *batch = worker->batch;
+
+	while (atomic_load(&batch->num_worlds_left) > 0) {
+		uint32_t w;
+		if (!take_batch_world(worker->index, batch, &w)) {
+			// Everything left is being stepped by someone else
+			sched_yield();
+			continue;
+		}
+
+		// Step a chunk, then put the world back
+		// (at the bottom of this workers own queue, so it stays here unless stolen)
+		world_t *world = &batch->worlds[w];
+		unsigned steps_left = batch->num_steps - world->result.num_steps;
+		unsigned steps = (steps_left < batch_chunk_steps ? steps_left : batch_chunk_steps);
+		PROFILE_SCOPE("step_world") {
+			step_world(steps, batch->dt, world);
+		}
+		if (world->result.num_steps < batch->num_steps) {
+			push_world_bottom(w, &batch->deques[worker->index]);
+		} else {
+			atomic_fetch_sub(&batch->num_worlds_left, 1);
+		}
+	}
+	return NULL;
+}
+
+
+/**
+Take a world from the workers own queue, or steal one from someone else.
+**/
+bool take_batch_world(unsigned worker, batch_t *batch, uint32_t *world) {
+	if (pop_world_bottom(&batch->deques[worker], world)) { return true; }
+	FOR_RANGE(i, 1, batch->num_threads) {
+		unsigned victim = (worker + i) % batch->num_threads;
+		if (steal_world_top(&batch->deques[victim], world)) { return true; }
+	}
+	return false;
+}
+
+
+//// World deques ////
+
+void push_world_bottom(uint32_t world, world_deque_t *deque) {
+	pthread_mutex_lock(&deque->lock);
+	assert(deque->bottom - deque->top < deque->capacity);
+	deque->worlds[deque->bottom++ % deque->capacity] = world;
+	pthread_mutex_unlock(&deque->lock);
+}
+
+
+bool pop_world_bottom(world_deque_t *deque, uint32_t *world) {
+	pthread_mutex_lock(&deque->lock);
+	bool found = deque->bottom > deque->top;
+	if (found) { *world = deque->worlds[--deque->bottom % deque->capacity]; }
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+
+bool steal_world_top(world_deque_t *deque, uint32_t *world) {
+	pthread_mutex_lock(&deque->lock);
+	bool found = deque->bottom > deque->top;
+	if (found) { *world = deque->worlds[deque->top++ % deque->capacity]; }
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
@@ -0,0 +1,139 @@
+#include <assert.h>
+#include <math.h>
+
+#define IN_CULLING
+#include "overview.h"
+
+// Encloses the actor model (and its nose)
+const float actor_bounding_radius = 1.25f;
+
+
+//// View frustum ////
+
+/**
+Frustum of a perspective view (with the vertical field of view in degrees).
+
+Plane normals point inwards, so a point 'p' is inside a plane if
+dot(normal, p) + w >= 0.
+**/
+frustum_t frustum_from_view(
+		vec3_t eye, vec3_t target, vec3_t up,
+		float fovy, float aspect, float near, float far) {
+
+	assert(fovy > 0 && fovy < 180);
+	assert(aspect > 0);
+	assert(near > 0 && near < far);
+
+	// View space axes
+	vec3_t forward = vec3_direction(eye, target);
+	vec3_t right = vec3_normal(vec3_cross(forward, up));
+	vec3_t view_up = vec3_cross(right, forward);
+
+	// Slopes of the sides
+	float half_v = tanf(fovy * 0.5f * tau / 360.f);
+	float half_h = half_v * aspect;
+
+	// Side planes all pass through the eye
+	vec3_t normals[6] = {
+		forward, // Near
+		vec3_mul(forward, -1), // Far
+		vec3_normal(vec3_add(right, vec3_mul(forward, half_h))), // Left
+		vec3_normal(vec3_sub(vec3_mul(forward, half_h), right)), // Right
+		vec3_normal(vec3_add(view_up, vec3_mul(forward, half_v))), // Bottom
+		vec3_normal(vec3_sub(vec3_mul(forward, half_v), view_up)), // Top
+	};
+	vec3_t points[6] = {
+		vec3_add(eye, vec3_mul(forward, near)),
+		vec3_add(eye, vec3_mul(forward, far)),
+		eye, eye, eye, eye,
+	};
+
+	frustum_t frustum;
+	FOR_IN(i, 6) {
+		frustum.planes[i] = vec4_from_vec3(normals[i], -vec3_dot(normals[i], points[i]));
+	}
+	return frustum;
+}
+
+
+/**
+Is some part of the sphere inside the frustum?
+
+(Conservative: spheres near the corners may pass without being visible)
+**/
+bool sphere_in_frustum(vec3_t center, float radius, const frustum_t *frustum) {
+	vec4_t p = vec4_from_vec3(center, 1);
+	FOR_IN(i, 6) {
+		if (vec4_dot(frustum->planes[i], p) < -radius) { return false; }
+	}
+	return true;
+}
+
+
+//// View culling ////
+
+/**
+Radius (around the root) that the limb can never reach outside of.
+**/
+float get_limb_bounding_radius(uint16_t limb_index, const limb_table_t *table) {
+	float radius = 0;
+	int bone = table->root_bone[limb_index];
+	while (bone) {
+		radius += table->bones[bone].distance;
+
+		// Next bone (if any)
+		bone = table->bone_nodes[bone].next_index;
+		if (bone == table->root_bone[limb_index]) { bone = 0; }
+	}
+	return radius;
+}
+
+
+/**
+Decide what in the population (and ground) is worth drawing from the view.
+**/
+void cull_population(
+		const frustum_t *frustum, const population_t *pop, const terrain_table_t *ground,
+		view_cull_t *out) {
+
+	// Actors
+	out->num_actors_culled = 0;
+	FOR_ROWS(a, pop->actors) {
+		vec3_t pos = pop->actors.location[a].position;
+		out->actor_visible[a] = sphere_in_frustum(pos, actor_bounding_radius, frustum);
+		out->num_actors_culled += !out->actor_visible[a];
+	}
+
+	// Limbs
+	const limb_table_t *limbs = &pop->limbs;
+	out->num_limbs_culled = 0;
+	FOR_ROWS(l, *limbs) {
+		float radius = get_limb_bounding_radius(l, limbs);
+		out->limb_visible[l] = sphere_in_frustum(limbs->position[l], radius, frustum);
+		out->num_limbs_culled += !out->limb_visible[l];
+	}
+
+	// Goals are visible with their limb or if any remaining point is
+	const limb_goal_table_t *goals = &pop->limb_goals;
+	out->num_goals_culled = 0;
+	FOR_ROWS(g, *goals) {
+		bool visible = out->limb_visible[get_limb_index(goals->dense_id[g], limbs)];
+		FOR_RANGE(i, goals->curve_index[g], goals->curve_length[g]) {
+			if (visible) { break; }
+			visible = sphere_in_frustum(goals->curve_points[g][i], goals->threshold[g], frustum);
+		}
+		out->goal_visible[g] = visible;
+		out->num_goals_culled += !visible;
+	}
+
+	// Terrain blocks
+	out->num_blocks_culled = 0;
+	FOR_ROWS(b, *ground) {
+		vec3_t low = vec3(ground->block[b].x1, 0, ground->block[b].z1);
+		vec3_t high = vec3(ground->block[b].x2, ground->block[b].height, ground->block[b].z2);
+		vec3_t center = vec3_lerp(0.5f, low, high);
+		float radius = vec3_distance(low, high) * 0.5f;
+		out->block_visible[b] = sphere_in_frustum(center, radius, frustum);
+		out->num_blocks_culled += !out->block_visible[b];
+	}
+}
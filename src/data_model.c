@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <raylib.h>
+#include <string.h>
 
 #define IN_DATA_MODEL
 #include "overview.h"
@@ -8,8 +9,16 @@
 //// Sparce table macros
 #define T(t,r,c) (t).c[r]
 
+#define T_SAME_ID(a, b) \
+	((a).id == (b).id && (a).generation == (b).generation)
+
+#define T_ID_RANGE(t) \
+	(sizeof((t).sparse_id) / sizeof((t).sparse_id[0]))
+
+// (Cheap to ask about dead ids, their generation has moved on)
 #define T_HAS_ID(t, r) \
-	((t).sparse_id[(r).id] < (t).num_rows && (t).dense_id[(t).sparse_id[(r).id]].id == (r).id)
+	((r).id < T_ID_RANGE(t) && (t).sparse_id[(r).id] < (t).num_rows && \
+	 T_SAME_ID((t).dense_id[(t).sparse_id[(r).id]], (r)))
 
 #define T_INDEX(t,r) \
 	(assert(T_HAS_ID((t), (r))), (t).sparse_id[(r).id])
@@ -23,12 +32,33 @@
 #define T_SET_CELL(t, r, c, v) \
 	(assert(T_HAS_ID(t,r)), (t).c[T_INDEX(t,r)] = (v))
 
+// Hand out an id (a deleted one if there is any, with its next generation)
+#define T_NEW_ID(t, out) \
+	((out).id = ((t).num_free_ids > 0 ? (t).free_id[--(t).num_free_ids] : (t).next_id++), \
+	 assert((out).id < T_ID_RANGE(t)), \
+	 (out).generation = (t).generation[(out).id])
+
+// Take the id back (so that it can be reused, as another generation)
+#define T_FREE_ID(t, r) \
+	((t).generation[(r).id]++, (t).free_id[(t).num_free_ids++] = (r).id)
+
+// Index of a new row at the end (keeping track of the most rows there have been)
+#define T_ADD_ROW(t) \
+	((t).peak_rows = ((t).num_rows >= (t).peak_rows ? (t).num_rows + 1 : (t).peak_rows), \
+	 (t).num_rows++)
+
 
-void create_some_terrain(app_t *);
 
 void init_cl_pool(cl_node_t [], size_t num_nodes);
 unsigned short take_free_cl_node(cl_node_t []);
 unsigned short append_cl_node_after(unsigned short anchor, cl_node_t []);
+void release_cl_nodes(unsigned short any_node, cl_node_t []);
+
+void choose_limb_ik_solver(uint16_t limb_index, limb_table_t *);
+int find_limb_of_bone(uint16_t bone_index, const limb_table_t *);
+
+void swap_gait_heap_nodes(uint16_t, uint16_t, gait_schedule_t *);
+void sift_gait_heap_node(uint16_t, gait_schedule_t *);
 
 //// App
 
@@ -39,13 +69,40 @@ void init_app(app_mode_e mode, app_t * app) {
 	app->paused = false;
 	app->step_once = false;
 	app->buffered_time = 0;
+	app->dropped_time = 0;
+	app->step_fraction = 1;
 	app->mode = mode;
+	app->show_profile = false;
+	app->show_memory_report = false;
 
 	app->frame_count = 0;
 	app->world_cursor = vec3(3, 2, 0);
+	app->num_steps_taken = 0;
+	app->recording = NULL;
 	population_t *pop = &app->population_history[app->frame_count % max_pop_history_frames];
+	init_world(mode, &app->landscape, pop);
+}
+
+
+/**
+Load what the app needs to draw itself (once there is a window).
+**/
+void load_app_assets(app_t *app) {
+	// Create actor model
+	app->actor_model = malloc(sizeof(Model));
+	*app->actor_model = LoadModelFromMesh(GenMeshCube(0.5f, 2.0f, 1.0f));
+}
+
 
+/**
+Set up the landscape and population of a world (without anything to draw it with).
+
+Expects both to start out zeroed.
+**/
+void init_world(app_mode_e mode, landscape_t *land, population_t *pop) {
+	land->gait_params = default_gait_params;
 	init_limb_table(&pop->limbs);
+	pop->fuse_limb_updates = true;
 
 	// Create a bunch of limbs with their roots in a grid
 	if (mode == am_limb_forest) {
@@ -67,21 +124,17 @@ void init_app(app_mode_e mode, app_t * app) {
 		}
 	}
 
-	// Create actor model
-	app->actor_model = malloc(sizeof(Model));
-	*app->actor_model = LoadModelFromMesh(GenMeshCube(0.5f, 2.0f, 1.0f));
-
 	// Setup single actor
 	if (mode == am_single_actor) {
 		create_person(vec3(0,3,0), 0, pop);
-		create_some_terrain(app);
+		create_some_terrain(land);
 	}
 
 	// Setup actor pair
 	if (mode == am_actor_pair) {
 		create_person(vec3(-2,+3,0), -pi/2, pop);
 		create_person(vec3(+2,+3,0), -pi/2, pop);
-		create_some_terrain(app);
+		create_some_terrain(land);
 	}
 
 	// Setp row of actors
@@ -93,7 +146,7 @@ void init_app(app_mode_e mode, app_t * app) {
 			movement_speed += 0.25;
 			set_actor_velocity(actor, new_vel, &pop->actors);
 		}
-		create_some_terrain(app);
+		create_some_terrain(land);
 	}
 
 	// Large arm from origo
@@ -122,16 +175,16 @@ void init_app(app_mode_e mode, app_t * app) {
 	}
 }
 
-void create_some_terrain(app_t *app) {
+void create_some_terrain(landscape_t *land) {
 	// Some terrain (A simple staircase)
-	create_terrain_block(4,6, -10, 10, 0.10, &app->landscape.ground);
-	create_terrain_block(6,8, -10, 10, 0.25, &app->landscape.ground);
-	create_terrain_block(8,10, -10, 10, 0.50, &app->landscape.ground);
+	create_terrain_block(4,6, -10, 10, 0.10, &land->ground);
+	create_terrain_block(6,8, -10, 10, 0.25, &land->ground);
+	create_terrain_block(8,10, -10, 10, 0.50, &land->ground);
 
 	// More terain (Up and down)
-	create_terrain_block(-3,-1, 2.25, 3.50, 0.3, &app->landscape.ground);
-	create_terrain_block(-3,-1, 4.50, 5.75, 0.5, &app->landscape.ground);
-	create_terrain_block(-3,-1, 7.25, 8.50, 0.3, &app->landscape.ground);
+	create_terrain_block(-3,-1, 2.25, 3.50, 0.3, &land->ground);
+	create_terrain_block(-3,-1, 4.50, 5.75, 0.5, &land->ground);
+	create_terrain_block(-3,-1, 7.25, 8.50, 0.3, &land->ground);
 }
 
 actor_id_t create_person(vec3_t center_point, float ori_y, population_t *pop) {
@@ -154,6 +207,43 @@ actor_id_t create_person(vec3_t center_point, float ori_y, population_t *pop) {
 }
 
 
+/**
+Delete the actor and its limbs (with everything that concerns them).
+**/
+void delete_person(actor_id_t actor, population_t *pop) {
+	void delete_attached_limbs(actor_id_t actor, limb_attachment_table_t *, population_t *);
+
+	delete_attached_limbs(actor, &pop->arms, pop);
+	delete_attached_limbs(actor, &pop->legs, pop);
+	delete_actor(actor, &pop->actors);
+
+	// Legs and actors may have moved to other indices
+	reset_gait_schedule(&pop->gait);
+}
+
+
+void delete_attached_limbs(actor_id_t actor, limb_attachment_table_t *attachments, population_t *pop) {
+	FOR_ROWS(la, *attachments) {
+		if (!T_SAME_ID(attachments->owner[la], actor)) { continue; }
+		limb_id_t limb = attachments->limb[la];
+
+		// Let go of (and by) other limbs
+		limb_link_table_t *links = &pop->limb_tip_links;
+		FOR_ROWS(l, *links) {
+			if (T_SAME_ID(links->other_limb[l], limb)) { unlink_limb(links->dense_id[l--], links); }
+		}
+		if (limb_has_link(limb, links)) { unlink_limb(limb, links); }
+
+		delete_limb_goal(limb, &pop->limb_goals);
+		delete_limb_step(limb, &pop->limb_steps);
+		delete_limb_swing(limb, &pop->limb_swings);
+		detach_limb(limb, attachments);
+		delete_limb(limb, &pop->limbs);
+		la--;
+	}
+}
+
+
 limb_id_t create_arm(actor_id_t actor, vec3_t root_opos, population_t *pop) {
 	mat4_t to_world = get_actor_to_world_transform(actor, &pop->actors);
 
@@ -206,10 +296,22 @@ limb_id_t create_leg(actor_id_t actor, vec3_t root_opos, population_t *pop) {
 Terminate all the things.
 **/
 void term_app(app_t *app) {
-	// Free actor model
-	UnloadModel(*app->actor_model);
-	free(app->actor_model);
-	app->actor_model = NULL;
+	// Free actor model (if loaded)
+	if (app->actor_model) {
+		UnloadModel(*app->actor_model);
+		free(app->actor_model);
+		app->actor_model = NULL;
+	}
+}
+
+
+//// Recent changes
+
+/**
+Remember that the row with the given id changed (forgetting the oldest change, if need be).
+**/
+void note_change(uint16_t id, recent_changes_t *changes) {
+	changes->id[changes->num_changes++ % max_recent_changes] = id;
 }
 
 
@@ -221,8 +323,9 @@ actor_id_t create_actor(vec3_t pos, float rot, actor_table_t *table) {
 	assert(table->num_rows < max_actor_table_rows);
 
 	// Add row to sparse set
-	actor_id_t actor_id = { table->next_id++};
-	int index = table->num_rows++;
+	actor_id_t actor_id;
+	T_NEW_ID(*table, actor_id);
+	int index = T_ADD_ROW(*table);
 	table->sparse_id[actor_id.id] = index;
 	table->dense_id[index] = actor_id;
 
@@ -236,6 +339,25 @@ actor_id_t create_actor(vec3_t pos, float rot, actor_table_t *table) {
 	return actor_id;
 }
 
+/**
+Delete a single actor (its id will be handed out again, as a new generation).
+**/
+void delete_actor(actor_id_t actor, actor_table_t *table) {
+	unsigned index = T_INDEX(*table, actor);
+
+	// Remove data by copying the last row
+	unsigned m = --table->num_rows;
+	table->dense_id[index] = table->dense_id[m];
+	table->location[index] = table->location[m];
+	table->movement[index] = table->movement[m];
+	table->to_world[index] = table->to_world[m];
+	table->to_object[index] = table->to_object[m];
+
+	// Update sparse set
+	table->sparse_id[table->dense_id[index].id] = index;
+	T_FREE_ID(*table, actor);
+}
+
 actor_id_t get_actor_id(uint16_t index, const actor_table_t *table) {
 	return T_ID(*table, index);
 }
@@ -277,6 +399,25 @@ Set actor velocity (in world space).
 **/
 void set_actor_velocity(actor_id_t actor, vec3_t new_vel, actor_table_t *table) {
 	table->movement[T_INDEX(*table, actor)].velocity = new_vel;
+	note_change(actor.id, &table->steered);
+}
+
+
+/**
+Set how fast the actor turns (radians per second, around the y axis).
+**/
+void set_actor_rotation(actor_id_t actor, float rotation_y, actor_table_t *table) {
+	table->movement[T_INDEX(*table, actor)].rotation_y = rotation_y;
+	note_change(actor.id, &table->steered);
+}
+
+
+/**
+Turn the actor right away (by the given angle around the y axis).
+**/
+void turn_actor(actor_id_t actor, float angle_y, actor_table_t *table) {
+	table->location[T_INDEX(*table, actor)].orientation_y += angle_y;
+	note_change(actor.id, &table->steered);
 }
 
 /**
@@ -293,9 +434,14 @@ void calculate_actor_transforms(actor_table_t *table) {
 //// Limb CRUD
 
 /**
-Init the given limb table.
+Init the given limb table (empty, with every id unused).
 **/
 void init_limb_table(limb_table_t *table) {
+	table->num_rows = 0;
+	table->peak_rows = 0;
+	table->next_id = 0;
+	table->num_free_ids = 0;
+	FOR_IN(i, limb_table_id_range) { table->generation[i] = 0; }
 	init_cl_pool(table->bone_nodes, max_limb_table_segnemts);
 }
 
@@ -306,8 +452,9 @@ limb_id_t create_limb(vec3_t pos, quat_t ori, limb_table_t *table) {
 	assert(table->num_rows < max_limb_table_rows);
 
 	// Add row to sparse set
-	limb_id_t limb_id = { table->next_id++};
-	int index = table->num_rows++;
+	limb_id_t limb_id;
+	T_NEW_ID(*table, limb_id);
+	int index = T_ADD_ROW(*table);
 	table->sparse_id[limb_id.id] = index;
 	table->dense_id[index] = limb_id;
 
@@ -316,10 +463,64 @@ limb_id_t create_limb(vec3_t pos, quat_t ori, limb_table_t *table) {
 	table->orientation[index] = ori;
 	table->root_bone[index] = 0;
 	table->paired_with[index] = limb_id;
+	table->posed[index] = false;
+	table->ik_solver[index] = iks_fabrik;
+	table->tip_position[index] = pos;
+	table->ik_residual[index] = 0;
+	table->ik_clamps[index] = 0;
+	table->ik_passes[index] = 0;
+	table->ik_skipped_steps[index] = 0;
 
 	return limb_id;
 }
 
+/**
+Delete a limb and its bones (its id will be handed out again, as a new generation).
+
+Whatever it was paired with is left unpaired.
+**/
+void delete_limb(limb_id_t limb, limb_table_t *table) {
+	unsigned index = T_INDEX(*table, limb);
+
+	// Unpair
+	limb_id_t paired = table->paired_with[index];
+	if (!T_SAME_ID(paired, limb) && T_HAS_ID(*table, paired)) {
+		table->paired_with[T_INDEX(*table, paired)] = paired;
+	}
+
+	// Bones go back to the pool
+	if (table->root_bone[index]) {
+		release_cl_nodes(table->root_bone[index], table->bone_nodes);
+	}
+
+	// Remove data by copying the last row
+	unsigned m = --table->num_rows;
+	table->dense_id[index] = table->dense_id[m];
+	table->end_effector[index] = table->end_effector[m];
+	table->position[index] = table->position[m];
+	table->orientation[index] = table->orientation[m];
+	table->root_bone[index] = table->root_bone[m];
+	table->paired_with[index] = table->paired_with[m];
+	table->posed[index] = table->posed[m];
+	table->ik_solver[index] = table->ik_solver[m];
+	table->tip_position[index] = table->tip_position[m];
+	table->ik_residual[index] = table->ik_residual[m];
+	table->ik_clamps[index] = table->ik_clamps[m];
+	table->ik_passes[index] = table->ik_passes[m];
+	table->ik_skipped_steps[index] = table->ik_skipped_steps[m];
+
+	// Update sparse set
+	table->sparse_id[table->dense_id[index].id] = index;
+	T_FREE_ID(*table, limb);
+}
+
+/**
+Is the limb (still) around?
+**/
+bool limb_exists(limb_id_t limb, const limb_table_t *table) {
+	return T_HAS_ID(*table, limb);
+}
+
 /**
 Get the current limb at the given index.
 **/
@@ -353,31 +554,40 @@ vec3_t get_bone_joint_position(uint16_t bone_index, const limb_table_t *table) {
 
 
 /**
-Get the (calculated) world position of the bones tip.
+Get the world position of the bones tip (as of when the bone last moved).
 **/
 vec3_t get_bone_tip_position(uint16_t bone_index, const limb_table_t *table) {
 	assert(bone_index < max_limb_table_segnemts);
-	vec3_t joint_pos = table->bones[bone_index].joint_pos;
-	quat_t joint_ori = table->bones[bone_index].orientation;
-	float length = table->bones[bone_index].distance;
-	return vec3_add(joint_pos, quat_rotate_vec3(joint_ori, vec3(length, 0,0)));
+	return table->bone_tip[bone_index];
 }
 
 
 /**
-Get the position of the given limbs outermost bone tip.
+Get the position of the given limbs outermost bone tip (its root if it has no bones).
 **/
 vec3_t get_limb_tip_position(limb_id_t limb, const limb_table_t *table) {
-	int limb_index = T_INDEX(*table, limb);
+	return T_CELL(*table, limb, tip_position);
+}
+
+
+/**
+Work out the bone tips of the limb again (after its bones have moved).
 
-	// Get the root bone node
-	uint16_t root_bone_index = table->root_bone[limb_index];
-	assert(root_bone_index);
-	const cl_node_t *root_bone_node = &table->bone_nodes[root_bone_index];
+Tips are read far more often than bones move, so whatever moves bones
+refreshes them once instead of every reader rotating its way to them.
+**/
+void refresh_limb_tips(uint16_t limb_index, limb_table_t *table) {
+	vec3_t tip = table->position[limb_index];
+	int root_seg = table->root_bone[limb_index];
+	for (int seg = root_seg; seg; ) {
+		const bone_t *bone = &table->bones[seg];
+		tip = vec3_add(bone->joint_pos, quat_rotate_vec3(bone->orientation, vec3(bone->distance, 0,0)));
+		table->bone_tip[seg] = tip;
 
-	// Get the tip position
-	// (The node "before" the root is the last in a cyclic list)
-	return get_bone_tip_position(root_bone_node->prev_index, table);
+		seg = table->bone_nodes[seg].next_index;
+		if (seg == root_seg) { seg = 0; }
+	}
+	table->tip_position[limb_index] = tip;
 }
 
 /**
@@ -405,6 +615,21 @@ size_t collect_bones(limb_id_t limb, const limb_table_t *table, bone_t out[], si
 }
 
 
+/**
+Count the bones of a limb (by index).
+**/
+size_t count_limb_bones(uint16_t limb_index, const limb_table_t *table) {
+	int root_seg = table->root_bone[limb_index];
+	if (!root_seg) { return 0; }
+
+	size_t num = 1;
+	for (int seg = table->bone_nodes[root_seg].next_index; seg != root_seg; seg = table->bone_nodes[seg].next_index) {
+		num++;
+	}
+	return num;
+}
+
+
 /**
 Set the end effector of the given limb.
 **/
@@ -436,6 +661,8 @@ uint16_t add_bone_to_limb(limb_id_t limb, vec3_t pos, limb_table_t *table) {
 		// Set properties
 		vec3_t limb_pos = table->position[limb_index];
 		table->bones[new_seg] = bone_from_root_tip(limb_pos, pos);
+		choose_limb_ik_solver(limb_index, table);
+		refresh_limb_tips(limb_index, table);
 		return new_seg;
 	} else {
 		// Insert at end
@@ -445,11 +672,40 @@ uint16_t add_bone_to_limb(limb_id_t limb, vec3_t pos, limb_table_t *table) {
 		// Set properties
 		vec3_t last_seg_pos = get_bone_tip(table->bones[last_seg]);
 		table->bones[new_seg] = bone_from_root_tip(last_seg_pos, pos);
+		choose_limb_ik_solver(limb_index, table);
+		refresh_limb_tips(limb_index, table);
 		return new_seg;
 	}
 }
 
 
+/**
+Pick the IK solver that suits the bones the limb has now.
+**/
+void choose_limb_ik_solver(uint16_t limb_index, limb_table_t *table) {
+	bone_t bones[32];
+	size_t num_bones = collect_bones(table->dense_id[limb_index], table, bones, 32);
+	table->ik_solver[limb_index] = choose_ik_solver(bones, num_bones);
+}
+
+
+/**
+Find the limb that has the bone (-1 if none).
+**/
+int find_limb_of_bone(uint16_t bone_index, const limb_table_t *table) {
+	FOR_ROWS(l, *table) {
+		uint16_t root_seg = table->root_bone[l];
+		if (!root_seg) { continue; }
+		uint16_t seg = root_seg;
+		do {
+			if (seg == bone_index) { return l; }
+			seg = table->bone_nodes[seg].next_index;
+		} while (seg != root_seg);
+	}
+	return -1;
+}
+
+
 /**
 Couple two limbs with each other.
 **/
@@ -461,6 +717,9 @@ void pair_limbs(limb_id_t l1, limb_id_t l2, limb_table_t *table) {
 void apply_pole_constraint(uint16_t bone_index, limb_table_t *table) {
 	assert(bone_index < max_limb_table_segnemts);
 	table->bones[bone_index].constraint.type = jc_pole;
+
+	int limb_index = find_limb_of_bone(bone_index, table);
+	if (limb_index >= 0) { choose_limb_ik_solver(limb_index, table); }
 }
 
 
@@ -469,6 +728,9 @@ void apply_hinge_constraint(uint16_t bone_index, float min_ang, float max_ang, l
 	table->bones[bone_index].constraint.type = jc_hinge;
 	table->bones[bone_index].constraint.min_ang = min_ang;
 	table->bones[bone_index].constraint.max_ang = max_ang;
+
+	int limb_index = find_limb_of_bone(bone_index, table);
+	if (limb_index >= 0) { choose_limb_ik_solver(limb_index, table); }
 }
 
 /*
@@ -493,7 +755,7 @@ void attach_limb_to_actor(
 
 	assert(table->num_rows < max_limb_attachment_table_rows);
 
-	int n = table->num_rows++;
+	int n = T_ADD_ROW(*table);
 	table->owner[n] = actor;
 	table->limb[n] = limb;
 
@@ -503,6 +765,22 @@ void attach_limb_to_actor(
 	table->relative_position[n] = mat4_mul_vec4(to_obj, vec4_from_vec3(p, 1)).vec3;
 }
 
+/**
+Let go of the limb (if it's attached).
+**/
+void detach_limb(limb_id_t limb, limb_attachment_table_t *table) {
+	FOR_ROWS(la, *table) {
+		if (!T_SAME_ID(table->limb[la], limb)) { continue; }
+
+		// Remove data by copying the last row
+		unsigned m = --table->num_rows;
+		table->owner[la] = table->owner[m];
+		table->limb[la] = table->limb[m];
+		table->relative_position[la] = table->relative_position[m];
+		return;
+	}
+}
+
 /**
 Snap limb positions in place relative to their owning actor.
 **/
@@ -519,6 +797,7 @@ void reposition_attached_limbs(
 		vec3_t p = attachments->relative_position[la];
 		p = mat4_mul_vec4(actors->to_world[actor_index], vec4_from_vec3(p, 1)).vec3;
 		limbs->position[limb_index] = p;
+		if (!limbs->root_bone[limb_index]) { limbs->tip_position[limb_index] = p; }
 
 		// Reorient limb
 		float ori_y = actors->location[actor_index].orientation_y;
@@ -538,13 +817,14 @@ void link_limb_to(limb_id_t l1, limb_id_t l2, limb_link_table_t *table) {
 		assert(table->num_rows < max_limb_goal_table_rows);
 
 		// Add new row to sparse set
-		index = table->num_rows++;
+		index = T_ADD_ROW(*table);
 		table->sparse_id[l1.id] = index;
 		table->dense_id[index] = l1;
 	}
 
 	// Set row data
 	table->other_limb[index] = l2;
+	note_change(l1.id, &table->changed);
 }
 
 
@@ -569,6 +849,7 @@ void unlink_limb(limb_id_t limb, limb_link_table_t *table) {
 
 	// Update data
 	table->other_limb[index] = table->other_limb[m];
+	note_change(limb.id, &table->changed);
 }
 
 
@@ -589,7 +870,7 @@ void put_limb_goal(limb_id_t limb, vec3_t pos, float max_speed, float max_acc, l
 		assert(table->num_rows < max_limb_goal_table_rows);
 
 		// Add new row to sparse set
-		index = table->num_rows++;
+		index = T_ADD_ROW(*table);
 		table->sparse_id[limb.id] = index;
 		table->dense_id[index] = limb;
 
@@ -604,6 +885,7 @@ void put_limb_goal(limb_id_t limb, vec3_t pos, float max_speed, float max_acc, l
 	table->max_speed[index] = max_speed;
 	table->max_acceleration[index] = max_acc;
 	table->threshold[index] = 0.1;
+	note_change(limb.id, &table->changed);
 }
 
 /**
@@ -614,6 +896,7 @@ void push_limb_goal(limb_id_t limb, vec3_t pos, float speed, float acc, limb_goa
 		int goal_index = T_INDEX(*table, limb);
 		assert(table->curve_length[goal_index] < max_limb_goal_curve_points);
 		table->curve_points[goal_index][table->curve_length[goal_index]++] = pos;
+		note_change(limb.id, &table->changed);
 	} else {
 		put_limb_goal(limb, pos, speed, acc, table);
 	}
@@ -627,33 +910,78 @@ bool has_limb_goal(limb_id_t limb, const limb_goal_table_t *table) {
 }
 
 
+/**
+Least time it could take before the limb accomplishes its goal.
+
+(End effectors never move faster than the goals max speed, unless they
+already did when the goal was put or something else moves them, like a link
+or a new goal. Treat it as an estimate in that case.)
+**/
+float get_limb_goal_time_left(limb_id_t limb, const limb_goal_table_t *goals, const limb_table_t *limbs) {
+	if (!has_limb_goal(limb, goals)) { return 0; }
+	int goal_index = T_INDEX(*goals, limb);
+	float threshold = goals->threshold[goal_index];
+
+	// Reach each remaining point (or at least come close enough)
+	float distance = 0;
+	vec3_t from = get_limb_end_effector_position(limb, limbs);
+	float slack = threshold;
+	FOR_RANGE(i, goals->curve_index[goal_index], goals->curve_length[goal_index]) {
+		vec3_t to = goals->curve_points[goal_index][i];
+		distance += maxf(vec3_distance(from, to) - slack, 0);
+		from = to;
+		slack = 2 * threshold;
+	}
+
+	float speed = maxf(goals->max_speed[goal_index], vec3_length(goals->velocity[goal_index]));
+	return (speed > 0 ? distance / speed : INFINITY);
+}
+
+
 /**
 Delete all goals there the limb is close enough to it's intended destination.
 **/
 void delete_accomplished_limb_goals(const limb_table_t *limbs, limb_goal_table_t *goals) {
 	FOR_ROWS(goal_index, * goals) {
-		// Get limb data
 		limb_id_t limb = goals->dense_id[goal_index];
 		vec3_t ee_pos = get_limb_end_effector_position(limb, limbs);
 
-		// Get goal data
-		int8_t curve_index = goals->curve_index[goal_index];
-		vec3_t goal_pos = goals->curve_points[goal_index][curve_index];
-		float threshold = goals->threshold[goal_index];
-
-		// Advance only if close enough
-		float distance = vec3_distance(ee_pos, goal_pos);
-		if (distance > threshold) { continue; }
-		goals->curve_index[goal_index]++;
-
 		// Remove if at the end of the curve
-		if (goals->curve_index[goal_index] >= goals->curve_length[goal_index]) {
+		if (advance_limb_goal(goal_index, ee_pos, goals)) {
 			delete_limb_goal_at_index(goal_index--, goals);
 		}
 	}
 }
 
 
+/**
+Move on to the next point of the goal if the end effector is close enough.
+
+Returns true once the goal is accomplished (past its last point).
+**/
+bool advance_limb_goal(unsigned goal_index, vec3_t ee_pos, limb_goal_table_t *goals) {
+	// Get goal data
+	int8_t curve_index = goals->curve_index[goal_index];
+	vec3_t goal_pos = goals->curve_points[goal_index][curve_index];
+	float threshold = goals->threshold[goal_index];
+
+	// Advance only if close enough
+	float distance = vec3_distance(ee_pos, goal_pos);
+	if (distance <= threshold) { goals->curve_index[goal_index]++; }
+	return goals->curve_index[goal_index] >= goals->curve_length[goal_index];
+}
+
+
+/**
+Forget the limbs goal (if it has one).
+**/
+void delete_limb_goal(limb_id_t limb, limb_goal_table_t *table) {
+	if (!T_HAS_ID(*table, limb)) { return; }
+	delete_limb_goal_at_index(T_INDEX(*table, limb), table);
+	note_change(limb.id, &table->changed);
+}
+
+
 void delete_limb_goal_at_index(unsigned index, limb_goal_table_t *table) {
 	assert(index < table->num_rows);
 
@@ -675,13 +1003,118 @@ void delete_limb_goal_at_index(unsigned index, limb_goal_table_t *table) {
 }
 
 
-//// Limb swing CRUD ////
+//// Limb step CRUD ////
+
 /**
-Create a swing behaviour for the given limb.
+Give the limb end effector a step to follow (replacing any it already has).
 
-TODO: Make this actually swing the limb like a pendelum.
+The end effector will be on the cubic Bezier curve through the control
+points, at the start when the step starts and at the end once it's done.
+**/
+void put_limb_step(
+		limb_id_t limb, double start_time, float duration, const vec3_t control_points[],
+		limb_step_table_t *table) {
+
+	assert(duration > 0);
+
+	// Figgure out where to put the data
+	int index;
+	if (T_HAS_ID(*table, limb)) {
+		index = T_INDEX(*table, limb);
+	} else {
+		// Check that there is room
+		assert(table->num_rows < max_limb_step_table_rows);
+
+		// Add new row to sparse set
+		index = T_ADD_ROW(*table);
+		table->sparse_id[limb.id] = index;
+		table->dense_id[index] = limb;
+	}
+
+	// Set row data
+	table->start_time[index] = start_time;
+	table->duration[index] = duration;
+	FOR_IN(i, num_limb_step_control_points) {
+		table->control_points[index][i] = control_points[i];
+	}
+}
+
+/**
+Does this limb have a step?
+**/
+bool has_limb_step(limb_id_t limb, const limb_step_table_t *table) {
+	return T_HAS_ID(*table, limb);
+}
+
+
+/**
+Where the end effector should be at the given time (clamped to the ends of the step).
+**/
+vec3_t get_limb_step_position(unsigned index, double time, const limb_step_table_t *table) {
+	assert(index < table->num_rows);
+	float s = (float) ((time - table->start_time[index]) / table->duration[index]);
+	s = minf(maxf(s, 0), 1);
+	const vec3_t *p = table->control_points[index];
+	return vec3_bezier(s, p[0], p[1], p[2], p[3]);
+}
+
+
+/**
+Time left (from the given time) until the limb is done with its step.
+**/
+float get_limb_step_time_left(limb_id_t limb, double time, const limb_step_table_t *table) {
+	if (!has_limb_step(limb, table)) { return 0; }
+	int index = T_INDEX(*table, limb);
+	return maxf((float) (table->start_time[index] + table->duration[index] - time), 0);
+}
+
+
+/**
+Delete all steps that are over by the given time.
+**/
+void delete_finished_limb_steps(double time, limb_step_table_t *steps) {
+	FOR_ROWS(step_index, *steps) {
+		if (time < steps->start_time[step_index] + steps->duration[step_index]) { continue; }
+		delete_limb_step_at_index(step_index--, steps);
+	}
+}
+
+
+/**
+Stop the limbs step (if it's taking one).
+**/
+void delete_limb_step(limb_id_t limb, limb_step_table_t *table) {
+	if (!T_HAS_ID(*table, limb)) { return; }
+	delete_limb_step_at_index(T_INDEX(*table, limb), table);
+}
+
+
+void delete_limb_step_at_index(unsigned index, limb_step_table_t *table) {
+	assert(index < table->num_rows);
+
+	// Remove data by copying another row
+	unsigned m = --table->num_rows;
+	table->dense_id[index] = table->dense_id[m];
+	table->start_time[index] = table->start_time[m];
+	table->duration[index] = table->duration[m];
+	FOR_IN(i, num_limb_step_control_points) {
+		table->control_points[index][i] = table->control_points[m][i];
+	}
+
+	// Update sparse set
+	table->sparse_id[table->dense_id[index].id] = index;
+}
+
+
+//// Limb swing CRUD ////
+/**
+Let the limb swing (starting out at rest in its current pose).
+The limb may have at most max_limb_swing_points bones.
 **/
 void create_limb_swing(limb_id_t limb, const limb_table_t *limbs, limb_swing_table_t *table) {
+	// Check that every bone gets a point (rather than swinging only the first few)
+	assert(count_limb_bones(get_limb_index(limb, limbs), limbs) <= max_limb_swing_points);
+
 	int index;
 	if (T_HAS_ID(*table, limb)) {
 		index = T_INDEX(*table, limb);
@@ -690,12 +1123,132 @@ void create_limb_swing(limb_id_t limb, const limb_table_t *limbs, limb_swing_tab
 		assert(table->num_rows < max_limb_swing_table_rows);
 
 		// Add new row to sparse set
-		index = table->num_rows++;
+		index = T_ADD_ROW(*table);
 		table->sparse_id[limb.id] = index;
 		table->dense_id[index] = limb;
 	}
 
-	table->prev_position[index] = get_limb_tip_position(limb, limbs);
+	// One point at the tip of each bone
+	bone_t bones[max_limb_swing_points];
+	size_t num_bones = collect_bones(limb, limbs, bones, max_limb_swing_points);
+	assert(num_bones > 0);
+	table->num_points[index] = num_bones;
+	FOR_IN(p, max_limb_swing_points) {
+		vec3_t tip = get_bone_tip(bones[(size_t) p < num_bones ? p : num_bones - 1]);
+		table->rest_length[p][index] = ((size_t) p < num_bones ? bones[p].distance : 0);
+		table->prev_x[p][index] = tip.x;
+		table->prev_y[p][index] = tip.y;
+		table->prev_z[p][index] = tip.z;
+	}
+}
+
+
+/**
+Stop swinging the limb (if it does).
+**/
+void delete_limb_swing(limb_id_t limb, limb_swing_table_t *table) {
+	if (!T_HAS_ID(*table, limb)) { return; }
+	unsigned index = T_INDEX(*table, limb);
+
+	// Remove data by copying the last row
+	unsigned m = --table->num_rows;
+	table->dense_id[index] = table->dense_id[m];
+	table->num_points[index] = table->num_points[m];
+	FOR_IN(p, max_limb_swing_points) {
+		table->rest_length[p][index] = table->rest_length[p][m];
+		table->prev_x[p][index] = table->prev_x[p][m];
+		table->prev_y[p][index] = table->prev_y[p][m];
+		table->prev_z[p][index] = table->prev_z[p][m];
+	}
+
+	// Update sparse set
+	table->sparse_id[table->dense_id[index].id] = index;
+}
+
+
+//// Gait schedule CRUD ////
+
+static const uint16_t not_queued = UINT16_MAX;
+
+void swap_gait_heap_nodes(uint16_t a, uint16_t b, gait_schedule_t *gait) {
+	uint16_t leg_a = gait->heap[a], leg_b = gait->heap[b];
+	gait->heap[a] = leg_b;
+	gait->heap[b] = leg_a;
+	gait->heap_index[leg_b] = a;
+	gait->heap_index[leg_a] = b;
+}
+
+void sift_gait_heap_node(uint16_t node, gait_schedule_t *gait) {
+	#define WAKE(n) gait->wake_time[gait->heap[n]]
+
+	// Up (toward earlier)
+	while (node > 0 && WAKE((node - 1) / 2) > WAKE(node)) {
+		swap_gait_heap_nodes(node, (node - 1) / 2, gait);
+		node = (node - 1) / 2;
+	}
+
+	// Down (toward later)
+	while (true) {
+		uint16_t earliest = node;
+		uint16_t left = 2 * node + 1, right = 2 * node + 2;
+		if (left < gait->num_queued && WAKE(left) < WAKE(earliest)) { earliest = left; }
+		if (right < gait->num_queued && WAKE(right) < WAKE(earliest)) { earliest = right; }
+		if (earliest == node) { break; }
+		swap_gait_heap_nodes(node, earliest, gait);
+		node = earliest;
+	}
+
+	#undef WAKE
+}
+
+
+/**
+Look at the leg again at the given time (replacing any earlier wake time).
+
+Legs (attachment indices) not seen before join the schedule.
+**/
+void schedule_leg(uint16_t leg, double wake_time, gait_schedule_t *gait) {
+	assert(leg < max_gait_schedule_legs);
+
+	// New legs start outside of the queue
+	while (gait->num_legs <= leg) {
+		gait->heap_index[gait->num_legs++] = not_queued;
+	}
+
+	gait->wake_time[leg] = wake_time;
+	if (gait->heap_index[leg] == not_queued) {
+		uint16_t node = gait->num_queued++;
+		gait->heap[node] = leg;
+		gait->heap_index[leg] = node;
+	}
+	sift_gait_heap_node(gait->heap_index[leg], gait);
+}
+
+
+/**
+Forget every leg (so they all join again as new legs, and are looked at right away).
+
+Needed whenever legs or actors change index. Posed actors start over too
+(at whichever phase suits how they stand).
+**/
+void reset_gait_schedule(gait_schedule_t *gait) {
+	gait->num_legs = 0;
+	gait->num_queued = 0;
+	memset(gait->posed, 0, sizeof(gait->posed));
+}
+
+
+/**
+Take the leg that should be woken first, if it's due at the given time.
+**/
+bool pop_due_leg(double time, uint16_t *leg, gait_schedule_t *gait) {
+	if (gait->num_queued == 0 || gait->wake_time[gait->heap[0]] > time) { return false; }
+
+	*leg = gait->heap[0];
+	swap_gait_heap_nodes(0, --gait->num_queued, gait);
+	gait->heap_index[*leg] = not_queued;
+	if (gait->num_queued > 0) { sift_gait_heap_node(0, gait); }
+	return true;
 }
 
 
@@ -719,9 +1272,11 @@ void create_terrain_block(float x1, float x2, float z1, float z2, float height,
 
 /**
 Get the height above the y-plane at (x,z).
+
+Blocks show where they reach above the streamed tiles (if there are any).
 **/
 float get_terrain_height(float x, float z, const terrain_table_t *table) {
-	float h = 0;
+	float h = (table->stream ? get_streamed_terrain_height(x, z, table->stream) : 0);
 	FOR_ROWS(i, *table) {
 		if ( x < table->block[i].x1) { continue; }
 		if ( x > table->block[i].x2) { continue; }
@@ -780,3 +1335,19 @@ unsigned short append_cl_node_after(unsigned short anchor, cl_node_t pool[]) {
 
 	return new_node;
 }
+
+
+/*
+Give all nodes of a cyclic list back to the pool.
+*/
+void release_cl_nodes(unsigned short any_node, cl_node_t pool[]) {
+	assert(any_node != 0);
+	unsigned short first = any_node, last = pool[any_node].prev_index;
+
+	// Splice the whole list in after the pool head
+	unsigned short next_free = pool[0].next_index;
+	pool[0].next_index = first;
+	pool[first].prev_index = 0;
+	pool[last].next_index = next_free;
+	pool[next_free].prev_index = last;
+}
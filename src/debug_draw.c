@@ -0,0 +1,110 @@
+#include <assert.h>
+
+#define IN_DEBUG_DRAW
+#include "overview.h"
+
+debug_draw_command_t *push_debug_draw_command(debug_draw_type_e, debug_draw_color_t, debug_draw_buffer_t *);
+
+
+//// Debug draw buffer ////
+
+/**
+Forget all commands in the buffer (to start on a new frame).
+**/
+void clear_debug_draw_buffer(debug_draw_buffer_t *buffer) {
+	buffer->num_commands = 0;
+	buffer->num_dropped = 0;
+	FOR_IN(t, num_debug_draw_types) { buffer->num_of_type[t] = 0; }
+}
+
+
+/**
+Reserve the next command in the buffer (or NULL if the buffer is full).
+**/
+debug_draw_command_t *push_debug_draw_command(
+		debug_draw_type_e type, debug_draw_color_t color,
+		debug_draw_buffer_t *buffer) {
+
+	assert(type < num_debug_draw_types);
+	if (buffer->num_commands >= max_debug_draw_commands) {
+		buffer->num_dropped++;
+		return NULL;
+	}
+
+	debug_draw_command_t *command = &buffer->commands[buffer->num_commands++];
+	command->type = type;
+	command->color = color;
+	buffer->num_of_type[type]++;
+	return command;
+}
+
+
+void push_debug_line(vec3_t from, vec3_t to, debug_draw_color_t color, debug_draw_buffer_t *buffer) {
+	debug_draw_command_t *command = push_debug_draw_command(dd_line, color, buffer);
+	if (!command) { return; }
+	command->a = from;
+	command->b = to;
+}
+
+
+void push_debug_sphere(vec3_t center, float radius, debug_draw_color_t color, debug_draw_buffer_t *buffer) {
+	debug_draw_command_t *command = push_debug_draw_command(dd_sphere, color, buffer);
+	if (!command) { return; }
+	command->a = center;
+	command->size = radius;
+}
+
+
+/**
+Orientation gizmo (red x-axis, green y-axis and blue z-axis).
+**/
+void push_debug_gizmo(vec3_t pos, quat_t ori, float length, debug_draw_buffer_t *buffer) {
+	debug_draw_color_t white = { 255, 255, 255, 255 };
+	debug_draw_command_t *command = push_debug_draw_command(dd_gizmo, white, buffer);
+	if (!command) { return; }
+	command->a = pos;
+	command->ori = ori;
+	command->size = length;
+}
+
+
+void push_debug_box(vec3_t center, vec3_t size, debug_draw_color_t color, debug_draw_buffer_t *buffer) {
+	debug_draw_command_t *command = push_debug_draw_command(dd_box, color, buffer);
+	if (!command) { return; }
+	command->a = center;
+	command->b = size;
+}
+
+
+/**
+Actor model placed at the given location.
+**/
+void push_debug_actor(location_t location, debug_draw_color_t color, debug_draw_buffer_t *buffer) {
+	debug_draw_command_t *command = push_debug_draw_command(dd_actor, color, buffer);
+	if (!command) { return; }
+	command->a = location.position;
+	command->size = location.orientation_y;
+}
+
+
+/**
+Order commands by type (keeping the order within each type).
+
+Afterwards 'order' lists command indices so that all commands of the same
+primitive type can be submitted in one go.
+**/
+void sort_debug_draw_buffer(debug_draw_buffer_t *buffer) {
+	// Where each type starts
+	uint16_t offset[num_debug_draw_types];
+	uint16_t next = 0;
+	FOR_IN(t, num_debug_draw_types) {
+		offset[t] = next;
+		next += buffer->num_of_type[t];
+	}
+	assert(next == buffer->num_commands);
+
+	// Distribute
+	FOR_IN(c, buffer->num_commands) {
+		buffer->order[offset[buffer->commands[c].type]++] = c;
+	}
+}
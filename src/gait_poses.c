@@ -0,0 +1,387 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#define IN_GAIT_POSES
+#include "overview.h"
+
+// Baking
+enum {
+	max_gait_bake_steps = 60 * 30,
+	gait_bake_warm_up_cycles = 2, // (Until legs settle into their rhythm)
+};
+
+// Ground that differs less than this is flat, sampled in a grid over what feet reach
+static const float gait_flat_ground_tolerance = 1e-4f;
+enum { gait_ground_samples_per_side = 5 };
+
+/** Bones of every leg of an actor, relative to it. **/
+typedef struct gait_frame_ {
+	vec3_t joint_pos[max_gait_pose_legs][max_gait_pose_bones];
+	quat_t orientation[max_gait_pose_legs][max_gait_pose_bones];
+} gait_frame_t;
+
+size_t collect_actor_legs(uint16_t actor_index, const animation_env_i *, uint16_t legs[], size_t max, bool *too_many);
+bool is_leg_moving(uint16_t leg, const animation_env_i *);
+void capture_gait_frame(
+	uint16_t actor_index, const uint16_t legs[], size_t num_legs, const animation_env_i *,
+	gait_frame_t *, float length[][max_gait_pose_bones]);
+bool fits_gait_pose_table(uint16_t actor_index, const uint16_t legs[], size_t num_legs, const gait_pose_table_t *, const animation_env_i *);
+bool is_ground_flat_around(vec3_t pos, float reach, const terrain_table_t *);
+float find_closest_gait_phase(uint16_t actor_index, float speed, const uint16_t legs[], size_t num_legs, const gait_pose_table_t *, const animation_env_i *);
+float get_gait_period(float speed, const gait_pose_table_t *);
+void sample_gait_pose(float speed, float phase, unsigned leg, unsigned bone, const gait_pose_table_t *, vec3_t *joint_pos, quat_t *orientation);
+void pose_actor_legs(uint16_t actor_index, float speed, float phase, const uint16_t legs[], size_t num_legs, const gait_pose_table_t *, const animation_env_i *);
+
+
+//// Gait baking ////
+
+/**
+Walk a person across flat ground at each of the given speeds (lowest first),
+and keep the poses of its legs over one cycle of their gait.
+
+A cycle starts as the first leg takes a step, and ends as it takes the next.
+Returns false if legs never settle into a cycle at some speed.
+**/
+bool bake_gait_poses(
+		const gait_params_t *params, const float speeds[], size_t num_speeds, float dt,
+		gait_pose_table_t *out) {
+	assert(num_speeds > 0 && num_speeds <= max_gait_pose_speeds);
+	*out = (gait_pose_table_t){ 0 };
+
+	landscape_t *land = calloc(1, sizeof(landscape_t));
+	population_t *pop = calloc(1, sizeof(population_t));
+	gait_frame_t *frames = malloc(max_gait_bake_steps * sizeof(gait_frame_t));
+	bool ok = land && pop && frames;
+	if (ok) { land->gait_params = *params; }
+
+	for (size_t s = 0; ok && s < num_speeds; s++) {
+		assert(speeds[s] > 0 && (s == 0 || speeds[s] > speeds[s - 1]));
+
+		// One person walking straight ahead
+		*pop = (population_t){ 0 };
+		init_limb_table(&pop->limbs);
+		pop->fuse_limb_updates = true;
+		actor_id_t actor = create_person(vec3(0, 3, 0), 0, pop);
+		set_actor_velocity(actor, vec3_mul(get_actor_forward_dir(actor, &pop->actors), speeds[s]), &pop->actors);
+		animation_env_i env = {
+			&pop->actors, &pop->arms, &pop->legs, &land->ground, &land->gait_params,
+			&pop->limbs, &pop->limb_goals, &pop->limb_steps, &pop->limb_tip_links, &pop->gait, 0, false
+		};
+		uint16_t actor_index = get_actor_index(actor, &pop->actors);
+		uint16_t legs[max_gait_pose_legs];
+		bool too_many_legs;
+		size_t num_legs = collect_actor_legs(actor_index, &env, legs, max_gait_pose_legs, &too_many_legs);
+		if (num_legs == 0 || too_many_legs) {
+			ok = false;
+			break;
+		}
+		out->num_legs = num_legs;
+		out->num_bones = count_limb_bones(get_limb_index(pop->legs.limb[legs[0]], &pop->limbs), &pop->limbs);
+		assert(out->num_bones <= max_gait_pose_bones);
+		gait_frame_t rest;
+		float length[max_gait_pose_legs][max_gait_pose_bones];
+		capture_gait_frame(actor_index, legs, num_legs, &env, &rest, length);
+
+		// Walk until the first leg has stepped off often enough (keeping every frame)
+		size_t cycle_start[gait_bake_warm_up_cycles + 2];
+		size_t num_starts = 0, num_frames = 0;
+		bool was_moving = false;
+		while (num_starts < gait_bake_warm_up_cycles + 2 && num_frames < max_gait_bake_steps) {
+			update_population(dt, land, pop);
+			bool moving = is_leg_moving(legs[0], &env);
+			if (moving && !was_moving) { cycle_start[num_starts++] = num_frames; }
+			was_moving = moving;
+			capture_gait_frame(actor_index, legs, num_legs, &env, &frames[num_frames++], NULL);
+		}
+		if (num_starts < gait_bake_warm_up_cycles + 2) {
+			ok = false;
+			break;
+		}
+
+		// Resample the last cycle at evenly spread phases
+		size_t first = cycle_start[gait_bake_warm_up_cycles], last = cycle_start[gait_bake_warm_up_cycles + 1];
+		out->speed[s] = speeds[s];
+		out->period[s] = (last - first) * dt;
+		FOR_IN(p, num_gait_pose_phases) {
+			float f = first + (float) (last - first) * p / num_gait_pose_phases;
+			size_t f0 = (size_t) f;
+			float t = f - f0;
+			FOR_IN(l, num_legs) {
+				FOR_IN(b, out->num_bones) {
+					vec3_t joint = vec3_lerp(t, frames[f0].joint_pos[l][b], frames[f0 + 1].joint_pos[l][b]);
+					out->joint_pos[s][p][l][b] = joint;
+					out->orientation[s][p][l][b] = quat_nlerp(t, frames[f0].orientation[l][b], frames[f0 + 1].orientation[l][b]);
+
+					// (How far from the actor bones reach, on the ground plane)
+					vec3_t tip = get_bone_tip((bone_t){
+						.joint_pos = joint, .orientation = out->orientation[s][p][l][b], .distance = length[l][b] });
+					out->reach = maxf(out->reach, maxf(fabsf(joint.x), fabsf(joint.z)));
+					out->reach = maxf(out->reach, maxf(fabsf(tip.x), fabsf(tip.z)));
+				}
+			}
+		}
+		out->num_speeds = s + 1;
+	}
+
+	free(frames);
+	free(pop);
+	free(land);
+	return ok;
+}
+
+
+/**
+Leg attachments (by index) of the actor, in the order they were attached.
+
+Returns how many were written (at most max), and whether there were more.
+**/
+size_t collect_actor_legs(uint16_t actor_index, const animation_env_i *env, uint16_t legs[], size_t max, bool *too_many) {
+	size_t num = 0;
+	*too_many = false;
+	FOR_ROWS(i, *env->leg_attachments) {
+		if (get_actor_index(env->leg_attachments->owner[i], env->actors) != actor_index) { continue; }
+		if (num == max) {
+			*too_many = true;
+			break;
+		}
+		legs[num++] = i;
+	}
+	return num;
+}
+
+
+bool is_leg_moving(uint16_t leg, const animation_env_i *env) {
+	limb_id_t limb = env->leg_attachments->limb[leg];
+	return has_limb_goal(limb, env->goals) || has_limb_step(limb, env->steps);
+}
+
+
+/**
+Bones of the legs relative to the actor (as they are now), and how long they are (if asked for).
+**/
+void capture_gait_frame(
+		uint16_t actor_index, const uint16_t legs[], size_t num_legs, const animation_env_i *env,
+		gait_frame_t *frame, float length[][max_gait_pose_bones]) {
+	const limb_table_t *limbs = env->limbs;
+	const mat4_t to_object = env->actors->to_object[actor_index];
+
+	FOR_IN(l, num_legs) {
+		int limb_index = get_limb_index(env->leg_attachments->limb[legs[l]], limbs);
+		quat_t to_object_ori = quat_conjugate(limbs->orientation[limb_index]);
+		uint16_t bone = limbs->root_bone[limb_index];
+		FOR_IN(b, max_gait_pose_bones) {
+			frame->joint_pos[l][b] = mat4_mul_vec3(to_object, limbs->bones[bone].joint_pos, 1);
+			frame->orientation[l][b] = quat_mul(to_object_ori, limbs->bones[bone].orientation);
+			if (length) { length[l][b] = limbs->bones[bone].distance; }
+			bone = limbs->bone_nodes[bone].next_index;
+			if (bone == limbs->root_bone[limb_index]) { break; }
+		}
+	}
+}
+
+
+//// Gait playback ////
+
+/**
+Walk actors by baked poses instead of stepping their legs (and moving them
+by IK), wherever that looks the same.
+
+That is when an actor walks straight ahead at a baked speed, on ground that
+is flat as far as its feet reach, away from the focus. Actors start once
+both feet are down (at the phase closest to how they stand), and step their
+legs again from wherever the poses left them once any of that changes.
+**/
+void play_back_gaits(float dt, const gait_playback_t *playback, const animation_env_i *env) {
+	const gait_pose_table_t *poses = playback->poses;
+	const actor_table_t *actors = env->actors;
+	limb_table_t *limbs = env->limbs;
+	gait_schedule_t *gait = env->gait;
+
+	FOR_ROWS(a, *actors) {
+		uint16_t legs[max_gait_pose_legs];
+		bool too_many_legs;
+		size_t num_legs = collect_actor_legs(a, env, legs, max_gait_pose_legs, &too_many_legs);
+		if (num_legs == 0) { continue; }
+		actor_id_t actor = get_actor_id(a, actors);
+		vec3_t vel = get_actor_velocity_in_object_space(actor, actors);
+		vec3_t pos = actors->location[a].position;
+
+		// Does it look the same?
+		bool fits =
+			!too_many_legs && fits_gait_pose_table(a, legs, num_legs, poses, env) &&
+			vel.x >= poses->speed[0] && vel.x <= poses->speed[poses->num_speeds - 1] &&
+			fabsf(vel.z) < 1e-3f && actors->movement[a].rotation_y == 0 &&
+			vec3_distance(pos, playback->focus) > playback->focus_radius &&
+			is_ground_flat_around(pos, poses->reach, env->ground);
+
+		// Start (with both feet down) or stop
+		if (fits && !gait->posed[a]) {
+			bool feet_down = true;
+			FOR_IN(l, num_legs) { feet_down &= !is_leg_moving(legs[l], env); }
+			if (feet_down) {
+				gait->posed[a] = true;
+				gait->phase[a] = find_closest_gait_phase(a, vel.x, legs, num_legs, poses, env);
+			}
+		} else if (!fits) {
+			gait->posed[a] = false;
+		}
+
+		// Legs follow their actor (and are looked at right away when let go)
+		FOR_IN(l, num_legs) {
+			int limb_index = get_limb_index(env->leg_attachments->limb[legs[l]], limbs);
+			if (limbs->posed[limb_index] && !gait->posed[a]) { schedule_leg(legs[l], env->time, gait); }
+			limbs->posed[limb_index] = gait->posed[a];
+		}
+		if (!gait->posed[a]) { continue; }
+
+		// Pose
+		pose_actor_legs(a, vel.x, gait->phase[a], legs, num_legs, poses, env);
+		gait->phase[a] = fmodf(gait->phase[a] + dt / get_gait_period(vel.x, poses), 1.f);
+	}
+}
+
+
+/**
+Does the actor have legs like the ones the poses were baked with?
+**/
+bool fits_gait_pose_table(
+		uint16_t actor_index, const uint16_t legs[], size_t num_legs,
+		const gait_pose_table_t *poses, const animation_env_i *env) {
+	if (poses->num_speeds == 0 || num_legs != poses->num_legs) { return false; }
+	FOR_IN(l, num_legs) {
+		int limb_index = get_limb_index(env->leg_attachments->limb[legs[l]], env->limbs);
+		if (count_limb_bones(limb_index, env->limbs) != poses->num_bones) { return false; }
+	}
+	return true;
+}
+
+
+/**
+Is the ground the same height all over the square the feet reach (as far as a grid of samples can tell)?
+**/
+bool is_ground_flat_around(vec3_t pos, float reach, const terrain_table_t *ground) {
+	float h = get_terrain_height(pos.x, pos.z, ground);
+	FOR_IN(j, gait_ground_samples_per_side) {
+		FOR_IN(i, gait_ground_samples_per_side) {
+			float x = pos.x - reach + 2 * reach * i / (gait_ground_samples_per_side - 1);
+			float z = pos.z - reach + 2 * reach * j / (gait_ground_samples_per_side - 1);
+			if (fabsf(get_terrain_height(x, z, ground) - h) > gait_flat_ground_tolerance) { return false; }
+		}
+	}
+	return true;
+}
+
+
+/**
+The phase where the feet are closest to where they are now (relative to the actor).
+**/
+float find_closest_gait_phase(
+		uint16_t actor_index, float speed, const uint16_t legs[], size_t num_legs,
+		const gait_pose_table_t *poses, const animation_env_i *env) {
+	const limb_table_t *limbs = env->limbs;
+	const mat4_t to_object = env->actors->to_object[actor_index];
+
+	// Feet (and how long the last bones are)
+	vec3_t foot[max_gait_pose_legs];
+	float foot_length[max_gait_pose_legs];
+	FOR_IN(l, num_legs) {
+		int limb_index = get_limb_index(env->leg_attachments->limb[legs[l]], limbs);
+		foot[l] = mat4_mul_vec3(to_object, limbs->tip_position[limb_index], 1);
+		uint16_t last_bone = limbs->bone_nodes[limbs->root_bone[limb_index]].prev_index;
+		foot_length[l] = limbs->bones[last_bone].distance;
+	}
+
+	unsigned best = 0;
+	float best_distance = INFINITY;
+	FOR_IN(p, num_gait_pose_phases) {
+		float distance = 0;
+		float phase = (float) p / num_gait_pose_phases;
+		FOR_IN(l, num_legs) {
+			vec3_t joint;
+			quat_t ori;
+			sample_gait_pose(speed, phase, l, poses->num_bones - 1, poses, &joint, &ori);
+			vec3_t tip = get_bone_tip((bone_t){ .joint_pos = joint, .orientation = ori, .distance = foot_length[l] });
+			distance += vec3_distance(tip, foot[l]);
+		}
+		if (distance < best_distance) {
+			best_distance = distance;
+			best = p;
+		}
+	}
+	return (float) best / num_gait_pose_phases;
+}
+
+
+/**
+Put the bones of the legs where the poses have them, and leave their end effectors at the tips.
+**/
+void pose_actor_legs(
+		uint16_t actor_index, float speed, float phase, const uint16_t legs[], size_t num_legs,
+		const gait_pose_table_t *poses, const animation_env_i *env) {
+	limb_table_t *limbs = env->limbs;
+	const mat4_t to_world = env->actors->to_world[actor_index];
+
+	FOR_IN(l, num_legs) {
+		int limb_index = get_limb_index(env->leg_attachments->limb[legs[l]], limbs);
+		quat_t to_world_ori = limbs->orientation[limb_index];
+		uint16_t bone = limbs->root_bone[limb_index];
+		FOR_IN(b, poses->num_bones) {
+			vec3_t joint;
+			quat_t ori;
+			sample_gait_pose(speed, phase, l, b, poses, &joint, &ori);
+			limbs->bones[bone].joint_pos = mat4_mul_vec3(to_world, joint, 1);
+			limbs->bones[bone].orientation = quat_mul(to_world_ori, ori);
+			bone = limbs->bone_nodes[bone].next_index;
+		}
+		refresh_limb_tips(limb_index, limbs);
+		limbs->end_effector[limb_index] = limbs->tip_position[limb_index];
+
+		// (Nothing for IK to do)
+		limbs->ik_residual[limb_index] = 0;
+		limbs->ik_clamps[limb_index] = 0;
+		limbs->ik_passes[limb_index] = 0;
+		limbs->ik_skipped_steps[limb_index] = 0;
+	}
+}
+
+
+//// Pose sampling ////
+
+/**
+How long a whole cycle takes at the speed (between the baked ones).
+**/
+float get_gait_period(float speed, const gait_pose_table_t *poses) {
+	if (poses->num_speeds == 1) { return poses->period[0]; }
+	unsigned s = 0;
+	while (s + 2 < poses->num_speeds && speed > poses->speed[s + 1]) { s++; }
+	float t = minf(maxf((speed - poses->speed[s]) / (poses->speed[s + 1] - poses->speed[s]), 0), 1);
+	return poses->period[s] + (poses->period[s + 1] - poses->period[s]) * t;
+}
+
+
+/**
+Pose of a bone (relative to the actor) at the speed and phase, blended
+between the closest baked ones.
+**/
+void sample_gait_pose(
+		float speed, float phase, unsigned leg, unsigned bone,
+		const gait_pose_table_t *poses, vec3_t *joint_pos, quat_t *orientation) {
+	// Speeds around it
+	unsigned s0 = 0;
+	while (s0 + 2 < poses->num_speeds && speed > poses->speed[s0 + 1]) { s0++; }
+	unsigned s1 = (poses->num_speeds > 1 ? s0 + 1 : s0);
+	float ts = (s1 > s0 ? minf(maxf((speed - poses->speed[s0]) / (poses->speed[s1] - poses->speed[s0]), 0), 1) : 0);
+
+	// Phases around it (wrapping around at the end of the cycle)
+	float f = phase * num_gait_pose_phases;
+	unsigned p0 = (unsigned) f % num_gait_pose_phases, p1 = (p0 + 1) % num_gait_pose_phases;
+	float tp = f - floorf(f);
+
+	vec3_t j0 = vec3_lerp(tp, poses->joint_pos[s0][p0][leg][bone], poses->joint_pos[s0][p1][leg][bone]);
+	vec3_t j1 = vec3_lerp(tp, poses->joint_pos[s1][p0][leg][bone], poses->joint_pos[s1][p1][leg][bone]);
+	quat_t q0 = quat_nlerp(tp, poses->orientation[s0][p0][leg][bone], poses->orientation[s0][p1][leg][bone]);
+	quat_t q1 = quat_nlerp(tp, poses->orientation[s1][p0][leg][bone], poses->orientation[s1][p1][leg][bone]);
+	*joint_pos = vec3_lerp(ts, j0, j1);
+	*orientation = quat_nlerp(ts, q0, q1);
+}
@@ -0,0 +1,81 @@
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#define IN_IK_METRICS
+#include "overview.h"
+
+// About 3x apart, from well below what shows up to clearly missing
+const float ik_residual_bucket_limits[num_ik_residual_buckets] = {
+	1e-4f, 3e-4f, 1e-3f, 3e-3f, 0.01f, 0.03f, 0.1f, 0.3f, 1.f, INFINITY,
+};
+
+
+//// IK metrics ////
+
+/**
+Sum up how the latest IK of every limb went (residuals, clamps and passes).
+**/
+void collect_ik_metrics(uint64_t step, double time, const limb_table_t *limbs, ik_metrics_t *out) {
+	memset(out, 0, sizeof(ik_metrics_t));
+	out->step = step;
+	out->time = time;
+	out->num_limbs = limbs->num_rows;
+
+	double sum_residual = 0;
+	FOR_ROWS(l, *limbs) {
+		float residual = limbs->ik_residual[l];
+		sum_residual += residual;
+		out->max_residual = maxf(out->max_residual, residual);
+		unsigned b = 0;
+		while (b < num_ik_residual_buckets - 1 && !(residual < ik_residual_bucket_limits[b])) { b++; }
+		out->residual_histogram[b]++;
+
+		unsigned clamps = limbs->ik_clamps[l];
+		out->num_clamps += clamps;
+		out->clamp_histogram[clamps < num_ik_clamp_buckets ? clamps : num_ik_clamp_buckets - 1]++;
+
+		unsigned passes = limbs->ik_passes[l];
+		assert(passes <= max_ik_passes);
+		out->num_passes += passes;
+		out->pass_histogram[passes]++;
+	}
+	out->mean_residual = (limbs->num_rows > 0 ? sum_residual / limbs->num_rows : 0);
+}
+
+
+//// CSV ////
+
+/**
+Column names (one column per histogram bucket, named by what goes in it).
+**/
+void write_ik_metrics_csv_header(FILE *file) {
+	fprintf(file, "step,time,limbs,mean_residual,max_residual,clamps,passes");
+	float lower = 0;
+	FOR_IN(b, num_ik_residual_buckets) {
+		if (b < num_ik_residual_buckets - 1) {
+			fprintf(file, ",residual_%g_%g", lower, ik_residual_bucket_limits[b]);
+		} else {
+			fprintf(file, ",residual_%g_up", lower);
+		}
+		lower = ik_residual_bucket_limits[b];
+	}
+	FOR_IN(b, num_ik_clamp_buckets) {
+		fprintf(file, (b < num_ik_clamp_buckets - 1 ? ",clamps_%u" : ",clamps_%u_up"), (unsigned) b);
+	}
+	FOR_IN(p, max_ik_passes + 1) {
+		fprintf(file, ",passes_%u", (unsigned) p);
+	}
+	fputc('\n', file);
+}
+
+
+void write_ik_metrics_csv_row(const ik_metrics_t *m, FILE *file) {
+	fprintf(file, "%llu,%.4f,%u,%g,%g,%u,%u",
+		(unsigned long long) m->step, m->time, m->num_limbs,
+		m->mean_residual, m->max_residual, m->num_clamps, m->num_passes);
+	FOR_IN(b, num_ik_residual_buckets) { fprintf(file, ",%u", m->residual_histogram[b]); }
+	FOR_IN(b, num_ik_clamp_buckets) { fprintf(file, ",%u", m->clamp_histogram[b]); }
+	FOR_IN(p, max_ik_passes + 1) { fprintf(file, ",%u", m->pass_histogram[p]); }
+	fputc('\n', file);
+}
@@ -0,0 +1,277 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <pthread.h>
+
+#define IN_IK_POOL
+#include "overview.h"
+
+// Tasks per thread to aim for (more balances better, fewer steals less)
+enum { ik_tasks_per_thread = 4 };
+enum { max_ik_threads = 64 };
+
+/**
+Tasks (by index) waiting for a worker.
+
+The owner pops at the bottom, others steal from the top.
+**/
+typedef struct ik_deque_ {
+	pthread_mutex_t lock;
+	uint16_t tasks[max_limb_table_rows];
+	size_t top, bottom;
+} ik_deque_t;
+
+typedef struct ik_worker_ {
+	struct ik_pool_ *pool;
+	unsigned index;
+} ik_worker_t;
+
+struct ik_pool_ {
+	unsigned num_threads; // (Including the one handing out the work)
+	unsigned num_started;
+	pthread_t threads[max_ik_threads];
+	ik_worker_t workers[max_ik_threads];
+	bool started[max_ik_threads];
+
+	// Waking workers up and waiting for them to be done
+	pthread_mutex_t lock;
+	pthread_cond_t wake, done;
+	unsigned round; // Of work handed out so far
+	unsigned num_busy;
+	bool quit;
+
+	// Current work: limbs (by index) grouped into tasks, dealt out to the workers
+	limb_table_t *limbs;
+	uint16_t limb_index[max_limb_table_rows];
+	uint16_t task_start[max_limb_table_rows + 1];
+	size_t num_tasks;
+	ik_deque_t deques[max_ik_threads];
+};
+
+void *run_ik_worker(void *);
+void run_ik_tasks(unsigned worker, ik_pool_t *);
+void plan_ik_tasks(const uint16_t limb_index[], size_t num, ik_pool_t *);
+unsigned estimate_limb_ik_cost(uint16_t limb_index, const limb_table_t *);
+bool take_ik_task(unsigned worker, ik_pool_t *, uint16_t *task);
+
+
+//// IK pool ////
+
+/**
+Start a pool of threads to move limbs by IK with (the thread using it counts as one).
+
+Workers sleep until there is something for them to do.
+**/
+ik_pool_t *create_ik_pool(unsigned num_threads) {
+	if (num_threads < 1) { num_threads = 1; }
+	if (num_threads > max_ik_threads) { num_threads = max_ik_threads; }
+
+	ik_pool_t *pool = calloc(1, sizeof(ik_pool_t));
+	pool->num_threads = num_threads;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	FOR_IN(t, num_threads) {
+		pthread_mutex_init(&pool->deques[t].lock, NULL);
+	}
+
+	// (Work of workers that fail to start is stolen by the others)
+	pool->num_started = 1;
+	FOR_RANGE(t, 1, num_threads) {
+		ik_worker_t *worker = &pool->workers[t];
+		worker->pool = pool;
+		worker->index = t;
+		pool->started[t] = pthread_create(&pool->threads[t], NULL, run_ik_worker, worker) == 0;
+		pool->num_started += pool->started[t];
+	}
+	return pool;
+}
+
+
+void destroy_ik_pool(ik_pool_t *pool) {
+	if (!pool) { return; }
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+	FOR_RANGE(t, 1, pool->num_threads) {
+		if (pool->started[t]) { pthread_join(pool->threads[t], NULL); }
+	}
+
+	FOR_IN(t, pool->num_threads) {
+		pthread_mutex_destroy(&pool->deques[t].lock);
+	}
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+
+unsigned get_ik_pool_threads(const ik_pool_t *pool) {
+	return (pool ? pool->num_threads : 1);
+}
+
+
+/**
+Use IK to move the given limbs (by index) to their end effectors, sharing them out over the pool.
+
+Every limb is moved exactly as move_limbs_directly_to_end_effectors() would
+(limbs don't share bones), only the order differs. Without a pool they are
+moved on this thread, in order.
+**/
+void move_limbs_to_end_effectors_in_parallel(
+		ik_pool_t *pool, const uint16_t limb_index[], size_t num, limb_table_t *limbs) {
+
+	if (!pool || pool->num_threads == 1 || num < 2) {
+		FOR_IN(i, num) {
+			uint16_t l = limb_index[i];
+			move_limb_directly_to(limbs->dense_id[l], limbs->end_effector[l], limbs);
+		}
+		return;
+	}
+
+	// Hand out the work
+	PROFILE_SCOPE("plan_ik_tasks") {
+		pool->limbs = limbs;
+		plan_ik_tasks(limb_index, num, pool);
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->round++;
+	pool->num_busy = pool->num_started;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	// Help out, then wait for the others
+	run_ik_tasks(0, pool);
+	pthread_mutex_lock(&pool->lock);
+	while (pool->num_busy > 0) { pthread_cond_wait(&pool->done, &pool->lock); }
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+//// IK tasks ////
+
+/**
+Group limbs into tasks of about the same cost and deal them out to the workers.
+
+Limbs are taken most costly first, so that long chains get started on early
+and short ones fill in the gaps at the end. Each worker gets its most costly
+task at the bottom of its queue (where it starts).
+**/
+void plan_ik_tasks(const uint16_t limb_index[], size_t num, ik_pool_t *pool) {
+	assert(num <= max_limb_table_rows);
+
+	// Sort by cost, highest first (insertion sort, since there are only so many limbs)
+	unsigned cost[max_limb_table_rows], total_cost = 0;
+	FOR_IN(i, num) {
+		uint16_t l = limb_index[i];
+		unsigned c = estimate_limb_ik_cost(l, pool->limbs);
+		size_t j = i;
+		while (j > 0 && cost[j - 1] < c) {
+			cost[j] = cost[j - 1];
+			pool->limb_index[j] = pool->limb_index[j - 1];
+			j--;
+		}
+		cost[j] = c;
+		pool->limb_index[j] = l;
+		total_cost += c;
+	}
+
+	// Fill tasks up to the target cost (costly limbs get one to themselves)
+	unsigned target = total_cost / (pool->num_threads * ik_tasks_per_thread) + 1;
+	unsigned task_cost = 0;
+	pool->num_tasks = 0;
+	FOR_IN(i, num) {
+		if (i == 0 || task_cost + cost[i] > target) {
+			pool->task_start[pool->num_tasks++] = i;
+			task_cost = 0;
+		}
+		task_cost += cost[i];
+	}
+	pool->task_start[pool->num_tasks] = num;
+
+	// Deal out (round robin, cheapest first so that the costliest end up at the bottom)
+	FOR_IN(t, pool->num_threads) {
+		pool->deques[t].top = pool->deques[t].bottom = 0;
+	}
+	for (size_t task = pool->num_tasks; task-- > 0;) {
+		ik_deque_t *deque = &pool->deques[task % pool->num_threads];
+		deque->tasks[deque->bottom++] = task;
+	}
+}
+
+
+/**
+Roughly how much work IK is for the limb (bones are what the solvers loop over).
+**/
+unsigned estimate_limb_ik_cost(uint16_t limb_index, const limb_table_t *limbs) {
+	size_t num_bones = count_limb_bones(limb_index, limbs);
+
+	// (Plus a bit for collecting and storing the bones)
+	return (num_bones < 32 ? num_bones : 32) + 1;
+}
+
+
+//// IK workers ////
+
+/**
+Wait for work, do it, and wait again (until the pool is destroyed).
+**/
+void *run_ik_worker(void *arg) {
+	const ik_worker_t *worker = arg;
+	ik_pool_t *pool = worker->pool;
+
+	unsigned round = 0;
+	pthread_mutex_lock(&pool->lock);
+	while (true) {
+		while (!pool->quit && pool->round == round) { pthread_cond_wait(&pool->wake, &pool->lock); }
+		if (pool->quit) { break; }
+		round = pool->round;
+		pthread_mutex_unlock(&pool->lock);
+
+		run_ik_tasks(worker->index, pool);
+
+		pthread_mutex_lock(&pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+
+/**
+Move the limbs of tasks until there are no more to take (then tell the pool).
+**/
+void run_ik_tasks(unsigned worker, ik_pool_t *pool) {
+	limb_table_t *limbs = pool->limbs;
+	uint16_t task;
+	while (take_ik_task(worker, pool, &task)) {
+		FOR_RANGE(i, pool->task_start[task], pool->task_start[task + 1]) {
+			uint16_t l = pool->limb_index[i];
+			move_limb_directly_to(limbs->dense_id[l], limbs->end_effector[l], limbs);
+		}
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	if (--pool->num_busy == 0) { pthread_cond_signal(&pool->done); }
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+/**
+Take a task from the workers own queue, or steal one from someone else.
+
+Tasks are never put back, so once every queue is empty there is nothing left to take.
+**/
+bool take_ik_task(unsigned worker, ik_pool_t *pool, uint16_t *task) {
+	FOR_IN(i, pool->num_threads) {
+		ik_deque_t *deque = &pool->deques[(worker + i) % pool->num_threads];
+		bool own = (i == 0);
+		pthread_mutex_lock(&deque->lock);
+		bool found = deque->bottom > deque->top;
+		if (found) { *task = deque->tasks[own ? --deque->bottom : deque->top++]; }
+		pthread_mutex_unlock(&deque->lock);
+		if (found) { return true; }
+	}
+	return false;
+}
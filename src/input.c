@@ -1,4 +1,3 @@
-#include <stdio.h>
 #include <raylib.h>
 
 #define IN_INPUT
@@ -10,100 +9,187 @@ typedef struct tank_controls_ {
 	KeyboardKey rot_left, rot_right, move_forward, move_backward;
 } tank_controls_t;
 
-void process_tank_controls(float dt, actor_id_t, const tank_controls_t *, actor_table_t *);
+input_command_t read_tank_controls(float dt, actor_id_t, const tank_controls_t *);
+void apply_tank_controls(const input_command_t *, actor_table_t *);
+void toggle_hand_holding(population_t *);
+void toggle_timed_steps(population_t *);
 
 //// Input ////
 
+/**
+Read input and apply it to the app right away (single threaded).
+**/
 void process_input(float dt, app_t *app) {
-	population_t *pop = &app->population_history[app->frame_count % max_pop_history_frames];
+	input_command_t commands[max_input_commands_per_frame];
+	size_t num_commands = gather_input_commands(dt, commands, max_input_commands_per_frame);
+	FOR_IN(i, num_commands) {
+		apply_input_command(&commands[i], app);
+	}
+}
+
+
+/**
+Turn the current keyboard state into commands for the simulation.
+
+(Reads input through raylib, so it belongs on the main thread)
+**/
+size_t gather_input_commands(float dt, input_command_t out[], size_t max) {
+	size_t num = 0;
+#define EMIT(...) do { if (num < max) { out[num++] = (input_command_t){__VA_ARGS__}; } } while(0)
 
 	// Meta keys
 	bool shift_down = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
 
 	// Toggle pause
-	if (IsKeyPressed(KEY_P)) { app->paused = !app->paused; }
+	if (IsKeyPressed(KEY_P)) { EMIT(ic_toggle_pause); }
 
 	// Step once
-	if (IsKeyPressed(KEY_N)) { app->step_once = true; }
+	if (IsKeyPressed(KEY_N)) { EMIT(ic_step_once); }
 
-	// Control playback
-	if (app->paused) {
-		int step_count =  (shift_down ? 10 : 1);
+	// Toggle phase timings
+	if (IsKeyPressed(KEY_F1)) { EMIT(ic_toggle_profile); }
 
-		// Step backwards
-		if (IsKeyPressed(KEY_R) && app->frame_count >= step_count) {
-			app->frame_count -= step_count;
-		}
+	// Toggle fused limb updates (to compare timings)
+	if (IsKeyPressed(KEY_F2)) { EMIT(ic_toggle_fused_limb_updates); }
 
-		// Step forwards
-		if (IsKeyPressed(KEY_F)) {
-			app->frame_count += step_count;
-		}
-	} else if (IsKeyDown(KEY_R) && app->frame_count >= 2) {
-		app->frame_count -= 2;
+	// Toggle table occupancy and memory usage
+	if (IsKeyPressed(KEY_F3)) { EMIT(ic_toggle_memory_report); }
+
+	// Control playback
+	// (Stepping only has an effect while paused and rewinding only while running)
+	{
+		int step_count =  (shift_down ? 10 : 1);
+		if (IsKeyPressed(KEY_R)) { EMIT(ic_step_back, .count = step_count); }
+		if (IsKeyPressed(KEY_F)) { EMIT(ic_step_forward, .count = step_count); }
+		if (IsKeyDown(KEY_R)) { EMIT(ic_rewind, .count = 2); }
 	}
 
 	// Move global cursor with arrow keys
-	if (shift_down) {
-		if (IsKeyDown(KEY_RIGHT)) { app->world_cursor.z -= dt; }
-		if (IsKeyDown(KEY_LEFT)) { app->world_cursor.z += dt; }
-	} else {
-		if (IsKeyDown(KEY_RIGHT)) { app->world_cursor.x += dt; }
-		if (IsKeyDown(KEY_LEFT)) { app->world_cursor.x -= dt; }
+	{
+		vec3_t move = vec3_origo;
+		if (shift_down) {
+			if (IsKeyDown(KEY_RIGHT)) { move.z -= dt; }
+			if (IsKeyDown(KEY_LEFT)) { move.z += dt; }
+		} else {
+			if (IsKeyDown(KEY_RIGHT)) { move.x += dt; }
+			if (IsKeyDown(KEY_LEFT)) { move.x -= dt; }
+		}
+		if (IsKeyDown(KEY_UP)) { move.y += dt; }
+		if (IsKeyDown(KEY_DOWN)) { move.y -= dt; }
+		if (move.x != 0 || move.y != 0 || move.z != 0) {
+			EMIT(ic_move_cursor, .vec = move);
+		}
 	}
-	if (IsKeyDown(KEY_UP)) { app->world_cursor.y += dt; }
-	if (IsKeyDown(KEY_DOWN)) { app->world_cursor.y -= dt; }
 
 	// Set goal for first limb
-	if (IsKeyPressed(KEY_SPACE)) {
-		limb_id_t id = { 0 };
-		push_limb_goal(id, app->world_cursor, 1, 5, &pop->limb_goals);
-	}
+	if (IsKeyPressed(KEY_SPACE)) { EMIT(ic_push_cursor_goal); }
 
 	// Controls
 	{
 		actor_id_t actor_1 = { 0 }, actor_2 = { 1 };
 		tank_controls_t controls_1 = { KEY_A, KEY_D, KEY_W, KEY_S };
 		tank_controls_t controls_2 = { KEY_J, KEY_L, KEY_I, KEY_K };
-		process_tank_controls(dt, actor_1, &controls_1, &pop->actors);
-		process_tank_controls(dt, actor_2, &controls_2, &pop->actors);
+		if (num < max) { out[num++] = read_tank_controls(dt, actor_1, &controls_1); }
+		if (num < max) { out[num++] = read_tank_controls(dt, actor_2, &controls_2); }
 	}
 
 	// Hand holding in video games
-	if (app->mode == am_actor_pair && IsKeyPressed(KEY_H)) {
-		printf("%s() – Toggle hand holding\n", __func__);
-		limb_id_t limb_1 = {1}, limb_2 = {4};
+	if (IsKeyPressed(KEY_H)) { EMIT(ic_toggle_hand_holding); }
 
-		// Toggle first limb
-		if (limb_has_link(limb_1, &pop->limb_tip_links)) {
-			unlink_limb(limb_1, &pop->limb_tip_links);
-		} else {
-			link_limb_to(limb_1, limb_2, &pop->limb_tip_links);
-		}
+	// Closed form steps (or goals)
+	if (IsKeyPressed(KEY_T)) { EMIT(ic_toggle_timed_steps); }
 
-		// Toggle second limb
-		if (limb_has_link(limb_2, &pop->limb_tip_links)) {
-			unlink_limb(limb_2, &pop->limb_tip_links);
-		} else {
-			link_limb_to(limb_2, limb_1, &pop->limb_tip_links);
-		}
+#undef EMIT
+	return num;
+}
+
+
+/**
+Apply a single input command to the app.
+
+(Never touches raylib, so it can run on the simulation thread)
+**/
+void apply_input_command(const input_command_t *command, app_t *app) {
+	population_t *pop = &app->population_history[app->frame_count % max_pop_history_frames];
+	if (app->recording) {
+		record_input_command(app->num_steps_taken, command, app->recording);
+	}
+
+	switch (command->type) {
+		case ic_none: {} break;
+		case ic_toggle_pause: { app->paused = !app->paused; } break;
+		case ic_step_once: { app->step_once = true; } break;
+		case ic_toggle_profile: { app->show_profile = !app->show_profile; } break;
+		case ic_toggle_memory_report: { app->show_memory_report = !app->show_memory_report; } break;
+		case ic_step_back: {
+			if (app->paused && app->frame_count >= command->count) {
+				app->frame_count -= command->count;
+			}
+		} break;
+		case ic_step_forward: {
+			if (app->paused) { app->frame_count += command->count; }
+		} break;
+		case ic_rewind: {
+			if (!app->paused && app->frame_count >= command->count) {
+				app->frame_count -= command->count;
+			}
+		} break;
+		case ic_move_cursor: { add_vec3(command->vec, &app->world_cursor); } break;
+		case ic_push_cursor_goal: {
+			limb_id_t id = { 0 };
+			if (limb_exists(id, &pop->limbs)) {
+				push_limb_goal(id, app->world_cursor, 1, 5, &pop->limb_goals);
+			}
+		} break;
+		case ic_tank_controls: { apply_tank_controls(command, &pop->actors); } break;
+		case ic_toggle_hand_holding: { toggle_hand_holding(pop); } break;
+		case ic_toggle_timed_steps: { toggle_timed_steps(pop); } break;
+		case ic_toggle_fused_limb_updates: {
+			pop->fuse_limb_updates = !pop->fuse_limb_updates;
+			LOG(le_toggle_fused_limb_updates, (pop->fuse_limb_updates ? "on" : "off"));
+		} break;
+		case num_input_command_types: { assert(false); } break;
 	}
 }
 
 
-void process_tank_controls(float dt, actor_id_t actor, const tank_controls_t *controls, actor_table_t *actors) {
+/**
+Let actors hold hands with whoever is nearby (or let go of all hands).
+**/
+void toggle_hand_holding(population_t *pop) {
+	pop->hold_hands = !pop->hold_hands;
+	if (!pop->hold_hands) { let_go_of_all_hands(&pop->limb_tip_links); }
+	LOG(le_toggle_hand_holding, (pop->hold_hands ? "on" : "off"));
+}
+
+
+/**
+Let feet step along timed curves (or toward goals, as before).
+
+Steps already taken finnish the way they started.
+**/
+void toggle_timed_steps(population_t *pop) {
+	pop->timed_steps = !pop->timed_steps;
+	LOG(le_toggle_timed_steps, (pop->timed_steps ? "on" : "off"));
+}
+
+
+input_command_t read_tank_controls(float dt, actor_id_t actor, const tank_controls_t *controls) {
+	input_command_t command = { ic_tank_controls, .actor = actor, .dt = dt };
+	if (IsKeyDown(controls->move_forward)) { command.vec.x = +1.f; }
+	else if (IsKeyDown(controls->move_backward)) { command.vec.x = -1.f; }
+	if (IsKeyDown(controls->rot_left)) { command.vec.y += 1.f; }
+	if (IsKeyDown(controls->rot_right)) { command.vec.y -= 1.f; }
+	return command;
+}
+
+
+void apply_tank_controls(const input_command_t *command, actor_table_t *actors) {
+	actor_id_t actor = command->actor;
 	if (!actor_exists(actor, actors)) { return; }
-	int actor_index = get_actor_index(actor, actors);
 	vec3_t actor_forward = get_actor_forward_dir(actor, actors);
 
-	if (IsKeyDown(controls->move_forward)) {
-		actors->movement[actor_index].velocity = vec3_mul(actor_forward, +1.f * actor_walking_speed);
-	} else if (IsKeyDown(controls->move_backward)) {
-		actors->movement[actor_index].velocity = vec3_mul(actor_forward, -1.f * actor_walking_speed);
-	} else {
-		actors->movement[actor_index].velocity = vec3(0,0,0);
-	}
-
-	if (IsKeyDown(controls->rot_left)) { actors->location[actor_index].orientation_y += dt * 0.25 * tau; }
-	if (IsKeyDown(controls->rot_right)) { actors->location[actor_index].orientation_y -= dt * 0.25 * tau; }
+	// Walk (x) and turn (y)
+	set_actor_velocity(actor, vec3_mul(actor_forward, command->vec.x * actor_walking_speed), actors);
+	if (command->vec.y != 0) { turn_actor(actor, command->dt * command->vec.y * 0.25 * tau, actors); }
 }
@@ -1,21 +1,57 @@
 #include <assert.h>
-#include <stdio.h>
+#include <math.h>
 
 #define IN_KINEMATICS
 #include "overview.h"
 
-#ifdef LOG_CONTROLER
-#define TRACE_FLOAT(f) printf("%s():%u \t| " #f " = %f\n", __func__, __LINE__, (f));
-#define TRACE_VEC3(v) printf("%s():%u \t| " #v " = (%f, %f, %f)\n", __func__, __LINE__, (v).x, (v).y, (v).z)
-#else
-#define TRACE_FLOAT(_) // _
-#define TRACE_VEC3(_) // _
-#endif
+#define TRACE_FLOAT(f) LOG(le_trace_float, __func__, __LINE__, #f, (f))
+#define TRACE_VEC3(v) LOG(le_trace_vec3, __func__, __LINE__, #v, (v).x, (v).y, (v).z)
 
 
 static const int num_fabrik_passes = 3;
+static const float ik_pass_tolerance = 1e-4f; // (Tips this close count as there, in ik_passes)
+
+const gait_params_t default_gait_params = {
+	.leg_acceleration_factor = 30,
+	.leg_forward_speed_factor = 1.75,
+	.leg_drop_speed_factor = 3,
+	.up_x = 0.75,
+	.step_height = 0.5,
+	.contact_x = 1.5f,
+	.foot_drift_factor = 2,
+};
+
+// FABRIK passes (return how many times a constraint clamped a bone)
+static inline unsigned fabrik_forward_pass(vec3_t origin, vec3_t end_pos, bone_t arr[], size_t num);
+static inline unsigned fabrik_inverse_pass(vec3_t root_pos, quat_t root_ori, vec3_t end_pos, bone_t arr[], size_t num);
+static inline bool constrain_to_next_bone_as(bone_constraint_e, const bone_t *next_bone, bone_t *this_bone);
+static inline bool constrain_to_prev_bone_as(bone_constraint_e, const bone_t *prev_bone, bone_t *this_bone);
+float clamp_hinge_angle(float angle, const bone_t *, unsigned *num_clamps);
 
 void accelrate_toward_goal_velocity(vec3_t target, float max_speed_change, vec3_t *current);
+vec3_t move_end_effector_toward_goal(float dt, vec3_t ee_pos, unsigned goal_index, limb_goal_table_t *);
+
+bool wake_legs_for_changes(const recent_changes_t *, uint32_t *num_seen, bool by_limb, const animation_env_i *);
+void wake_legs_of_actor(uint16_t actor_id, const animation_env_i *);
+
+// Swing solver constants
+enum { num_swing_constraint_passes = 4 };
+static const float limb_swing_damping = 0.98f;
+
+/** Pose of every swinging limb (struct of arrays, indexed by point and then swing row). **/
+typedef struct swing_chains_ {
+	float root_x[max_limb_swing_table_rows];
+	float root_y[max_limb_swing_table_rows];
+	float root_z[max_limb_swing_table_rows];
+	float x[max_limb_swing_points][max_limb_swing_table_rows];
+	float y[max_limb_swing_points][max_limb_swing_table_rows];
+	float z[max_limb_swing_points][max_limb_swing_table_rows];
+	float weight[max_limb_swing_points][max_limb_swing_table_rows]; // 0 past the tip (not moving)
+} swing_chains_t;
+
+void gather_swing_chains(const limb_swing_table_t *, const limb_table_t *, swing_chains_t *);
+void solve_swing_chains(float dt, vec3_t gravity, limb_swing_table_t *, swing_chains_t *);
+void scatter_swing_chains(const limb_swing_table_t *, const swing_chains_t *, limb_table_t *);
 
 vec3_t get_bone_forward(const bone_t *b) { return quat_rotate_vec3(b->orientation, vec3_positive_x); }
 vec3_t get_bone_up(const bone_t *b) { return quat_rotate_vec3(b->orientation, vec3_positive_y); }
@@ -23,6 +59,26 @@ vec3_t get_bone_right(const bone_t *b) { return quat_rotate_vec3(b->orientation,
 
 vec3_t calc_tip_pos(vec3_t joint_pos, quat_t ori, float length);
 
+/** Two hands (by arm attachment index) that could hold each other. **/
+typedef struct hand_pair_ {
+	float distance;
+	uint16_t arm, other_arm;
+} hand_pair_t;
+enum { max_hand_pairs = max_limb_attachment_table_rows * 4 };
+int compare_hand_pairs(const void *, const void *);
+
+// IK budget priorities (a limb a metre off counts as much as one that waited 40 steps)
+static const float ik_priority_per_residual = 10.f;
+static const float ik_priority_per_skipped_step = 0.25f;
+static const float ik_priority_of_goal = 1.f; // (Or step)
+static const float ik_priority_near_focus = 1.f;
+
+// Link island solver
+enum { max_link_island_passes = 32 };
+static const float link_island_tolerance = 0.001f;
+static const float link_island_reach_factor = 0.95f; // IK struggles with limbs fully stretched
+uint16_t find_link_island_root(uint16_t limb_index, uint16_t parent[]);
+
 
 //// Actor movement ////
 
@@ -57,20 +113,43 @@ void move_limbs_toward_goals(float dt, limb_goal_table_t *goals, limb_table_t *l
 		// Get limb data
 		limb_id_t limb = goals->dense_id[goal_index];
 		int limb_index = get_limb_index(limb, limbs);
-		vec3_t ee_pos = limbs->end_effector[limb_index];
-
-		// Get goal data
-		int8_t curve_index = goals->curve_index[goal_index];
-		vec3_t goal_pos = goals->curve_points[goal_index][curve_index];
-		float max_speed = goals->max_speed[goal_index];
-		float acceleration = goals->max_acceleration[goal_index];
-		float max_speed_change = acceleration * dt;
 
 		// Move end effectors
-		vec3_t target_vel = vec3_mul(vec3_direction(ee_pos, goal_pos), max_speed);
-		accelrate_toward_goal_velocity(target_vel, max_speed_change, &goals->velocity[goal_index]);
 		limbs->end_effector[limb_index] =
-			vec3_add(limbs->end_effector[limb_index], vec3_mul(goals->velocity[goal_index], dt));
+			move_end_effector_toward_goal(dt, limbs->end_effector[limb_index], goal_index, goals);
+	}
+}
+
+
+/**
+Where the end effector ends up after moving toward its goal for a while.
+
+(Updates the goals velocity)
+**/
+vec3_t move_end_effector_toward_goal(float dt, vec3_t ee_pos, unsigned goal_index, limb_goal_table_t *goals) {
+	// Get goal data
+	int8_t curve_index = goals->curve_index[goal_index];
+	vec3_t goal_pos = goals->curve_points[goal_index][curve_index];
+	float max_speed = goals->max_speed[goal_index];
+	float acceleration = goals->max_acceleration[goal_index];
+	float max_speed_change = acceleration * dt;
+
+	// Move end effector
+	vec3_t target_vel = vec3_mul(vec3_direction(ee_pos, goal_pos), max_speed);
+	accelrate_toward_goal_velocity(target_vel, max_speed_change, &goals->velocity[goal_index]);
+	return vec3_add(ee_pos, vec3_mul(goals->velocity[goal_index], dt));
+}
+
+
+/**
+Put limb end effectors where their steps have them at the given time.
+
+(Closed form, so it does not matter how long ago they were last moved)
+**/
+void move_limbs_along_steps(double time, const limb_step_table_t *steps, limb_table_t *limbs) {
+	FOR_ROWS(step_index, *steps) {
+		int limb_index = get_limb_index(steps->dense_id[step_index], limbs);
+		limbs->end_effector[limb_index] = get_limb_step_position(step_index, time, steps);
 	}
 }
 
@@ -94,96 +173,255 @@ void accelrate_toward_goal_velocity(vec3_t  goal_vel, float max_speed_change, ve
 
 
 /**
-Move legs forward one at the time.
+Move legs forward one at the time (looking at every leg on every step).
 **/
 void animate_walking_actor_legs(float dt, const animation_env_i *env) {
+	FOR_ROWS(i, *env->leg_attachments) {
+		step_leg_if_ready(dt, i, env);
+	}
+}
 
-	// Get what you need
+
+/**
+Move legs forward one at the time (looking only at legs that might be ready).
+
+Gives the same result as animate_walking_actor_legs(), as long as legs are
+not woken later than they could be ready. Legs wake up when:
+- The time they were scheduled for has come.
+- The actor they are attached to is steered or turned (by its setters).
+- A leg of the same actor gets a new goal or link, or loses one (also by
+  the leg stepping, which wakes the other legs for the next step).
+
+So the work done per step follows the legs that are woken, not how many
+legs or actors there are.
+**/
+void animate_scheduled_actor_legs(float dt, const animation_env_i *env) {
 	const actor_table_t *actors = env->actors;
 	const limb_attachment_table_t *leg_attachments = env->leg_attachments;
-	const terrain_table_t * ground = env->ground;
-	limb_goal_table_t *goals = env->goals;
-	limb_table_t *limbs = env->limbs;
+	gait_schedule_t *gait = env->gait;
+	const double now = env->time;
+
+	// Look at new legs right away (and keep track of whose they are)
+	FOR_RANGE(i, gait->num_legs, leg_attachments->num_rows) {
+		uint16_t actor_id = leg_attachments->owner[i].id;
+		uint16_t first = gait->first_leg_of_actor[actor_id];
+		bool has_first = (first < i && leg_attachments->owner[first].id == actor_id);
+		gait->next_leg_of_actor[i] = (has_first ? first : UINT16_MAX);
+		gait->first_leg_of_actor[actor_id] = i;
+		gait->leg_of_limb[leg_attachments->limb[i].id] = i;
+		schedule_leg(i, now, gait);
+	}
 
-	// Speeds
-	const float leg_acceleration_factor = 30;
-	const float leg_forward_speed_factor = 1.75;
-	const float leg_drop_speed_factor = 3;
+	// Wake legs of actors that were steered, or whose legs got goals or links
+	// (if there were too many changes to tell which, wake them all)
+	bool caught_up =
+		wake_legs_for_changes(&actors->steered, &gait->num_steered_seen, false, env) &
+		wake_legs_for_changes(&env->goals->changed, &gait->num_goal_changes_seen, true, env);
+	if (env->links) {
+		caught_up &= wake_legs_for_changes(&env->links->changed, &gait->num_link_changes_seen, true, env);
+	}
+	if (!caught_up) {
+		FOR_ROWS(i, *leg_attachments) { schedule_leg(i, now, gait); }
+	}
 
-	// Step curve positions (relative to root joint)
-	const float up_x = 0.75;
-	const float step_height = 0.5;
-	const float contact_x = 1.5f;
+	// Collect legs that are due
+	// (and look at them in the same order as when polling every leg)
+	uint16_t woken[max_gait_schedule_legs];
+	size_t num_woken = 0;
+	uint16_t leg;
+	while (pop_due_leg(now, &leg, gait)) {
+		size_t w = num_woken++;
+		while (w > 0 && woken[w - 1] > leg) { woken[w] = woken[w - 1]; w--; }
+		woken[w] = leg;
+	}
 
-	FOR_ROWS(i, *leg_attachments) {
-		actor_id_t actor = leg_attachments->owner[i];
-		limb_id_t limb = leg_attachments->limb[i];
-		int limb_index = get_limb_index(limb, limbs);
+	// Steps are taken at whole time steps, so round down half a step
+	// (to stay clear of rounding errors)
+	FOR_IN(w, num_woken) {
+		float delay = step_leg_if_ready(dt, woken[w], env);
+		schedule_leg(woken[w], now + maxf(delay - 0.5f * dt, 0), gait);
+	}
+}
 
-		// Current forward velocity
-		const float vel_x = get_actor_velocity_in_object_space(actor, actors).x;
-		if (vel_x <= 0) { continue; }
 
-		// Finnish what you..
-		if (has_limb_goal(limb, goals)) { continue; }
+/**
+Wake the legs concerned by changes not caught up on yet (by actor id, or by limb id).
 
-		// Let other leg finnish
-		limb_id_t other_limb = limbs->paired_with[limb_index];
-		if (other_limb.id != limb.id && has_limb_goal(other_limb, goals)) {
-			continue;
+Returns false if there were more than are remembered.
+**/
+bool wake_legs_for_changes(const recent_changes_t *changes, uint32_t *num_seen, bool by_limb, const animation_env_i *env) {
+	const limb_attachment_table_t *leg_attachments = env->leg_attachments;
+	const gait_schedule_t *gait = env->gait;
+	uint32_t num_new = changes->num_changes - *num_seen;
+	*num_seen = changes->num_changes;
+	if (num_new > max_recent_changes) { return false; }
+
+	for (uint32_t c = changes->num_changes - num_new; c != changes->num_changes; c++) {
+		uint16_t id = changes->id[c % max_recent_changes];
+		if (by_limb) {
+			// (Only legs, limbs of other kinds are looked up in vain)
+			uint16_t leg = gait->leg_of_limb[id];
+			if (leg >= gait->num_legs || leg_attachments->limb[leg].id != id) { continue; }
+			id = leg_attachments->owner[leg].id;
 		}
+		wake_legs_of_actor(id, env);
+	}
+	return true;
+}
 
-		// Get transforms
-		const mat4_t to_obj = get_actor_to_object_transform(actor, actors);
 
-		// This foots position in world and actors object space
-		const vec3_t this_foot_wpos = get_limb_tip_position(limb, limbs);
-		const vec3_t this_foot_opos = mat4_mul_vec3(to_obj, this_foot_wpos, 1);
+/**
+Look at every leg of the actor (by id) right away.
+**/
+void wake_legs_of_actor(uint16_t actor_id, const animation_env_i *env) {
+	const limb_attachment_table_t *leg_attachments = env->leg_attachments;
+	gait_schedule_t *gait = env->gait;
+	uint16_t leg = gait->first_leg_of_actor[actor_id];
+	while (leg < gait->num_legs && leg_attachments->owner[leg].id == actor_id) {
+		uint16_t next = gait->next_leg_of_actor[leg];
+		schedule_leg(leg, env->time, gait);
+		leg = next;
+	}
+}
 
-		// Use other limb if it's further behind
-		if (limb.id != other_limb.id) {
-			const vec3_t other_foot_wpos = get_limb_tip_position(other_limb, limbs);
-			const vec3_t other_foot_opos = mat4_mul_vec3(to_obj, other_foot_wpos, 1);
-			if (other_foot_opos.x < this_foot_opos.x) {
-				continue;
-			}
-		}
 
-		// Move foot forward only if behind actor
-		if (this_foot_opos.x >= 0) { continue; }
+/**
+Start moving a leg forward (if it's time for it to take a step).
 
-		// Start where the foot's actually at right now
-		limbs->end_effector[limb_index] = get_limb_tip_position(limb, limbs);
+Returns about how long it will take until the leg can take its next step
+(INFINITY if it will not take one until its actor starts moving forward).
 
-		// Root position in world and actors bject space
-		const vec3_t leg_root_wpos = limbs->position[limb_index];
-		const vec3_t leg_root_opos = mat4_mul_vec3(to_obj, leg_root_wpos, 1);
+That is an estimate rather than a bound: planted feet are assumed to drift
+backwards no faster than foot_drift_factor times the actors speed (a margin
+for turning and dragged feet), and end effectors to move no faster than their
+goals let them. animate_scheduled_actor_legs() looks again whenever the
+actor, or the goals and links of its legs, change in ways that could break
+those assumptions.
+**/
+float step_leg_if_ready(float dt, uint16_t leg, const animation_env_i *env) {
 
-		// Start moving
-		printf("Move foot [#%u|%u] forward!\n", limb.id, limb_index);
-		const float leg_acceleration = vel_x * leg_acceleration_factor;
+	// Get what you need
+	const actor_table_t *actors = env->actors;
+	const limb_attachment_table_t *leg_attachments = env->leg_attachments;
+	const terrain_table_t * ground = env->ground;
+	limb_goal_table_t *goals = env->goals;
+	limb_step_table_t *steps = env->steps;
+	limb_table_t *limbs = env->limbs;
 
-		// First lift foot forward
-		const mat4_t to_world = get_actor_to_world_transform(actor, actors);
-		{
-			vec3_t leg_goal_opos = vec3_add(leg_root_opos, vec3(up_x, 0, 0));
-			vec3_t leg_goal_wpos = mat4_mul_vec3(to_world, leg_goal_opos, 1);
-			leg_goal_wpos.y =
-				step_height + get_terrain_height(leg_goal_wpos.x, leg_goal_wpos.z, ground);
-			const float speed = vel_x * leg_forward_speed_factor;
-			put_limb_goal(limb, leg_goal_wpos, speed, leg_acceleration, goals);
-		}
+	// Speeds and step curve positions
+	const gait_params_t *params = env->gait_params;
+	const float leg_acceleration_factor = params->leg_acceleration_factor;
+	const float leg_forward_speed_factor = params->leg_forward_speed_factor;
+	const float up_x = params->up_x;
+	const float step_height = params->step_height;
+	const float contact_x = params->contact_x;
+	const float foot_drift_factor = params->foot_drift_factor;
+
+	actor_id_t actor = leg_attachments->owner[leg];
+	limb_id_t limb = leg_attachments->limb[leg];
+	int limb_index = get_limb_index(limb, limbs);
+
+	// Posed legs are looked at again once let go
+	if (limbs->posed[limb_index]) { return INFINITY; }
+
+	// Current forward velocity
+	const float vel_x = get_actor_velocity_in_object_space(actor, actors).x;
+	if (vel_x <= 0) { return INFINITY; }
+
+	// Finnish what you..
+	if (has_limb_goal(limb, goals)) {
+		return get_limb_goal_time_left(limb, goals, limbs);
+	}
+	if (has_limb_step(limb, steps)) {
+		return get_limb_step_time_left(limb, env->time, steps);
+	}
 
-		// Then drop foot once in front of actor
-		{
-			vec3_t leg_goal_opos = vec3_add(leg_root_opos, vec3(contact_x, 0,0));
-			vec3_t leg_goal_wpos = mat4_mul_vec3(to_world, leg_goal_opos, 1);
-			leg_goal_wpos.y =
-				get_terrain_height(leg_goal_wpos.x, leg_goal_wpos.z, ground);
-			const float speed = vel_x * leg_forward_speed_factor;
-			push_limb_goal(limb, leg_goal_wpos, speed, leg_acceleration, goals);
+	// Let other leg finnish
+	limb_id_t other_limb = limbs->paired_with[limb_index];
+	if (other_limb.id != limb.id && has_limb_goal(other_limb, goals)) {
+		return get_limb_goal_time_left(other_limb, goals, limbs);
+	}
+	if (other_limb.id != limb.id && has_limb_step(other_limb, steps)) {
+		return get_limb_step_time_left(other_limb, env->time, steps);
+	}
+
+	// Get transforms
+	const mat4_t to_obj = get_actor_to_object_transform(actor, actors);
+
+	// This foots position in world and actors object space
+	const vec3_t this_foot_wpos = get_limb_tip_position(limb, limbs);
+	const vec3_t this_foot_opos = mat4_mul_vec3(to_obj, this_foot_wpos, 1);
+
+	// Use other limb if it's further behind
+	// (it's about to take a step, so look again after that)
+	if (limb.id != other_limb.id) {
+		const vec3_t other_foot_wpos = get_limb_tip_position(other_limb, limbs);
+		const vec3_t other_foot_opos = mat4_mul_vec3(to_obj, other_foot_wpos, 1);
+		if (other_foot_opos.x < this_foot_opos.x) {
+			return 0;
 		}
 	}
+
+	// Move foot forward only if behind actor
+	// (never counting on feet to drift slower than the actor moves)
+	if (this_foot_opos.x >= 0) {
+		return this_foot_opos.x / (vel_x * maxf(foot_drift_factor, 1));
+	}
+
+	// Start where the foot's actually at right now
+	limbs->end_effector[limb_index] = get_limb_tip_position(limb, limbs);
+
+	// Root position in world and actors bject space
+	const vec3_t leg_root_wpos = limbs->position[limb_index];
+	const vec3_t leg_root_opos = mat4_mul_vec3(to_obj, leg_root_wpos, 1);
+
+	// Start moving
+	LOG(le_move_foot_forward, limb.id, limb_index);
+	const float leg_acceleration = vel_x * leg_acceleration_factor;
+	const mat4_t to_world = get_actor_to_world_transform(actor, actors);
+
+	// Or follow a curve from here to the contact point
+	// (lifted so that it peaks at about step height halfway through)
+	if (env->timed_steps) {
+		vec3_t contact_wpos = mat4_mul_vec3(to_world, vec3_add(leg_root_opos, vec3(contact_x, 0, 0)), 1);
+		contact_wpos.y = get_terrain_height(contact_wpos.x, contact_wpos.z, ground);
+		const vec3_t lift = vec3(0, step_height / 0.75f, 0);
+		const vec3_t p0 = limbs->end_effector[limb_index];
+		const vec3_t points[num_limb_step_control_points] = {
+			p0, vec3_add(p0, lift), vec3_add(contact_wpos, lift), contact_wpos,
+		};
+
+		// Curve length is about halfway between the chord and the control polygon
+		float length = vec3_distance(points[0], points[3]);
+		FOR_IN(i, 3) { length += vec3_distance(points[i], points[i + 1]); }
+		length *= 0.5f;
+
+		const float speed = vel_x * leg_forward_speed_factor;
+		put_limb_step(limb, env->time, length / speed, points, steps);
+		return get_limb_step_time_left(limb, env->time, steps);
+	}
+
+	// First lift foot forward
+	{
+		vec3_t leg_goal_opos = vec3_add(leg_root_opos, vec3(up_x, 0, 0));
+		vec3_t leg_goal_wpos = mat4_mul_vec3(to_world, leg_goal_opos, 1);
+		leg_goal_wpos.y =
+			step_height + get_terrain_height(leg_goal_wpos.x, leg_goal_wpos.z, ground);
+		const float speed = vel_x * leg_forward_speed_factor;
+		put_limb_goal(limb, leg_goal_wpos, speed, leg_acceleration, goals);
+	}
+
+	// Then drop foot once in front of actor
+	{
+		vec3_t leg_goal_opos = vec3_add(leg_root_opos, vec3(contact_x, 0,0));
+		vec3_t leg_goal_wpos = mat4_mul_vec3(to_world, leg_goal_opos, 1);
+		leg_goal_wpos.y =
+			get_terrain_height(leg_goal_wpos.x, leg_goal_wpos.z, ground);
+		const float speed = vel_x * leg_forward_speed_factor;
+		push_limb_goal(limb, leg_goal_wpos, speed, leg_acceleration, goals);
+	}
+
+	return get_limb_goal_time_left(limb, goals, limbs);
 }
 
 /**
@@ -200,17 +438,233 @@ void keep_actors_actors_above_ground(float h, const terrain_table_t *ground, act
 //// Limb linking (hand holding) ////
 
 /**
-Move the end effecto of a linked limb to the tip the limb it is linked to.
+Move linked limbs so that their tips meet (solving each island on its own).
+**/
+void move_linked_limbs_together(const limb_link_table_t *links, limb_table_t *limbs) {
+	link_islands_t islands;
+	find_link_islands(links, limbs, &islands);
+
+	// Islands share no limbs (so they could be solved in parallel)
+	FOR_IN(i, islands.num_islands) {
+		solve_link_island(i, &islands, limbs);
+	}
+}
+
+
+/**
+Group linked limbs into islands (union-find over the links).
+
+Islands and their limbs come in limb index order, so the order of the link
+rows makes no difference.
+**/
+void find_link_islands(const limb_link_table_t *links, const limb_table_t *limbs, link_islands_t *out) {
+	// Join the two limbs of every link
+	uint16_t parent[max_limb_table_rows];
+	bool linked[max_limb_table_rows];
+	FOR_ROWS(l, *limbs) { parent[l] = l; linked[l] = false; }
+	FOR_ROWS(k, *links) {
+		uint16_t a = find_link_island_root(get_limb_index(links->dense_id[k], limbs), parent);
+		uint16_t b = find_link_island_root(get_limb_index(links->other_limb[k], limbs), parent);
+		if (a < b) { parent[b] = a; } else { parent[a] = b; }
+		linked[get_limb_index(links->dense_id[k], limbs)] = true;
+		linked[get_limb_index(links->other_limb[k], limbs)] = true;
+	}
+
+	// Number islands by their first limb and count their limbs
+	int16_t island_of_root[max_limb_table_rows];
+	uint16_t num_limbs_in[max_limb_table_rows];
+	out->num_islands = 0;
+	FOR_ROWS(l, *limbs) {
+		island_of_root[l] = -1;
+		out->island_of[l] = -1;
+		if (!linked[l]) { continue; }
+
+		uint16_t root = find_link_island_root(l, parent);
+		if (island_of_root[root] < 0) {
+			island_of_root[root] = out->num_islands;
+			num_limbs_in[out->num_islands++] = 0;
+		}
+		out->island_of[l] = island_of_root[root];
+		num_limbs_in[out->island_of[l]]++;
+	}
+
+	// Group limbs by island (counting sort)
+	out->island_start[0] = 0;
+	FOR_IN(i, out->num_islands) {
+		out->island_start[i + 1] = out->island_start[i] + num_limbs_in[i];
+	}
+	uint16_t cursor[max_limb_table_rows];
+	FOR_IN(i, out->num_islands) { cursor[i] = out->island_start[i]; }
+	FOR_ROWS(l, *limbs) {
+		if (out->island_of[l] < 0) { continue; }
+		out->limb_index[cursor[out->island_of[l]]++] = l;
+	}
+}
+
+
+/**
+Root of the island the limb (by index) is in so far (halving the path to it).
+**/
+uint16_t find_link_island_root(uint16_t limb_index, uint16_t parent[]) {
+	while (parent[limb_index] != limb_index) {
+		parent[limb_index] = parent[parent[limb_index]];
+		limb_index = parent[limb_index];
+	}
+	return limb_index;
+}
+
+
+/**
+Find a point that every limb of the island can reach and move their end
+effectors to it.
+
+Starts from the average end effector, then moves it to the average of the
+closest points each limb can reach, until they all agree (or are as close
+as they are going to get).
+**/
+void solve_link_island(unsigned island, const link_islands_t *islands, limb_table_t *limbs) {
+	assert(island < islands->num_islands);
+	const uint16_t *members = &islands->limb_index[islands->island_start[island]];
+	const size_t num = islands->island_start[island + 1] - islands->island_start[island];
+
+	// Start where the limbs want to be
+	vec3_t target = vec3(0, 0, 0);
+	float reach[max_limb_table_rows];
+	FOR_IN(m, num) {
+		target = vec3_add(target, limbs->end_effector[members[m]]);
+		reach[m] = get_limb_bounding_radius(members[m], limbs) * link_island_reach_factor;
+	}
+	target = vec3_div(target, num);
+
+	// Reach for it (until consistent)
+	FOR_IN(pass, max_link_island_passes) {
+		vec3_t reached = vec3(0, 0, 0);
+		float max_miss = 0;
+		FOR_IN(m, num) {
+			vec3_t root = limbs->position[members[m]];
+			float miss = vec3_distance(root, target) - reach[m];
+			vec3_t tip = (miss > 0 ? vec3_add(root, vec3_mul(vec3_direction(root, target), reach[m])) : target);
+			reached = vec3_add(reached, tip);
+			max_miss = maxf(max_miss, miss);
+		}
+		if (max_miss <= link_island_tolerance) { break; }
+		target = vec3_div(reached, num);
+	}
+
+	FOR_IN(m, num) { limbs->end_effector[members[m]] = target; }
+}
+
+
+/**
+Hold hands with other actors that are within reach (and let go when out of reach).
+
+Only free hands (not linked to anything yet) look for a hand to hold, so
+links are kept until the actors move too far apart.
+**/
+void hold_hands_with_nearby_actors(
+		const actor_table_t *actors, const actor_grid_t *grid, const limb_attachment_table_t *arms,
+		const limb_table_t *limbs, limb_link_table_t *links) {
+
+	// How far each arm reaches
+	float reach[max_limb_attachment_table_rows];
+	float max_reach = 0;
+	FOR_ROWS(i, *arms) {
+		reach[i] = get_limb_bounding_radius(get_limb_index(arms->limb[i], limbs), limbs);
+		max_reach = maxf(reach[i], max_reach);
+	}
+
+	// Arms of each actor (by actor index)
+	uint16_t arm_start[max_actor_table_rows + 1] = { 0 };
+	uint16_t arms_by_actor[max_limb_attachment_table_rows];
+	uint16_t actor_of_arm[max_limb_attachment_table_rows];
+	FOR_ROWS(i, *arms) {
+		actor_of_arm[i] = get_actor_index(arms->owner[i], actors);
+		arm_start[actor_of_arm[i] + 1]++;
+	}
+	FOR_IN(a, actors->num_rows) { arm_start[a + 1] += arm_start[a]; }
+	{
+		uint16_t cursor[max_actor_table_rows];
+		FOR_ROWS(a, *actors) { cursor[a] = arm_start[a]; }
+		FOR_ROWS(i, *arms) { arms_by_actor[cursor[actor_of_arm[i]]++] = i; }
+	}
+
+	// Let go of hands that can't reach each other any more
+	limb_id_t let_go[max_limb_link_table_rows];
+	size_t num_let_go = 0;
+	FOR_ROWS(l, *links) {
+		limb_id_t this_limb = links->dense_id[l], other_limb = links->other_limb[l];
+		int this_index = get_limb_index(this_limb, limbs), other_index = get_limb_index(other_limb, limbs);
+		float max_distance =
+			get_limb_bounding_radius(this_index, limbs) + get_limb_bounding_radius(other_index, limbs);
+		if (vec3_distance(limbs->position[this_index], limbs->position[other_index]) > max_distance) {
+			let_go[num_let_go++] = this_limb;
+		}
+	}
+	FOR_IN(i, num_let_go) {
+		if (!limb_has_link(let_go[i], links)) { continue; }
+		limb_id_t other_limb = links->other_limb[links->sparse_id[let_go[i].id]];
+		unlink_limb(let_go[i], links);
+		if (limb_has_link(other_limb, links)) { unlink_limb(other_limb, links); }
+		LOG(le_let_go_of_hands, let_go[i].id, other_limb.id);
+	}
+
+	// Pairs of free hands (of different actors) that can reach each other
+	hand_pair_t pairs[max_hand_pairs];
+	size_t num_pairs = 0;
+	FOR_ROWS(i, *arms) {
+		limb_id_t this_limb = arms->limb[i];
+		if (limb_has_link(this_limb, links)) { continue; }
+		vec3_t this_root = get_limb_position(this_limb, limbs);
+
+		// Only actors this close can have an arm that reaches
+		uint16_t nearby[max_actor_table_rows];
+		float radius = reach[i] + max_reach + actor_bounding_radius;
+		size_t num_nearby = find_actors_within(this_root, radius, actors, grid, nearby, max_actor_table_rows);
+
+		FOR_IN(n, num_nearby) {
+			if (nearby[n] == actor_of_arm[i]) { continue; }
+			FOR_RANGE(j, arm_start[nearby[n]], arm_start[nearby[n] + 1]) {
+				uint16_t other = arms_by_actor[j];
+				if (other < i || limb_has_link(arms->limb[other], links)) { continue; }
+
+				float d = vec3_distance(this_root, get_limb_position(arms->limb[other], limbs));
+				if (d <= reach[i] + reach[other] && num_pairs < max_hand_pairs) {
+					pairs[num_pairs++] = (hand_pair_t){ d, i, other };
+				}
+			}
+		}
+	}
+
+	// Closest hands take each other first
+	qsort(pairs, num_pairs, sizeof(hand_pair_t), compare_hand_pairs);
+	FOR_IN(p, num_pairs) {
+		limb_id_t this_limb = arms->limb[pairs[p].arm], other_limb = arms->limb[pairs[p].other_arm];
+		if (limb_has_link(this_limb, links) || limb_has_link(other_limb, links)) { continue; }
+
+		link_limb_to(this_limb, other_limb, links);
+		link_limb_to(other_limb, this_limb, links);
+		LOG(le_hold_hands, this_limb.id, other_limb.id);
+	}
+}
+
+
+/**
+Order hand pairs by distance (and then by arms, to keep it deterministic).
 **/
-void move_limb_tips_to_their_linked_partners(const limb_link_table_t *links, limb_table_t * limbs) {
-	FOR_ROWS(link_index, *links) {
-		limb_id_t this_limb = links->dense_id[link_index];
-		limb_id_t other_limb = links->other_limb[link_index];
+int compare_hand_pairs(const void *a, const void *b) {
+	const hand_pair_t *p1 = a, *p2 = b;
+	if (p1->distance != p2->distance) { return (p1->distance < p2->distance ? -1 : +1); }
+	if (p1->arm != p2->arm) { return (int) p1->arm - (int) p2->arm; }
+	return (int) p1->other_arm - (int) p2->other_arm;
+}
 
-		vec3_t ee_pos = get_limb_end_effector_position(this_limb, limbs);
-		vec3_t tip_pos = get_limb_tip_position(other_limb, limbs);
-		vec3_t new_pos = vec3_lerp(0.5, ee_pos, tip_pos);
-		set_limb_end_effector(this_limb, new_pos, limbs);
+
+/**
+Let go of every hand that is being held.
+**/
+void let_go_of_all_hands(limb_link_table_t *links) {
+	while (links->num_rows > 0) {
+		unlink_limb(links->dense_id[0], links);
 	}
 }
 
@@ -222,11 +676,98 @@ Use IK to move all limbs to (or as close as possible to) their end effectors.
 **/
 void move_limbs_directly_to_end_effectors(limb_table_t *table) {
 	FOR_ROWS(limb_index, *table) {
+		if (table->posed[limb_index]) { continue; }
 		limb_id_t limb = get_limb_id(limb_index, table);
 		move_limb_directly_to(limb, table->end_effector[limb_index], table);
 	}
 }
 
+
+/**
+Does the budget keep any limbs from being moved?
+**/
+bool is_ik_budget_limited(const ik_budget_t *budget) {
+	return budget && (budget->max_bones > 0 || budget->max_time > 0);
+}
+
+
+/**
+Use IK to move the given limbs (by index) to their end effectors, as many as the budget allows.
+
+Limbs go in order of priority: how far their tips are from their end
+effectors, how long they have been skipped, and whether they have a goal
+(or step) or are near the focus. Skipped limbs keep their pose and rise in
+priority every step, so every limb gets its turn. The most important limb
+is always moved (even if it's over budget on its own).
+
+With a work budget (bones) the chosen limbs are moved on the pool (if
+any). With a time budget they are moved one at the time on this thread
+until time runs out.
+**/
+void move_limbs_to_end_effectors_within_budget(
+		const ik_budget_t *budget, const uint16_t limb_index[], size_t num,
+		const limb_goal_table_t *goals, const limb_step_table_t *steps,
+		ik_pool_t *pool, limb_table_t *limbs) {
+
+	if (!is_ik_budget_limited(budget)) {
+		move_limbs_to_end_effectors_in_parallel(pool, limb_index, num, limbs);
+		return;
+	}
+	double start = get_profile_clock();
+
+	// Prioritize (insertion sort, highest first and otherwise in the given order)
+	uint16_t order[max_limb_table_rows];
+	float priority[max_limb_table_rows];
+	FOR_IN(i, num) {
+		uint16_t l = limb_index[i];
+		limb_id_t limb = limbs->dense_id[l];
+		float residual = (limbs->root_bone[l] ? vec3_distance(get_limb_tip_position(limb, limbs), limbs->end_effector[l]) : 0);
+		bool has_goal = has_limb_goal(limb, goals) || has_limb_step(limb, steps);
+		bool near_focus = vec3_distance(limbs->position[l], budget->focus) <= budget->focus_radius;
+		float p = residual * ik_priority_per_residual +
+			limbs->ik_skipped_steps[l] * ik_priority_per_skipped_step +
+			(has_goal ? ik_priority_of_goal : 0) +
+			(near_focus ? ik_priority_near_focus : 0);
+
+		size_t j = i;
+		while (j > 0 && priority[j - 1] < p) {
+			priority[j] = priority[j - 1];
+			order[j] = order[j - 1];
+			j--;
+		}
+		priority[j] = p;
+		order[j] = l;
+	}
+
+	// Move as many as there is room for
+	size_t num_moved = 0;
+	if (budget->max_time > 0) {
+		while (num_moved < num && (num_moved == 0 || get_profile_clock() - start < budget->max_time)) {
+			uint16_t l = order[num_moved++];
+			move_limb_directly_to(limbs->dense_id[l], limbs->end_effector[l], limbs);
+		}
+	} else {
+		unsigned num_bones = 0;
+		while (num_moved < num) {
+			unsigned limb_bones = count_limb_bones(order[num_moved], limbs);
+			if (num_moved > 0 && num_bones + limb_bones > budget->max_bones) { break; }
+			num_bones += limb_bones;
+			num_moved++;
+		}
+		move_limbs_to_end_effectors_in_parallel(pool, order, num_moved, limbs);
+	}
+
+	// The rest wait (for a later step)
+	FOR_RANGE(i, num_moved, num) {
+		uint16_t l = order[i];
+		if (limbs->ik_skipped_steps[l] < UINT16_MAX) { limbs->ik_skipped_steps[l]++; }
+		limbs->ik_residual[l] = (limbs->root_bone[l] ? vec3_distance(get_limb_tip_position(limbs->dense_id[l], limbs), limbs->end_effector[l]) : 0);
+		limbs->ik_clamps[l] = 0;
+		limbs->ik_passes[l] = 0;
+	}
+}
+
+
 void move_limb_directly_to(limb_id_t limb, vec3_t end_pos, limb_table_t *table) {
 	int limb_index = get_limb_index(limb, table);
 
@@ -236,10 +777,34 @@ void move_limb_directly_to(limb_id_t limb, vec3_t end_pos, limb_table_t *table)
 	size_t num_bones = collect_bones(limb, table, bones, 32);
 	vec3_t root_pos = table->position[limb_index];
 	quat_t root_ori = table->orientation[limb_index];
-	FOR_IN(i, num_fabrik_passes) {
-		reposition_bones_with_fabrik(root_pos, root_ori, end_pos, bones, num_bones);
+	unsigned num_clamps = 0;
+	int passes_to_tolerance = num_fabrik_passes + 1;
+	float residual = 0;
+	if (table->ik_solver[limb_index] == iks_two_hinges) {
+		// (One pass, in closed form)
+		assert(num_bones == 2);
+		num_clamps = reposition_two_hinged_bones(root_pos, root_ori, end_pos, bones);
+		residual = vec3_distance(get_bone_tip(bones[1]), end_pos);
+		passes_to_tolerance = (residual <= ik_pass_tolerance ? 1 : 2);
+	} else {
+		FOR_IN(i, num_fabrik_passes) {
+			num_clamps += reposition_bones_with_fabrik(root_pos, root_ori, end_pos, bones, num_bones);
+
+			// (Only looking at how far from the end position the tip is)
+			vec3_t tip = (num_bones > 0 ? get_bone_tip(bones[num_bones - 1]) : root_pos);
+			residual = vec3_distance(tip, end_pos);
+			if (residual <= ik_pass_tolerance && passes_to_tolerance > num_fabrik_passes) {
+				passes_to_tolerance = i + 1;
+			}
+		}
 	}
 
+	// How well it went
+	table->ik_residual[limb_index] = residual;
+	table->ik_clamps[limb_index] = (num_clamps < UINT16_MAX ? num_clamps : UINT16_MAX);
+	table->ik_passes[limb_index] = passes_to_tolerance;
+	table->ik_skipped_steps[limb_index] = 0;
+
 	// Reapply changes (directly)
 	uint16_t seg_index = table->root_bone[limb_index];
 	FOR_ITR(bone_t, seg_itr, bones, num_bones) {
@@ -251,23 +816,26 @@ void move_limb_directly_to(limb_id_t limb, vec3_t end_pos, limb_table_t *table)
 		// Continue to next bone
 		seg_index = table->bone_nodes[seg_index].next_index;
 	}
+	refresh_limb_tips(limb_index, table);
 }
 
 /**
 Apply FABRIK (Forward and Backwards Reaching Inverse Kinnematics) to given array of bones.
+
+Returns how many times constraints clamped a bone (in both directions).
 **/
-void reposition_bones_with_fabrik(
+unsigned reposition_bones_with_fabrik(
 		vec3_t root_pos, quat_t root_ori, const vec3_t end_pos,
 		bone_t arr[], size_t num) {
-	void apply_fabrik_forward_pass(vec3_t origin, const vec3_t end_pos, bone_t arr[], size_t num);
-	void apply_fabrik_inverse_pass(vec3_t, quat_t, const vec3_t end_pos, bone_t arr[], size_t num);
-
-	apply_fabrik_forward_pass(root_pos, end_pos, arr, num);
-	apply_fabrik_inverse_pass(root_pos, root_ori, end_pos, arr, num);
+	unsigned num_clamps = fabrik_forward_pass(root_pos, end_pos, arr, num);
+	num_clamps += fabrik_inverse_pass(root_pos, root_ori, end_pos, arr, num);
+	return num_clamps;
 }
 
-void apply_fabrik_forward_pass(vec3_t origin, const vec3_t end_pos, bone_t arr[], size_t num) {
 
+static inline unsigned fabrik_forward_pass(vec3_t origin, const vec3_t end_pos, bone_t arr[], size_t num) {
+
+	unsigned num_clamps = 0;
 	bone_t next_bone = {{jc_no_constraint}, end_pos, quat_identity, 0.f};
 	for (int i = num - 1; i >= 0 ; i--) {
 
@@ -286,20 +854,27 @@ void apply_fabrik_forward_pass(vec3_t origin, const vec3_t end_pos, bone_t arr[]
 		vec3_t dir = get_bone_forward(&arr[i]);
 		arr[i].orientation = quat_mul(quat_from_vec3_pair(dir, n), arr[i].orientation);
 
-		constrain_to_next_bone(&next_bone, &arr[i]);
+		num_clamps += constrain_to_next_bone_as(next_bone.constraint.type, &next_bone, &arr[i]);
 
 		// Continue to the next one
 		next_bone = arr[i];
 	}
+	return num_clamps;
 }
 
 /**
 Constrain this bone relative to the next one (or the end effector semi-bone).
 **/
 void constrain_to_next_bone(const bone_t *next_bone, bone_t *this_bone) {
+	constrain_to_next_bone_as(next_bone->constraint.type, next_bone, this_bone);
+}
+
+/** (Returns true if the constraint had to clamp the bone) **/
+static inline bool constrain_to_next_bone_as(bone_constraint_e type, const bone_t *next_bone, bone_t *this_bone) {
 	vec3_t b = vec3_between(this_bone->joint_pos, next_bone->joint_pos);
+	bool clamped = false;
 
-	switch (next_bone->constraint.type) {
+	switch (type) {
 		case jc_no_constraint: {} break;
 		case jc_pole: { /* TODO */ } break;
 		case jc_hinge: {
@@ -323,13 +898,13 @@ void constrain_to_next_bone(const bone_t *next_bone, bone_t *this_bone) {
 
 			// Angle?
 			// atan(0, +1) = 0
-			float angle = atan2(bone_up, bone_forward);
+			float angle = la_atan2f(bone_up, bone_forward);
 			angle = (angle > pi ? angle - tau : angle);
 			TRACE_FLOAT(180 * angle / pi);
 
 			// Clamp angle to constraint
-			if (angle > next_bone->constraint.max_ang) { angle = next_bone->constraint.max_ang; }
-			if (angle < next_bone->constraint.min_ang) { angle = next_bone->constraint.min_ang; }
+			if (angle > next_bone->constraint.max_ang) { angle = next_bone->constraint.max_ang; clamped = true; }
+			if (angle < next_bone->constraint.min_ang) { angle = next_bone->constraint.min_ang; clamped = true; }
 			TRACE_FLOAT(180 * angle / pi);
 
 			// Reset orientation
@@ -343,13 +918,16 @@ void constrain_to_next_bone(const bone_t *next_bone, bone_t *this_bone) {
 		} break;
 		case num_bone_constraints: { assert(false); } break;
 	}
+	return clamped;
 }
 
 
-void apply_fabrik_inverse_pass(
+static inline unsigned fabrik_inverse_pass(
 		vec3_t root_pos, quat_t root_ori, const vec3_t end_pos,
 		bone_t arr[], size_t num) {
 
+	unsigned num_clamps = 0;
+
 	// Inverse pass
 	// (Pretend root is a limb segment without length)
 	bone_t prev_bone = {{jc_no_constraint}, root_pos, root_ori, 0};
@@ -364,17 +942,24 @@ void apply_fabrik_inverse_pass(
 		vec3_t bone_dir = get_bone_forward(&arr[i]);
 		arr[i].orientation = quat_mul(quat_from_vec3_pair(bone_dir, new_dir), arr[i].orientation);
 
-		constrain_to_prev_bone(&prev_bone, &arr[i]);
+		num_clamps += constrain_to_prev_bone_as(arr[i].constraint.type, &prev_bone, &arr[i]);
 
 		// Continue to the next one
 		prev_bone = arr[i];
 	}
+	return num_clamps;
 }
 
 
 void constrain_to_prev_bone(const bone_t *prev_bone, bone_t *this_bone) {
+	constrain_to_prev_bone_as(this_bone->constraint.type, prev_bone, this_bone);
+}
 
-	switch (this_bone->constraint.type) {
+/** (Returns true if the constraint had to clamp the bone) **/
+static inline bool constrain_to_prev_bone_as(bone_constraint_e type, const bone_t *prev_bone, bone_t *this_bone) {
+	bool clamped = false;
+
+	switch (type) {
 		case jc_no_constraint: {} break;
 		case jc_pole: {
 			vec3_t this_dir = get_bone_forward(this_bone);
@@ -382,6 +967,7 @@ void constrain_to_prev_bone(const bone_t *prev_bone, bone_t *this_bone) {
 			if (vec3_dot(prev_dir, this_dir) < 1) {
 				quat_t r = quat_from_vec3_pair(this_dir, prev_dir);
 				this_bone->orientation = quat_mul(r, this_bone->orientation);
+				clamped = vec3_dot(prev_dir, this_dir) < 0.9999f; // (Not just rounding)
 			}
 		} break;
 		case jc_hinge: {
@@ -405,13 +991,13 @@ void constrain_to_prev_bone(const bone_t *prev_bone, bone_t *this_bone) {
 
 			// Angle?
 			// atan(0, +1) = 0
-			float angle = atan2(bone_up, bone_forward);
+			float angle = la_atan2f(bone_up, bone_forward);
 			angle = (angle > pi ? angle - tau : angle);
 			TRACE_FLOAT(180 * angle / pi);
 
 			// Clamp angle to constraint
-			if (angle > this_bone->constraint.max_ang) { angle = this_bone->constraint.max_ang; }
-			if (angle < this_bone->constraint.min_ang) { angle = this_bone->constraint.min_ang; }
+			if (angle > this_bone->constraint.max_ang) { angle = this_bone->constraint.max_ang; clamped = true; }
+			if (angle < this_bone->constraint.min_ang) { angle = this_bone->constraint.min_ang; clamped = true; }
 			TRACE_FLOAT(180 * angle / pi);
 
 			// Reset orientation
@@ -420,48 +1006,519 @@ void constrain_to_prev_bone(const bone_t *prev_bone, bone_t *this_bone) {
 		} break;
 		case num_bone_constraints: { assert(false); } break;
 	}
+	return clamped;
+}
+
+
+/**
+Pick the IK solver for a limb with the given bones.
 
+Two hinged bones (like legs) bend in the plane of the root hinge, so they are
+solved in closed form. Anything else goes through FABRIK.
+**/
+ik_solver_e choose_ik_solver(const bone_t bones[], size_t num) {
+	if (num == 2 && bones[0].constraint.type == jc_hinge && bones[1].constraint.type == jc_hinge) {
+		return iks_two_hinges;
+	}
+	return iks_fabrik;
 }
 
 
-//// Limb momentum ////
+/**
+Place two hinged bones so that the tip gets as close to the end position as the hinges allow.
+
+Hinges turn around the right axis of what comes before them, and turning
+around it leaves it as it is, so both bones stay in the plane through the root
+that is spanned by its forward and up axes. The knee angle comes from the law
+of cosines (bent either way), the hip aims at the end position and the knee is
+aimed again from where the hip ended up. The closest of the two bends wins.
+
+Returns how many bones the hinges clamped (like reposition_bones_with_fabrik).
+**/
+unsigned reposition_two_hinged_bones(vec3_t root_pos, quat_t root_ori, const vec3_t end_pos, bone_t arr[]) {
+
+	// End position in the hinge plane
+	vec3_t forward = quat_rotate_vec3(root_ori, vec3_positive_x);
+	vec3_t up = quat_rotate_vec3(root_ori, vec3_positive_y);
+	vec3_t side = quat_rotate_vec3(root_ori, vec3_positive_z);
+	vec3_t to_end = vec3_between(root_pos, end_pos);
+	float x = vec3_dot(to_end, forward);
+	float y = vec3_dot(to_end, up);
+
+	// How much the knee has to bend to reach that far (or as far as it can)
+	float l1 = arr[0].distance, l2 = arr[1].distance;
+	float cos_bend = (l1 > 0 && l2 > 0 ? (x*x + y*y - l1*l1 - l2*l2) / (2 * l1 * l2) : 1);
+	float bend = acosf(cos_bend < -1 ? -1 : (cos_bend > 1 ? 1 : cos_bend));
+	float aim = la_atan2f(y, x);
+
+	float best_hip = 0, best_knee = 0, best_distance = INFINITY;
+	unsigned best_clamps = 0;
+	FOR_IN(i, 2) {
+		unsigned num_clamps = 0, num_first_clamps = 0; // (Only the final angles count)
+		float knee = clamp_hinge_angle(i ? -bend : bend, &arr[1], &num_first_clamps);
+
+		// Aim the hip so that the tip points at the end position
+		float s, c;
+		la_sincosf(knee, &s, &c);
+		float hip = clamp_hinge_angle(aim - la_atan2f(l2 * s, l1 + l2 * c), &arr[0], &num_clamps);
+
+		// Aim the knee again (it may have to make up for the hip)
+		la_sincosf(hip, &s, &c);
+		float knee_x = l1 * c, knee_y = l1 * s;
+		knee = clamp_hinge_angle(la_atan2f(y - knee_y, x - knee_x) - hip, &arr[1], &num_clamps);
+
+		la_sincosf(hip + knee, &s, &c);
+		float dx = knee_x + l2 * c - x, dy = knee_y + l2 * s - y;
+		float distance = dx*dx + dy*dy;
+		if (distance < best_distance) {
+			best_hip = hip;
+			best_knee = knee;
+			best_distance = distance;
+			best_clamps = num_clamps;
+		}
+	}
+
+	// Same orientations as hinges turned by these angles
+	arr[0].joint_pos = root_pos;
+	arr[0].orientation = quat_mul(quat_from_axis_angle(side, best_hip), root_ori);
+	arr[1].joint_pos = get_bone_tip(arr[0]);
+	arr[1].orientation = quat_mul(quat_from_axis_angle(side, best_knee), arr[0].orientation);
+	return best_clamps;
+}
 
 /**
-Perpetuate motion from the previous simulation step.
+Clamp a hinge angle to the limits of the bone, counting clamps.
+
+Angles outside go to whichever limit is the shortest turn away, so a knee
+asked to bend a little past its limit does not snap straight.
 **/
-void perpetuate_limb_momentums(float dt, limb_swing_table_t *momentums, limb_table_t *limbs) {
+float clamp_hinge_angle(float angle, const bone_t *bone, unsigned *num_clamps) {
+	float min_ang = bone->constraint.min_ang, max_ang = bone->constraint.max_ang;
+	angle = (angle > pi ? angle - tau : (angle < -pi ? angle + tau : angle));
+	if (angle >= min_ang && angle <= max_ang) { return angle; }
+
+	(*num_clamps)++;
+	float past_max = (angle > max_ang ? angle - max_ang : angle + tau - max_ang);
+	float before_min = (angle < min_ang ? min_ang - angle : min_ang + tau - angle);
+	return (past_max <= before_min ? max_ang : min_ang);
+}
 
-	FOR_ROWS(momentum_index, *momentums) {
-		limb_id_t limb = momentums->dense_id[momentum_index];
-		int limb_index = get_limb_index(limb, limbs);
 
-		// Get data
-		vec3_t prev_pos = momentums->prev_position[momentum_index];
-		vec3_t curr_pos = get_limb_tip_position(limb, limbs);
+//// Limb swing ////
+
+/**
+Let swinging limbs swing like (damped) pendulums hanging from their roots.
+
+Roots follow their actors, so the rest of the chain lags behind and swings
+when actors start, stop or turn. Bones and end effectors are set to the
+new pose (goals, steps and links may move the end effectors after this).
+**/
+void swing_limbs(float dt, vec3_t gravity, limb_swing_table_t *swings, limb_table_t *limbs) {
+	swing_chains_t chains;
+	gather_swing_chains(swings, limbs, &chains);
+	solve_swing_chains(dt, gravity, swings, &chains);
+	scatter_swing_chains(swings, &chains, limbs);
+}
+
 
-		// Move things (assuming fixed time step)
-		vec3_t last_move = vec3_between(prev_pos, curr_pos);
-		vec3_t next_pos = vec3_add(curr_pos, last_move);
-		limbs->end_effector[limb_index] = next_pos;
+/**
+Copy the current pose of every swinging limb into chains.
+**/
+void gather_swing_chains(const limb_swing_table_t *swings, const limb_table_t *limbs, swing_chains_t *chains) {
+	FOR_ROWS(r, *swings) {
+		int limb_index = get_limb_index(swings->dense_id[r], limbs);
+		vec3_t root = limbs->position[limb_index];
+		chains->root_x[r] = root.x;
+		chains->root_y[r] = root.y;
+		chains->root_z[r] = root.z;
+
+		// Tip of each bone (repeating the last one past the end)
+		uint16_t bone = limbs->root_bone[limb_index];
+		vec3_t tip = root;
+		FOR_IN(p, max_limb_swing_points) {
+			if (p < swings->num_points[r]) {
+				tip = get_bone_tip_position(bone, limbs);
+				bone = limbs->bone_nodes[bone].next_index;
+			}
+			chains->x[p][r] = tip.x;
+			chains->y[p][r] = tip.y;
+			chains->z[p][r] = tip.z;
+			chains->weight[p][r] = (p < swings->num_points[r] ? 1 : 0);
+		}
+	}
+}
+
+
+/**
+Move all chains one (Verlet) step and pull their bones back to length.
+
+Runs across all chains for one point at the time (so it vectorizes).
+**/
+void solve_swing_chains(float dt, vec3_t gravity, limb_swing_table_t *swings, swing_chains_t *c) {
+	const size_t num = swings->num_rows;
+	const vec3_t g = vec3_mul(gravity, dt * dt);
+
+	// Keep moving (and fall)
+	FOR_IN(p, max_limb_swing_points) {
+		float *x = c->x[p], *y = c->y[p], *z = c->z[p], *w = c->weight[p];
+		float *px = swings->prev_x[p], *py = swings->prev_y[p], *pz = swings->prev_z[p];
+		FOR_IN(r, num) {
+			float vx = (x[r] - px[r]) * limb_swing_damping + g.x;
+			float vy = (y[r] - py[r]) * limb_swing_damping + g.y;
+			float vz = (z[r] - pz[r]) * limb_swing_damping + g.z;
+			px[r] = x[r];
+			py[r] = y[r];
+			pz[r] = z[r];
+			x[r] += vx * w[r];
+			y[r] += vy * w[r];
+			z[r] += vz * w[r];
+		}
+	}
+
+	// Keep bone lengths
+	FOR_IN(pass, num_swing_constraint_passes) {
+		// First bone hangs from the root (which does not budge)
+		{
+			float *x = c->x[0], *y = c->y[0], *z = c->z[0], *len = swings->rest_length[0];
+			FOR_IN(r, num) {
+				float dx = x[r] - c->root_x[r], dy = y[r] - c->root_y[r], dz = z[r] - c->root_z[r];
+				float d = sqrtf(dx * dx + dy * dy + dz * dz);
+				float s = (d > 0 ? (d - len[r]) / d : 0);
+				x[r] -= dx * s;
+				y[r] -= dy * s;
+				z[r] -= dz * s;
+			}
+		}
 
-		// Save position for next pass
-		momentums->prev_position[momentum_index] = curr_pos;
+		// The rest share the correction with the bone before them
+		FOR_RANGE(p, 1, max_limb_swing_points) {
+			float *x0 = c->x[p - 1], *y0 = c->y[p - 1], *z0 = c->z[p - 1];
+			float *x1 = c->x[p], *y1 = c->y[p], *z1 = c->z[p];
+			float *len = swings->rest_length[p], *w = c->weight[p];
+			FOR_IN(r, num) {
+				float dx = x1[r] - x0[r], dy = y1[r] - y0[r], dz = z1[r] - z0[r];
+				float d = sqrtf(dx * dx + dy * dy + dz * dz);
+				float s = (d > 0 ? 0.5f * (d - len[r]) / d : 0) * w[r];
+				x0[r] += dx * s;
+				y0[r] += dy * s;
+				z0[r] += dz * s;
+				x1[r] -= dx * s;
+				y1[r] -= dy * s;
+				z1[r] -= dz * s;
+			}
+		}
 	}
 }
 
 
 /**
-Apply gravity to limbs with momentum.
+Pose the bones of every swinging limb along its chain.
 **/
-void apply_gravity_to_limbs(float dt, vec3_t gravity, limb_swing_table_t *momentums, limb_table_t *limbs) {
-	vec3_t gravity_step = vec3_mul(gravity, dt * dt / 2);
+void scatter_swing_chains(const limb_swing_table_t *swings, const swing_chains_t *chains, limb_table_t *limbs) {
+	FOR_ROWS(r, *swings) {
+		int limb_index = get_limb_index(swings->dense_id[r], limbs);
+		vec3_t from = limbs->position[limb_index];
+		uint16_t bone = limbs->root_bone[limb_index];
+		FOR_IN(p, swings->num_points[r]) {
+			vec3_t to = vec3(chains->x[p][r], chains->y[p][r], chains->z[p][r]);
+
+			// Rotate as little as possible
+			bone_t *b = &limbs->bones[bone];
+			b->joint_pos = from;
+			b->orientation = quat_mul(quat_from_vec3_pair(get_bone_forward(b), vec3_direction(from, to)), b->orientation);
+
+			from = to;
+			bone = limbs->bone_nodes[bone].next_index;
+		}
+		limbs->end_effector[limb_index] = from;
+		refresh_limb_tips(limb_index, limbs);
+	}
+}
 
-	FOR_ROWS(momentum_index, *momentums) {
-		limb_id_t limb = momentums->dense_id[momentum_index];
-		int limb_index = get_limb_index(limb, limbs);
 
-		// Move end effectors
-		add_vec3(gravity_step, &limbs->end_effector[limb_index]);
+//// Secondary limb kinematics ////
+
+/**
+Swing limbs, move them by goals, steps and links, then apply IK
+(one phase at the time, going through the limbs in each phase).
+**/
+void update_limbs_phase_by_phase(float dt, const limb_update_env_i *env) {
+	PROFILE_SCOPE("swing_limbs") {
+		swing_limbs(dt, env->gravity, env->swings, env->limbs);
+	}
+	PROFILE_SCOPE("move_limbs_toward_goals") {
+		move_limbs_toward_goals(dt, env->goals, env->limbs);
+	}
+	PROFILE_SCOPE("move_limbs_along_steps") {
+		move_limbs_along_steps(env->time, env->steps, env->limbs);
+	}
+	PROFILE_SCOPE("move_linked_limbs_together") {
+		move_linked_limbs_together(env->links, env->limbs);
+	}
+	PROFILE_SCOPE("move_limbs_directly_to_end_effectors") {
+		if (env->ik_pool || is_ik_budget_limited(env->ik_budget)) {
+			uint16_t unposed[max_limb_table_rows];
+			size_t num_unposed = 0;
+			FOR_ROWS(l, *env->limbs) {
+				if (!env->limbs->posed[l]) { unposed[num_unposed++] = l; }
+			}
+			move_limbs_to_end_effectors_within_budget(
+				env->ik_budget, unposed, num_unposed, env->goals, env->steps, env->ik_pool, env->limbs);
+		} else {
+			move_limbs_directly_to_end_effectors(env->limbs);
+		}
+	}
+	PROFILE_SCOPE("delete_accomplished_limb_goals") {
+		delete_accomplished_limb_goals(env->limbs, env->goals);
+	}
+	PROFILE_SCOPE("delete_finished_limb_steps") {
+		delete_finished_limb_steps(env->time, env->steps);
+	}
+}
+
+
+/**
+Same as update_limbs_phase_by_phase(), but taking one limb at the time
+through every phase after the swing (so its end effector is loaded and
+stored only once).
+
+Gives bit for bit the same result: linked limbs are solved (and moved by
+IK) one island at the time after the other limbs, and accomplished goals
+are deleted after the pass in the same order.
+
+With an IK pool or budget, IK of every limb (linked or not) is left for
+after the islands are solved, and done in parallel or as far as the budget
+goes, just like update_limbs_phase_by_phase() does.
+**/
+void update_limbs_fused(float dt, const limb_update_env_i *env) {
+	limb_table_t *limbs = env->limbs;
+	limb_swing_table_t *swings = env->swings;
+	limb_goal_table_t *goals = env->goals;
+	const limb_step_table_t *steps = env->steps;
+	const limb_link_table_t *links = env->links;
+
+	// Swinging runs across all swinging limbs at once
+	PROFILE_SCOPE("swing_limbs") {
+		swing_limbs(dt, env->gravity, swings, limbs);
+	}
+
+	// Row of each limb in the other tables (if any)
+	int16_t goal_row[max_limb_table_rows], step_row[max_limb_table_rows];
+	PROFILE_SCOPE("gather_limb_rows") {
+		FOR_ROWS(l, *limbs) { goal_row[l] = step_row[l] = -1; }
+		FOR_ROWS(i, *goals) { goal_row[get_limb_index(goals->dense_id[i], limbs)] = i; }
+		FOR_ROWS(i, *steps) { step_row[get_limb_index(steps->dense_id[i], limbs)] = i; }
+	}
+
+	// Linked limbs are solved together
+	link_islands_t islands;
+	PROFILE_SCOPE("find_link_islands") {
+		find_link_islands(links, limbs, &islands);
+	}
+
+	// IK waits for the islands (when it's done in parallel or on a budget)
+	bool defer_ik = env->ik_pool || is_ik_budget_limited(env->ik_budget);
+
+	PROFILE_SCOPE("update_limbs_fused") {
+		FOR_ROWS(l, *limbs) {
+			limb_id_t limb = limbs->dense_id[l];
+			vec3_t ee_pos = limbs->end_effector[l];
+
+			// Goal
+			if (goal_row[l] >= 0) {
+				ee_pos = move_end_effector_toward_goal(dt, ee_pos, goal_row[l], goals);
+			}
+
+			// Step
+			if (step_row[l] >= 0) {
+				ee_pos = get_limb_step_position(step_row[l], env->time, steps);
+			}
+
+			// IK (linked limbs wait for their island, posed ones need none)
+			limbs->end_effector[l] = ee_pos;
+			if (islands.island_of[l] >= 0 || limbs->posed[l] || defer_ik) { continue; }
+			move_limb_directly_to(limb, ee_pos, limbs);
+
+			// Goal progress (deleted below)
+			if (goal_row[l] >= 0) {
+				advance_limb_goal(goal_row[l], ee_pos, goals);
+			}
+		}
+	}
+
+	// Islands of linked limbs
+	PROFILE_SCOPE("solve_link_islands") {
+		FOR_IN(i, islands.num_islands) {
+			solve_link_island(i, &islands, limbs);
+			if (defer_ik) { continue; }
+			FOR_RANGE(m, islands.island_start[i], islands.island_start[i + 1]) {
+				uint16_t l = islands.limb_index[m];
+				move_limb_directly_to(limbs->dense_id[l], limbs->end_effector[l], limbs);
+				if (goal_row[l] >= 0) {
+					advance_limb_goal(goal_row[l], limbs->end_effector[l], goals);
+				}
+			}
+		}
+	}
+
+	// Deferred IK, of linked limbs too (so they count towards the budget)
+	// (goals progress the same, since IK leaves end effectors be)
+	if (defer_ik) {
+		uint16_t deferred[max_limb_table_rows];
+		size_t num_deferred = 0;
+		FOR_ROWS(l, *limbs) {
+			if (!limbs->posed[l]) { deferred[num_deferred++] = l; }
+		}
+		PROFILE_SCOPE("move_limbs_to_end_effectors_within_budget") {
+			move_limbs_to_end_effectors_within_budget(
+				env->ik_budget, deferred, num_deferred, goals, steps, env->ik_pool, limbs);
+		}
+		FOR_IN(i, num_deferred) {
+			uint16_t l = deferred[i];
+			if (goal_row[l] >= 0) {
+				advance_limb_goal(goal_row[l], limbs->end_effector[l], goals);
+			}
+		}
+	}
+
+	// Deferred deletion
+	PROFILE_SCOPE("delete_accomplished_limb_goals") {
+		FOR_ROWS(goal_index, *goals) {
+			if (goals->curve_index[goal_index] < goals->curve_length[goal_index]) { continue; }
+			delete_limb_goal_at_index(goal_index--, goals);
+		}
+	}
+	PROFILE_SCOPE("delete_finished_limb_steps") {
+		delete_finished_limb_steps(env->time, env->steps);
+	}
+}
+
+
+//// Population update ////
+
+/**
+Update the dynamically changing part of the simulation.
+**/
+void update_population(float dt, const landscape_t *land, population_t *pop) {
+
+	// Move whole actors
+	PROFILE_SCOPE("move_actors") {
+		move_actors(dt, &pop->actors);
+		calculate_actor_transforms(&pop->actors);
+	}
+
+	// Have the ground around them loaded
+	if (land->ground.stream) {
+		PROFILE_SCOPE("stream_terrain_around_actors") {
+			stream_terrain_around_actors(&pop->actors, land->ground.stream);
+		}
+	}
+
+	// Keep track of who is near who
+	PROFILE_SCOPE("build_actor_grid") {
+		build_actor_grid(actor_grid_cell_size, &pop->actors, &pop->actor_grid);
+	}
+
+	// Move limbs attached to actors
+	PROFILE_SCOPE("reposition_attached_limbs") {
+		reposition_attached_limbs(&pop->arms, &pop->actors, &pop->limbs);
+		reposition_attached_limbs(&pop->legs, &pop->actors, &pop->limbs);
+	}
+
+	// Hold hands with neighbours
+	if (pop->hold_hands) {
+		PROFILE_SCOPE("hold_hands_with_nearby_actors") {
+			hold_hands_with_nearby_actors(
+				&pop->actors, &pop->actor_grid, &pop->arms,
+				&pop->limbs, &pop->limb_tip_links);
+		}
+	}
+
+	// Animate actors
+	animation_env_i anim_env = {
+		&pop->actors,
+		&pop->arms, &pop->legs,
+		&land->ground, &land->gait_params,
+		&pop->limbs, &pop->limb_goals, &pop->limb_steps, &pop->limb_tip_links,
+		&pop->gait, pop->time, pop->timed_steps
+	};
+	if (pop->gait_playback.poses) {
+		PROFILE_SCOPE("play_back_gaits") {
+			play_back_gaits(dt, &pop->gait_playback, &anim_env);
+		}
+	}
+	PROFILE_SCOPE("animate_scheduled_actor_legs") {
+		animate_scheduled_actor_legs(dt, &anim_env);
+	}
+	PROFILE_SCOPE("keep_actors_actors_above_ground") {
+		keep_actors_actors_above_ground(3.0, &land->ground, &pop->actors);
+	}
+
+	// Update (secondary) kinematics
+	limb_update_env_i limb_env = {
+		&pop->limbs, &pop->limb_swings, &pop->limb_goals, &pop->limb_steps,
+		&pop->limb_tip_links, vec3(0,-4,0), pop->time + dt, pop->ik_pool, &pop->ik_budget
+	};
+	if (pop->fuse_limb_updates) {
+		update_limbs_fused(dt, &limb_env);
+	} else {
+		update_limbs_phase_by_phase(dt, &limb_env);
+	}
+
+	pop->time += dt;
+	pop->num_steps++;
+	PROFILE_SCOPE("collect_ik_metrics") {
+		collect_ik_metrics(pop->num_steps, pop->time, &pop->limbs, &pop->ik_metrics);
+	}
+}
+
+
+//// Population interpolation ////
+
+/**
+Blend two consecutive population frames (for rendering between simulation steps).
+
+Starts from a copy of the later frame and only blends rows that exist in both.
+**/
+void interpolate_population(float s, const population_t *from, const population_t *to, population_t *out) {
+	*out = *to;
+
+	// Actors
+	actor_table_t *actors = &out->actors;
+	FOR_ROWS(a, *actors) {
+		if (a >= from->actors.num_rows) { break; }
+		actor_id_t a1 = from->actors.dense_id[a], a2 = actors->dense_id[a];
+		if (a1.id != a2.id || a1.generation != a2.generation) { continue; }
+
+		location_t l1 = from->actors.location[a], l2 = to->actors.location[a];
+		actors->location[a].position = vec3_lerp(s, l1.position, l2.position);
+		actors->location[a].orientation_y = l1.orientation_y + (l2.orientation_y - l1.orientation_y) * s;
+	}
+	calculate_actor_transforms(actors);
+
+	// Limbs (and their bones)
+	limb_table_t *limbs = &out->limbs;
+	FOR_ROWS(l, *limbs) {
+		if (l >= from->limbs.num_rows) { break; }
+		limb_id_t l1 = from->limbs.dense_id[l], l2 = limbs->dense_id[l];
+		if (l1.id != l2.id || l1.generation != l2.generation) { continue; }
+
+		limbs->position[l] = vec3_lerp(s, from->limbs.position[l], to->limbs.position[l]);
+		limbs->orientation[l] = quat_nlerp(s, from->limbs.orientation[l], to->limbs.orientation[l]);
+		limbs->end_effector[l] = vec3_lerp(s, from->limbs.end_effector[l], to->limbs.end_effector[l]);
+
+		// Bones are only comparable if the chain is the same
+		uint16_t root_bone = limbs->root_bone[l];
+		if (root_bone != from->limbs.root_bone[l]) { continue; }
+		for (uint16_t b = root_bone; b; ) {
+			const bone_t *b1 = &from->limbs.bones[b], *b2 = &to->limbs.bones[b];
+			limbs->bones[b].joint_pos = vec3_lerp(s, b1->joint_pos, b2->joint_pos);
+			limbs->bones[b].orientation = quat_nlerp(s, b1->orientation, b2->orientation);
+
+			b = limbs->bone_nodes[b].next_index;
+			if (b == root_bone) { b = 0; }
+		}
+		refresh_limb_tips(l, limbs);
 	}
 }
 
@@ -2,7 +2,11 @@
 #define LINALG_H
 
 #include <math.h>
+#include <stdint.h>
 #include <assert.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 
 #define LADEF static inline
@@ -10,6 +14,12 @@
 static const float tau = 6.28318530717958647692f;
 static const float pi = 3.14159265358979323846f;
 
+// Trade last-ulp precision for speed in lengths, normals, angles and rotations
+// (see the fast_ functions below for how far off they may be)
+#ifndef LINALG_FAST_MATH
+#define LINALG_FAST_MATH 0
+#endif
+
 /***
 Scalar math.
 ***/
@@ -21,6 +31,93 @@ LADEF float minf(float a, float b) { return (a < b ? a : b); }
 LADEF float maxf(float a, float b) { return (a > b ? a : b); }
 
 
+/**
+Approximate 1/sqrt(x) for x > 0.
+
+The SSE estimate refined by a Newton step: relative error below 5e-7.
+(Without SSE: a bit trick guess refined by two: relative error below 5e-6)
+**/
+LADEF float fast_rsqrtf(float x) {
+#ifdef __SSE__
+	float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+	return y * (1.5f - 0.5f * x * y * y);
+#else
+	union { float f; uint32_t i; } u = { x };
+	u.i = 0x5f375a86u - (u.i >> 1);
+	float y = u.f;
+	y = y * (1.5f - 0.5f * x * y * y);
+	y = y * (1.5f - 0.5f * x * y * y);
+	return y;
+#endif
+}
+
+
+/**
+Approximate atan2(y, x) (0 when both are 0).
+
+Odd polynomial for atan on [0, 1] and octant folding: absolute error below 3e-6 radians.
+**/
+LADEF float fast_atan2f(float y, float x) {
+	float ax = fabsf(x), ay = fabsf(y);
+	float hi = maxf(ax, ay), lo = minf(ax, ay);
+	if (hi == 0) { return 0; }
+
+	// atan(t) for t in [0, 1]
+	float t = lo / hi, t2 = t * t;
+	float a = t * (0.99997726f + t2 * (-0.33262347f + t2 * (0.19354346f +
+		t2 * (-0.11643287f + t2 * (0.05265332f + t2 * -0.01172120f)))));
+
+	// Unfold
+	if (ay > ax) { a = 0.5f * pi - a; }
+	if (x < 0) { a = pi - a; }
+	return (y < 0 ? -a : a);
+}
+
+
+/**
+Approximate sine and cosine of the same angle (in radians).
+
+Reduced to [-pi/4, pi/4] (and the quadrant) with Taylor polynomials from
+there: absolute error below 1e-7 within a turn of 0 and below 1e-6 within
+four (reducing loses precision further out).
+**/
+LADEF void fast_sincosf(float a, float *sin_out, float *cos_out) {
+	// Quarter turns (with pi/2 in two parts, to keep the remainder precise)
+	float quarters = a * (2.f / pi);
+	int q = (int) (quarters + copysignf(0.5f, quarters));
+	float x = (a - q * 1.5707963705062866f) - q * -4.371139000186243e-08f;
+
+	float x2 = x * x;
+	float s = x * (1 + x2 * (-1.f/6 + x2 * (1.f/120 + x2 * (-1.f/5040 + x2 * (1.f/362880)))));
+	float c = 1 + x2 * (-1.f/2 + x2 * (1.f/24 + x2 * (-1.f/720 + x2 * (1.f/40320))));
+
+	// Back to the quadrant (without branches, since angles come in any order)
+	bool swap = q & 1;
+	*sin_out = ((q & 2) ? -1.f : 1.f) * (swap ? c : s);
+	*cos_out = (((q + 1) & 2) ? -1.f : 1.f) * (swap ? s : c);
+}
+
+
+/** atan2 (approximate in fast math mode) **/
+LADEF float la_atan2f(float y, float x) {
+#if LINALG_FAST_MATH
+	return fast_atan2f(y, x);
+#else
+	return atan2(y, x);
+#endif
+}
+
+/** Sine and cosine (approximate in fast math mode) **/
+LADEF void la_sincosf(float a, float *sin_out, float *cos_out) {
+#if LINALG_FAST_MATH
+	fast_sincosf(a, sin_out, cos_out);
+#else
+	*sin_out = sinf(a);
+	*cos_out = cosf(a);
+#endif
+}
+
+
 /***
 Vector with 3 elements (+ paddding)
 ***/
@@ -89,7 +186,12 @@ static inline float vec3_squared_length(vec3_t v) {
 The lenght (or 'norm') of the given vector.
 **/
 static inline float vec3_length(vec3_t v) {
+#if LINALG_FAST_MATH
+	float l2 = vec3_squared_length(v);
+	return (l2 > 0 ? l2 * fast_rsqrtf(l2) : 0);
+#else
 	return sqrtf(vec3_squared_length(v));
+#endif
 }
 
 
@@ -97,9 +199,16 @@ static inline float vec3_length(vec3_t v) {
 The normal (unit length vector) of the given vector.
 **/
 static inline vec3_t vec3_normal(vec3_t v) {
+#if LINALG_FAST_MATH
+	float l2 = vec3_squared_length(v);
+	if (l2 == 0) { return vec3(0,0,0); }
+	float r = fast_rsqrtf(l2);
+	vec3_t n = {v.x*r, v.y*r, v.z*r};
+#else
 	float l = vec3_length(v);
 	if (l == 0) { return vec3(0,0,0); }
 	vec3_t n = {v.x/l, v.y/l, v.z/l};
+#endif
 	assert_vec3(n);
 	return n;
 }
@@ -230,6 +339,19 @@ static inline vec3_t vec3_lerp(float s, vec3_t v1, vec3_t v2) {
 }
 
 
+/**
+Point on the cubic Bezier curve through the given control points (s in [0,1]).
+**/
+static inline vec3_t vec3_bezier(float s, vec3_t p0, vec3_t p1, vec3_t p2, vec3_t p3) {
+	float t = 1.f - s;
+	vec3_t r = vec3_add(
+		vec3_add(vec3_mul(p0, t * t * t), vec3_mul(p1, 3.f * t * t * s)),
+		vec3_add(vec3_mul(p2, 3.f * t * s * s), vec3_mul(p3, s * s * s)));
+	assert_vec3(r);
+	return r;
+}
+
+
 /**
 Round every scalar in the vector.
 **/
@@ -242,7 +364,13 @@ static inline vec3_t vec3_round(vec3_t v){
 #ifdef IN_TESTS
 
 bool operator== (const vec3_t& v1, const vec3_t& v2) {
+#if LINALG_FAST_MATH
+	// Approximations only agree up to their error (relative to the size of the values)
+	float e = 1e-5f * (1 + vec3_length(v1));
+	return fabsf(v1.x - v2.x) <= e && fabsf(v1.y - v2.y) <= e && fabsf(v1.z - v2.z) <= e;
+#else
 	return v1.x == v2.x && v1.y == v2.y && v1.z == v2.z;
+#endif
 }
 
 std::ostream& operator<<(std::ostream& out, const vec3_t& v) {
@@ -334,6 +462,13 @@ TEST_CASE("Operations on 3 element vectors") {
 	SECTION("Support / operator with a vector and a scalar") {
 		CHECK(vec3_div(vec3(100, 200, 300), 10.0) == vec3(10, 20, 30));
 	}
+
+	SECTION("Bezier curves start and end at the outer control points") {
+		vec3_t p0 = vec3(0, 0, 0), p1 = vec3(0, 4, 0), p2 = vec3(4, 4, 0), p3 = vec3(4, 0, 0);
+		CHECK(vec3_bezier(0, p0, p1, p2, p3) == p0);
+		CHECK(vec3_bezier(1, p0, p1, p2, p3) == p3);
+		CHECK(vec3_bezier(0.5, p0, p1, p2, p3) == vec3(2, 3, 0));
+	}
 }
 #endif // IN_TESTS
 
@@ -439,8 +574,8 @@ Rotate clockwise (in radians) around the y-axis.
 **/
 static inline mat4_t mat4_rotation_y(float r) {
 	mat4_t m = mat4_identity;
-	m.m11 = m.m33 = cosf(r);
-	m.m13 = sinf(r);
+	la_sincosf(r, &m.m13, &m.m11);
+	m.m33 = m.m11;
 	m.m31 = -m.m13;
 	return m;
 }
@@ -589,11 +724,13 @@ static inline quat_t quat_inverse(quat_t q) {
 
 static inline quat_t quat_from_axis_angle(vec3_t axis, float angle) {
 	vec3_t n = vec3_normal(axis);
+	float s, c;
+	la_sincosf(angle/2, &s, &c);
 	quat_t q = {
-		axis.x * sinf(angle/2),
-		axis.y * sinf(angle/2),
-		axis.z * sinf(angle/2),
-		cosf(angle/2)
+		axis.x * s,
+		axis.y * s,
+		axis.z * s,
+		c
 	};
 	return q;
 }
@@ -607,17 +744,25 @@ static inline quat_t quat_from_vec3_pair(vec3_t v1, vec3_t v2) {
 	v1 = vec3_normal(v1); v2 = vec3_normal(v2);
 
 	// Take special care if vectors are opposite of each other
+	// (approximate normals may leave them a rounding error short of it)
 	float e = vec3_dot(v1, v2);
-	if ( e <= -1.f) {
+	if ( e <= (LINALG_FAST_MATH ? -1.f + 1e-6f : -1.f)) {
 		vec3_t axis = vec3_normal(vec3_orthogonal(v1));
 		return quat_from_axis_angle(axis, pi);
 	}
 
 	// Do various calculations
 	vec3_t c = vec3_cross(v1, v2);
+#if LINALG_FAST_MATH
+	float s2 = 2 * (1 + e);
+	float rs = fast_rsqrtf(s2);
+	vec3_t qv = vec3_mul(c, rs);
+	float qw = 0.5f * s2 * rs;
+#else
 	float s = sqrtf(2 * (1 + e));
 	vec3_t qv = vec3_mul(c, 1.0f/s);
 	float qw = s/2.0f;
+#endif
 
 	// Assemble it
 	quat_t q = {qv.x, qv.y, qv.z, qw};
@@ -638,6 +783,27 @@ static inline quat_t quat_mul(quat_t q1, quat_t q2) {
 }
 
 
+/**
+Normalized linear interpolation between two unit quaternions (along the shortest arc).
+**/
+static inline quat_t quat_nlerp(float s, quat_t q1, quat_t q2) {
+	// Flip the second one if they are in opposite hemispheres
+	float sign = (vec4_dot(q1.vec4, q2.vec4) < 0 ? -1.f : 1.f);
+	quat_t q = {
+		q1.x * (1.f - s) + q2.x * s * sign,
+		q1.y * (1.f - s) + q2.y * s * sign,
+		q1.z * (1.f - s) + q2.z * s * sign,
+		q1.w * (1.f - s) + q2.w * s * sign,
+	};
+
+	// Back to unit length
+	float l = sqrtf(vec4_dot(q.vec4, q.vec4));
+	if (l == 0) { return q1; }
+	q.x /= l; q.y /= l; q.z /= l; q.w /= l;
+	return q;
+}
+
+
 /**
 Apply the rotation of a quaternion to a vector.
 **/
@@ -723,6 +889,21 @@ TEST_CASE("Quaternion operations") {
 		}
 	}
 
+	SECTION("Normalized linear interpolation between quaternions") {
+		quat_t q1 = quat_from_axis_angle(vec3(0,+1,0), 0);
+		quat_t q2 = quat_from_axis_angle(vec3(0,+1,0), pi/2);
+
+		SECTION("end points are kept") {
+			CHECK(quat_nlerp(0, q1, q2) == q1);
+			CHECK(vec3_round(quat_rotate_vec3(quat_nlerp(1, q1, q2), vec3(10,0,0))) == vec3(0,0,-10));
+		}
+
+		SECTION("half way is half the rotation") {
+			quat_t q = quat_nlerp(0.5, q1, q2);
+			CHECK(vec3_round(quat_rotate_vec3(q, vec3(10,0,0))) == vec3(7,0,-7));
+		}
+	}
+
 	SECTION("Quaternion rotation from two vectors") {
 		SECTION("x-axis -> y-axis") {
 			quat_t q = quat_from_vec3_pair(vec3(1,0,0), vec3(0,1,0));
@@ -0,0 +1,246 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define IN_LOGGING
+#include "overview.h"
+
+enum { max_log_threads = 16 };
+
+/** Everything logged by a single thread (oldest records get overwritten). **/
+typedef struct log_buffer_ {
+	log_record_t records[max_log_records];
+	unsigned num_records;
+} log_buffer_t;
+
+static log_buffer_t log_buffers[max_log_threads];
+static atomic_uint num_log_buffers = 0; // (Ever claimed)
+static atomic_uint log_buffers_in_use = 0; // One bit per buffer (of threads still running)
+static _Thread_local log_buffer_t *thread_log_buffer = NULL;
+static pthread_once_t log_buffer_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_buffer_key;
+static atomic_flag log_buffers_ran_out = ATOMIC_FLAG_INIT;
+
+typedef struct log_event_info_ {
+	const char *name;
+	log_level_e level;
+	log_category_e category;
+	const char *format;
+} log_event_info_t;
+
+#define LOG_EVENT_INFO(id, level, category, format) { #id, level, category, format },
+static const log_event_info_t log_event_infos[num_log_events] = {
+	LOG_EVENTS(LOG_EVENT_INFO)
+};
+#undef LOG_EVENT_INFO
+
+static const char *log_level_names[num_log_levels] = {
+	"TRACE", "DEBUG", "INFO", "WARNING", "ERROR",
+};
+static const char *log_category_names[num_log_categories] = {
+	"app", "input", "animation", "kinematics",
+};
+
+log_buffer_t *get_thread_log_buffer(void);
+void create_log_buffer_key(void);
+void release_log_buffer(void *);
+void decode_log_record(FILE *, unsigned thread, const log_record_t *);
+
+
+//// Log buffers ////
+
+/**
+Get the log buffer of the calling thread (claiming one on first use).
+
+Buffers of threads that have exited are claimed again (keeping their records),
+so only threads running at the same time count towards max_log_threads.
+Returns NULL (and warns the first time) if every buffer is already taken.
+**/
+log_buffer_t *get_thread_log_buffer(void) {
+	if (!thread_log_buffer) {
+		pthread_once(&log_buffer_key_once, create_log_buffer_key);
+
+		// Claim the first free buffer
+		unsigned in_use = atomic_load(&log_buffers_in_use);
+		unsigned i;
+		do {
+			i = 0;
+			while (i < max_log_threads && (in_use & (1u << i))) { i++; }
+			if (i == max_log_threads) {
+				if (!atomic_flag_test_and_set(&log_buffers_ran_out)) {
+					fprintf(stderr, "More than %d threads logging at once (the rest are not logged)\n", max_log_threads);
+				}
+				return NULL;
+			}
+		} while (!atomic_compare_exchange_weak(&log_buffers_in_use, &in_use, in_use | (1u << i)));
+
+		// Count it among those to decode
+		unsigned num = atomic_load(&num_log_buffers);
+		while (num < i + 1 && !atomic_compare_exchange_weak(&num_log_buffers, &num, i + 1)) {}
+
+		thread_log_buffer = &log_buffers[i];
+		pthread_setspecific(log_buffer_key, thread_log_buffer);
+	}
+	return thread_log_buffer;
+}
+
+
+void create_log_buffer_key(void) {
+	pthread_key_create(&log_buffer_key, release_log_buffer);
+}
+
+
+/**
+Let another thread have the buffer (once the thread that had it exits).
+**/
+void release_log_buffer(void *buffer) {
+	unsigned i = (log_buffer_t *) buffer - log_buffers;
+	atomic_fetch_and(&log_buffers_in_use, ~(1u << i));
+}
+
+
+//// Log events ////
+
+/**
+Record an event (and its arguments) in the calling threads ring buffer.
+
+Nothing gets formatted until the log is decoded.
+**/
+void log_event(log_event_e event, size_t num_args, const log_arg_t args[]) {
+	assert(event < num_log_events);
+	assert(num_args <= max_log_args);
+	log_buffer_t *buffer = get_thread_log_buffer();
+	if (!buffer) { return; }
+
+	log_record_t *record = &buffer->records[buffer->num_records++ % max_log_records];
+	record->time = get_profile_clock();
+	record->event = event;
+	record->num_args = num_args;
+	FOR_IN(i, num_args) { record->args[i] = args[i]; }
+}
+
+
+/**
+Number of records currently kept in the ring buffers (of all threads).
+**/
+size_t count_log_records(void) {
+	size_t num = 0;
+	unsigned num_buffers = atomic_load(&num_log_buffers);
+	if (num_buffers > max_log_threads) { num_buffers = max_log_threads; }
+	FOR_IN(b, num_buffers) {
+		unsigned n = log_buffers[b].num_records;
+		num += (n < max_log_records ? n : max_log_records);
+	}
+	return num;
+}
+
+
+/**
+Forget all records (in all threads).
+
+(Only safe while no other thread is logging)
+**/
+void clear_log(void) {
+	FOR_IN(b, max_log_threads) { log_buffers[b].num_records = 0; }
+}
+
+
+//// Log decoding ////
+
+/**
+Format every kept record (of all threads) as text, oldest first.
+
+Returns the number of records written.
+(Only safe while no other thread is logging)
+**/
+size_t decode_log(FILE *file) {
+	unsigned num_buffers = atomic_load(&num_log_buffers);
+	if (num_buffers > max_log_threads) { num_buffers = max_log_threads; }
+
+	// Where each buffer is at (and where it ends)
+	unsigned next[max_log_threads], end[max_log_threads];
+	FOR_IN(b, num_buffers) {
+		unsigned n = log_buffers[b].num_records;
+		end[b] = n;
+		next[b] = (n < max_log_records ? 0 : n - max_log_records);
+		if (next[b] > 0) {
+			fprintf(file, "(Thread %d lost its %u oldest records)\n", b, next[b]);
+		}
+	}
+
+	// Merge the buffers by time
+	size_t num_written = 0;
+	while (true) {
+		int oldest = -1;
+		FOR_IN(b, num_buffers) {
+			if (next[b] == end[b]) { continue; }
+			const log_record_t *r = &log_buffers[b].records[next[b] % max_log_records];
+			const log_record_t *o = (oldest < 0 ? NULL : &log_buffers[oldest].records[next[oldest] % max_log_records]);
+			if (!o || r->time < o->time) { oldest = b; }
+		}
+		if (oldest < 0) { break; }
+
+		decode_log_record(file, oldest, &log_buffers[oldest].records[next[oldest]++ % max_log_records]);
+		num_written++;
+	}
+	return num_written;
+}
+
+
+/**
+Decode the log to a text file.
+**/
+bool write_log(const char *path) {
+	FILE *file = fopen(path, "w");
+	if (!file) { return false; }
+	decode_log(file);
+	return fclose(file) == 0;
+}
+
+
+/**
+Write a single record as one line of text.
+
+Conversions in the events format are filled in with the recorded arguments
+(integer conversions read them as 64 bit).
+**/
+void decode_log_record(FILE *file, unsigned thread, const log_record_t *record) {
+	assert(record->event < num_log_events);
+	const log_event_info_t *info = &log_event_infos[record->event];
+	fprintf(file, "[%10.6f] #%u %-7s %-10s | ", record->time, thread,
+		log_level_names[info->level], log_category_names[info->category]);
+
+	unsigned arg = 0;
+	for (const char *c = info->format; *c; c++) {
+		if (*c != '%') { fputc(*c, file); continue; }
+		if (c[1] == '%') { fputc('%', file); c++; continue; }
+
+		// Copy flags, width and precision
+		char spec[16] = "%";
+		size_t len = 1;
+		c++;
+		while (*c && strchr("-+ #0123456789.", *c) && len < sizeof(spec) - 4) { spec[len++] = *c++; }
+		if (!*c) { break; }
+
+		// Fill in the argument
+		const log_arg_t missing = { 0 };
+		const log_arg_t *a = (arg < record->num_args ? &record->args[arg] : &missing);
+		arg++;
+		if (strchr("diuxXo", *c)) {
+			spec[len++] = 'l'; spec[len++] = 'l'; spec[len++] = *c;
+			if (*c == 'd' || *c == 'i') { fprintf(file, spec, (long long) a->i); }
+			else { fprintf(file, spec, (unsigned long long) a->i); }
+		} else if (strchr("fFeEgG", *c)) {
+			spec[len++] = *c;
+			fprintf(file, spec, a->f);
+		} else if (*c == 's') {
+			spec[len++] = *c;
+			fprintf(file, spec, (a->s ? a->s : "(null)"));
+		} else {
+			fputc('?', file);
+		}
+	}
+	fputc('\n', file);
+}
@@ -0,0 +1,75 @@
+#include <assert.h>
+#include <string.h>
+
+#define IN_MEMORY_REPORT
+#include "overview.h"
+
+void add_table_usage(const char *name, uint16_t num_rows, uint16_t peak_rows, uint16_t capacity, size_t bytes, memory_report_t *);
+
+
+//// Memory report ////
+
+/**
+Report how full the tables of the population are, and how much memory the
+app keeps (and copies around) for populations like it.
+**/
+void report_memory(const population_t *pop, memory_report_t *out) {
+	memset(out, 0, sizeof(memory_report_t));
+
+#define ADD_TABLE(name, t, capacity) \
+	add_table_usage(name, (t).num_rows, (t).peak_rows, (capacity), sizeof(t), out)
+	ADD_TABLE("actors", pop->actors, max_actor_table_rows);
+	ADD_TABLE("limbs", pop->limbs, max_limb_table_rows);
+	ADD_TABLE("arms", pop->arms, max_limb_attachment_table_rows);
+	ADD_TABLE("legs", pop->legs, max_limb_attachment_table_rows);
+	ADD_TABLE("limb goals", pop->limb_goals, max_limb_goal_table_rows);
+	ADD_TABLE("limb steps", pop->limb_steps, max_limb_step_table_rows);
+	ADD_TABLE("limb swings", pop->limb_swings, max_limb_swing_table_rows);
+	ADD_TABLE("limb tip links", pop->limb_tip_links, max_limb_link_table_rows);
+#undef ADD_TABLE
+
+	// Free bones are a cyclic list of their own (headed by node 0, which is never handed out)
+	const cl_node_t *nodes = pop->limbs.bone_nodes;
+	uint16_t num_free = 0;
+	for (uint16_t n = nodes[0].next_index; n != 0; n = nodes[n].next_index) { num_free++; }
+	out->num_bone_nodes_free = num_free;
+	out->num_bone_nodes_used = max_limb_table_segnemts - 1 - num_free;
+
+	// What the app does with populations
+	out->population_bytes = sizeof(population_t);
+	out->history_bytes = max_pop_history_frames * sizeof(population_t);
+	out->bytes_copied_per_step = sizeof(population_t);
+	out->bytes_copied_per_frame = sizeof(app_frame_t);
+	out->app_bytes = sizeof(app_t);
+}
+
+
+void add_table_usage(
+		const char *name, uint16_t num_rows, uint16_t peak_rows, uint16_t capacity, size_t bytes,
+		memory_report_t *report) {
+	assert(report->num_tables < max_reported_tables);
+	table_usage_t *usage = &report->tables[report->num_tables++];
+	usage->name = name;
+	usage->num_rows = num_rows;
+	usage->peak_rows = peak_rows;
+	usage->capacity = capacity;
+	usage->bytes = bytes;
+}
+
+
+/**
+Print the report as a table (one line per table, then the totals).
+**/
+void print_memory_report(const memory_report_t *report, FILE *file) {
+	fprintf(file, "%-16s %6s %6s %8s %10s\n", "Table", "Rows", "Peak", "Capacity", "Bytes");
+	FOR_IN(t, report->num_tables) {
+		const table_usage_t *u = &report->tables[t];
+		fprintf(file, "%-16s %6u %6u %8u %10zu\n", u->name, u->num_rows, u->peak_rows, u->capacity, u->bytes);
+	}
+	fprintf(file, "Bone nodes: %u used, %u free\n", report->num_bone_nodes_used, report->num_bone_nodes_free);
+	fprintf(file, "Population: %zu bytes (history of %d: %zu bytes)\n",
+		report->population_bytes, max_pop_history_frames, report->history_bytes);
+	fprintf(file, "Copied: %zu bytes per step, %zu bytes per captured frame\n",
+		report->bytes_copied_per_step, report->bytes_copied_per_frame);
+	fprintf(file, "App: %zu bytes\n", report->app_bytes);
+}
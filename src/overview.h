@@ -1,6 +1,7 @@
 #ifndef OVERVIEW_H
 #define OVERVIEW_H
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -41,28 +42,88 @@ typedef struct movement_ {
 void move_locations(float dt, const movement_t [], size_t, location_t []);
 
 
+//// Debug draw
+typedef enum debug_draw_type_ {
+	dd_line,
+	dd_sphere,
+	dd_gizmo,
+	dd_box,
+	dd_actor,
+
+	num_debug_draw_types // Not a type :P
+} debug_draw_type_e;
+typedef struct debug_draw_color_ { uint8_t r, g, b, a; } debug_draw_color_t;
+typedef struct debug_draw_command_ {
+	uint8_t type;
+	debug_draw_color_t color;
+	float size; // Radius, gizmo length or actor orientation
+	vec3_t a, b; // Line end points or center (and size)
+	quat_t ori;
+} debug_draw_command_t;
+enum { max_debug_draw_commands = 1 << 14 };
+typedef struct debug_draw_buffer_ {
+	debug_draw_command_t commands[max_debug_draw_commands];
+	uint16_t order[max_debug_draw_commands];
+	uint16_t num_commands;
+	uint32_t num_dropped; // (Commands that did not fit this frame)
+	uint16_t num_of_type[num_debug_draw_types];
+} debug_draw_buffer_t;
+
+// Debug draw CRUD
+void clear_debug_draw_buffer(debug_draw_buffer_t *);
+void push_debug_line(vec3_t from, vec3_t to, debug_draw_color_t, debug_draw_buffer_t *);
+void push_debug_sphere(vec3_t center, float radius, debug_draw_color_t, debug_draw_buffer_t *);
+void push_debug_gizmo(vec3_t pos, quat_t ori, float length, debug_draw_buffer_t *);
+void push_debug_box(vec3_t center, vec3_t size, debug_draw_color_t, debug_draw_buffer_t *);
+void push_debug_actor(location_t, debug_draw_color_t, debug_draw_buffer_t *);
+void sort_debug_draw_buffer(debug_draw_buffer_t *);
+
+// Debug draw rendering
+void submit_debug_draw_buffer(const struct Model *actor_model, const debug_draw_buffer_t *);
+
+
+//// Recent changes (ids of rows changed lately, for others to catch up on)
+enum { max_recent_changes = 64 };
+typedef struct recent_changes_ {
+	uint32_t num_changes; // Ever made
+	uint16_t id[max_recent_changes]; // The latest ones (by change number)
+} recent_changes_t;
+
+void note_change(uint16_t id, recent_changes_t *);
+
+
 //// Actor ////
-typedef struct actor_id_ { uint16_t id; } actor_id_t;
+typedef struct actor_id_ { uint16_t id, generation; } actor_id_t;
 enum {
 	max_actor_table_rows = 128,
-	actor_table_id_range = 1024,
+	actor_table_id_range = max_actor_table_rows, // Ids are reused
 };
 typedef struct actor_table_ {
 	// Meta
 	uint16_t sparse_id[actor_table_id_range];
 	actor_id_t dense_id[max_actor_table_rows];
 	uint16_t num_rows, next_id;
+	uint16_t peak_rows; // (The most there have been)
+
+	// Ids of deleted actors (and how often each id has been used)
+	uint16_t free_id[actor_table_id_range];
+	uint16_t num_free_ids;
+	uint16_t generation[actor_table_id_range];
 
 	// Column(s)
 	location_t location[max_actor_table_rows];
 	movement_t movement[max_actor_table_rows];
 	mat4_t to_world[max_actor_table_rows];
 	mat4_t to_object[max_actor_table_rows];
+
+	// Actors steered (or turned) other than by their movement
+	recent_changes_t steered;
 } actor_table_t;
 extern const float actor_walking_speed;
 
 // Actor CRUD
 actor_id_t create_actor(vec3_t, float, actor_table_t *);
+void delete_actor(actor_id_t, actor_table_t *);
 actor_id_t get_actor_id(uint16_t index, const actor_table_t *);
 uint16_t get_actor_index(actor_id_t agent, const actor_table_t *);
 bool actor_exists(actor_id_t, const actor_table_t *);
@@ -71,16 +132,36 @@ vec3_t get_actor_velocity_in_object_space(actor_id_t, const actor_table_t *);
 mat4_t get_actor_to_object_transform(actor_id_t, const actor_table_t *);
 mat4_t get_actor_to_world_transform(actor_id_t, const actor_table_t *);
 void set_actor_velocity(actor_id_t, vec3_t, actor_table_t *);
+void set_actor_rotation(actor_id_t, float rotation_y, actor_table_t *);
+void turn_actor(actor_id_t, float angle_y, actor_table_t *);
 void calculate_actor_transforms(actor_table_t *);
 
 // Actor movement
 void move_actors(float dt, actor_table_t *);
 
 // Actor render
-void render_actors(const struct Model *, const actor_table_t *);
+void render_actors(const actor_table_t *, const bool visible[], debug_draw_buffer_t *);
+
+//// Actor grid (spatial hash over actor positions on the ground plane)
+enum { num_actor_grid_buckets = 256 };
+typedef struct actor_grid_ {
+	float cell_size;
+	uint16_t num_actors;
+	uint16_t bucket_start[num_actor_grid_buckets + 1];
+	uint16_t actor_index[max_actor_table_rows]; // Ordered by bucket
+} actor_grid_t;
+extern const float actor_grid_cell_size;
+
+void build_actor_grid(float cell_size, const actor_table_t *, actor_grid_t *);
+size_t find_actors_within(
+	vec3_t pos, float radius, const actor_table_t *, const actor_grid_t *,
+	uint16_t out[], size_t max);
+size_t find_nearest_actors(
+	vec3_t pos, size_t k, const actor_table_t *, const actor_grid_t *,
+	uint16_t out[]);
 
 //// Limbs ////
-typedef struct limb_id_ { uint16_t id; } limb_id_t;
+typedef struct limb_id_ { uint16_t id, generation; } limb_id_t;
 typedef enum bone_constraint_ {
 	jc_no_constraint = 0, //(length only)
 	jc_pole,
@@ -88,6 +169,12 @@ typedef enum bone_constraint_ {
 
 	num_bone_constraints // Not a constraint :P
 } bone_constraint_e;
+typedef enum ik_solver_ {
+	iks_fabrik = 0, // (Any bones and constraints)
+	iks_two_hinges, // Two hinged bones, in closed form
+
+	num_ik_solvers
+} ik_solver_e;
 typedef struct bone_ {
 	struct {
 		bone_constraint_e type;
@@ -99,7 +186,7 @@ typedef struct bone_ {
 } bone_t;
 enum {
 	max_limb_table_rows = 128,
-	limb_table_id_range = 1024,
+	limb_table_id_range = max_limb_table_rows, // Ids are reused
 	max_limb_table_segnemts = max_limb_table_rows * 8,
 };
 typedef struct limb_table_ {
@@ -107,6 +194,12 @@ typedef struct limb_table_ {
 	uint16_t sparse_id[limb_table_id_range];
 	limb_id_t dense_id[max_limb_table_rows];
 	uint16_t num_rows, next_id;
+	uint16_t peak_rows; // (The most there have been)
+
+	// Ids of deleted limbs (and how often each id has been used)
+	uint16_t free_id[limb_table_id_range];
+	uint16_t num_free_ids;
+	uint16_t generation[limb_table_id_range];
 
 	// Columns
 	vec3_t end_effector[max_limb_table_rows];
@@ -114,15 +207,27 @@ typedef struct limb_table_ {
 	quat_t orientation[max_limb_table_rows];
 	uint16_t root_bone[max_limb_table_rows];
 	limb_id_t paired_with[max_limb_table_rows];
+	bool posed[max_limb_table_rows]; // By baked gait poses (so nothing steps or moves it by IK)
+	ik_solver_e ik_solver[max_limb_table_rows]; // Picked again when bones or constraints are added
+	vec3_t tip_position[max_limb_table_rows]; // Of the last bone (follows the bones, like bone_tip)
+
+	// How the latest IK went
+	float ik_residual[max_limb_table_rows]; // Tip to end effector
+	uint16_t ik_clamps[max_limb_table_rows]; // Bones clamped by constraints (over all passes)
+	uint8_t ik_passes[max_limb_table_rows]; // Until the tip was within 0.1 mm (one more than made if never, 0 if skipped by a budget)
+	uint16_t ik_skipped_steps[max_limb_table_rows]; // Since IK last moved the limb
 
 	// Segment pool
 	cl_node_t bone_nodes[max_limb_table_segnemts];
 	bone_t bones[max_limb_table_segnemts];
+	vec3_t bone_tip[max_limb_table_segnemts]; // (Refreshed by whatever moves the bones)
 } limb_table_t;
 
 // Limb CRUD
 void init_limb_table(limb_table_t *);
 limb_id_t create_limb(vec3_t pos, quat_t ori, limb_table_t *);
+void delete_limb(limb_id_t, limb_table_t *);
+bool limb_exists(limb_id_t, const limb_table_t *);
 limb_id_t get_limb_id(uint16_t index, const limb_table_t *);
 uint16_t get_limb_index(limb_id_t, const limb_table_t *);
 vec3_t get_limb_position(limb_id_t, const limb_table_t *);
@@ -131,8 +236,10 @@ vec3_t get_bone_tip_position(uint16_t seg, const limb_table_t *);
 vec3_t get_limb_tip_position(limb_id_t, const limb_table_t *);
 vec3_t get_limb_end_effector_position(limb_id_t, const limb_table_t *);
 size_t collect_bones(limb_id_t, const limb_table_t *, bone_t out[], size_t max);
+size_t count_limb_bones(uint16_t limb_index, const limb_table_t *);
 void set_limb_end_effector(limb_id_t, vec3_t, limb_table_t *);
 uint16_t add_bone_to_limb(limb_id_t, vec3_t pos, limb_table_t *);
+void refresh_limb_tips(uint16_t limb_index, limb_table_t *);
 void pair_limbs(limb_id_t, limb_id_t, limb_table_t *);
 void apply_pole_constraint(uint16_t seg, limb_table_t *);
 void apply_hinge_constraint(uint16_t seg, float min_ang, float max_ang, limb_table_t *);
@@ -140,9 +247,11 @@ void apply_hinge_constraint(uint16_t seg, float min_ang, float max_ang, limb_tab
 // Limb kinematics
 void move_limbs_directly_to_end_effectors(limb_table_t *table);
 void move_limb_directly_to(limb_id_t, vec3_t end, limb_table_t *);
-void reposition_bones_with_fabrik(
+unsigned reposition_bones_with_fabrik(
 	vec3_t root_pos, quat_t root_ori, vec3_t end,
 	bone_t [], size_t num);
+unsigned reposition_two_hinged_bones(vec3_t root_pos, quat_t root_ori, vec3_t end, bone_t []);
+ik_solver_e choose_ik_solver(const bone_t [], size_t num);
 vec3_t get_bone_tip(bone_t);
 
 #if defined(IN_KINEMATICS) || defined(IN_TESTS)
@@ -152,7 +261,7 @@ bone_t bone_from_root_tip(vec3_t root, vec3_t tip);
 #endif
 
 // Render limbs
-void render_limb_skeletons(const limb_table_t *);
+void render_limb_skeletons(const limb_table_t *, const bool visible[], debug_draw_buffer_t *);
 
 //// Limb attachments
 enum {max_limb_attachment_table_rows = max_limb_table_rows };
@@ -161,12 +270,14 @@ typedef struct limb_attachment_table_ {
 	limb_id_t limb[max_limb_attachment_table_rows];
 	vec3_t relative_position[max_limb_attachment_table_rows];
 	uint16_t num_rows;
+	uint16_t peak_rows; // (The most there have been)
 } limb_attachment_table_t;
 
 // Limb attachment CRUD
 void attach_limb_to_actor(
 	limb_id_t, actor_id_t, const limb_table_t*, const actor_table_t *,
 	limb_attachment_table_t *);
+void detach_limb(limb_id_t, limb_attachment_table_t *);
 
 // Limb attachement kinematics
 void reposition_attached_limbs(const limb_attachment_table_t *, const actor_table_t *, limb_table_t *);
@@ -179,9 +290,13 @@ typedef struct limb_link_table_ {
 	uint16_t sparse_id[limb_table_id_range];
 	limb_id_t dense_id[max_limb_link_table_rows];
 	uint16_t num_rows;
+	uint16_t peak_rows; // (The most there have been)
 
 	// Column data
 	limb_id_t other_limb[max_limb_link_table_rows];
+
+	// Limbs linked or unlinked
+	recent_changes_t changed;
 } limb_link_table_t;
 
 // Limb link CRUD
@@ -189,17 +304,32 @@ void link_limb_to(limb_id_t, limb_id_t, limb_link_table_t *);
 bool limb_has_link(limb_id_t, const limb_link_table_t *);
 void unlink_limb(limb_id_t, limb_link_table_t *);
 
+// Limb link islands (limbs connected through links, directly or not)
+typedef struct link_islands_ {
+	uint16_t num_islands;
+	uint16_t island_start[max_limb_table_rows + 1]; // Into limb_index
+	uint16_t limb_index[max_limb_table_rows]; // Grouped by island (in index order)
+	int16_t island_of[max_limb_table_rows]; // By limb index (-1 if not linked)
+} link_islands_t;
+
 // Limb link kinematics
-void move_limb_tips_to_their_linked_partners(const limb_link_table_t *, limb_table_t *);
+void find_link_islands(const limb_link_table_t *, const limb_table_t *, link_islands_t *);
+void solve_link_island(unsigned island, const link_islands_t *, limb_table_t *);
+void move_linked_limbs_together(const limb_link_table_t *, limb_table_t *);
+void hold_hands_with_nearby_actors(
+	const actor_table_t *, const actor_grid_t *, const limb_attachment_table_t *arms,
+	const limb_table_t *, limb_link_table_t *);
+void let_go_of_all_hands(limb_link_table_t *);
 
 //// Limb path
 enum {max_limb_goal_table_rows = max_limb_table_rows };
 enum {max_limb_goal_curve_points = 4 };
 typedef struct limb_goal_table_ {
 	// Table meta
-	uint16_t sparse_id[max_limb_goal_table_rows];
+	uint16_t sparse_id[limb_table_id_range];
 	limb_id_t dense_id[max_limb_table_rows];
 	uint16_t num_rows;
+	uint16_t peak_rows; // (The most there have been)
 
 	// Column data
 	vec3_t curve_points[max_limb_goal_table_rows][max_limb_goal_curve_points];
@@ -209,6 +339,9 @@ typedef struct limb_goal_table_ {
 	float max_speed[max_limb_goal_table_rows];
 	float max_acceleration[max_limb_goal_table_rows];
 	float threshold[max_limb_goal_table_rows];
+
+	// Limbs given goals (or that had them taken away before they were accomplished)
+	recent_changes_t changed;
 } limb_goal_table_t;
 
 // Limb goal CRUD
@@ -217,34 +350,69 @@ void push_limb_goal(limb_id_t, vec3_t, float speed, float acc, limb_goal_table_t
 bool has_limb_goal(limb_id_t, const limb_goal_table_t *);
 void move_limbs_toward_goals(float dt, limb_goal_table_t *, limb_table_t *);
 void delete_accomplished_limb_goals(const limb_table_t *, limb_goal_table_t *);
+bool advance_limb_goal(unsigned, vec3_t ee_pos, limb_goal_table_t *);
 void delete_limb_goal(limb_id_t, limb_goal_table_t *);
 void delete_limb_goal_at_index(unsigned, limb_goal_table_t *);
 
 // Limb goal rendering
-void render_limb_goals(const limb_goal_table_t *, const limb_table_t *);
+void render_limb_goals(const limb_goal_table_t *, const limb_table_t *, const bool visible[], debug_draw_buffer_t *);
+
+//// Limb steps (time parameterized end effector curves)
+enum { max_limb_step_table_rows = max_limb_table_rows };
+enum { num_limb_step_control_points = 4 };
+typedef struct limb_step_table_ {
+	// Table meta
+	uint16_t sparse_id[limb_table_id_range];
+	limb_id_t dense_id[max_limb_step_table_rows];
+	uint16_t num_rows;
+	uint16_t peak_rows; // (The most there have been)
 
-//// Limb swing
+	// Column data
+	double start_time[max_limb_step_table_rows];
+	float duration[max_limb_step_table_rows];
+	vec3_t control_points[max_limb_step_table_rows][num_limb_step_control_points]; // Cubic Bezier
+} limb_step_table_t;
+
+// Limb step CRUD
+void put_limb_step(limb_id_t, double start_time, float duration, const vec3_t control_points[], limb_step_table_t *);
+bool has_limb_step(limb_id_t, const limb_step_table_t *);
+vec3_t get_limb_step_position(unsigned index, double time, const limb_step_table_t *);
+float get_limb_step_time_left(limb_id_t, double time, const limb_step_table_t *);
+void move_limbs_along_steps(double time, const limb_step_table_t *, limb_table_t *);
+void delete_finished_limb_steps(double time, limb_step_table_t *);
+void delete_limb_step(limb_id_t, limb_step_table_t *);
+void delete_limb_step_at_index(unsigned, limb_step_table_t *);
+
+//// Limb swing (bone chains hanging like pendulums from their roots)
 enum { max_limb_swing_table_rows = max_limb_table_rows };
+enum { max_limb_swing_points = 8 }; // Bone tips per swinging limb
 typedef struct limb_swing_table_ {
 	// Table meta
 	uint16_t sparse_id[limb_table_id_range];
 	limb_id_t dense_id[max_limb_swing_table_rows];
 	uint16_t num_rows;
+	uint16_t peak_rows; // (The most there have been)
 
 	// Column data
-	vec3_t prev_position[max_limb_swing_table_rows];
+	// (Point major, so the solver can run across all swinging limbs at once)
+	uint8_t num_points[max_limb_swing_table_rows];
+	float rest_length[max_limb_swing_points][max_limb_swing_table_rows];
+	float prev_x[max_limb_swing_points][max_limb_swing_table_rows];
+	float prev_y[max_limb_swing_points][max_limb_swing_table_rows];
+	float prev_z[max_limb_swing_points][max_limb_swing_table_rows];
 } limb_swing_table_t;
 
 // Limb swing CRUD
 void create_limb_swing(limb_id_t, const limb_table_t *, limb_swing_table_t *);
+void delete_limb_swing(limb_id_t, limb_swing_table_t *);
 
 // Limb swing kinematics
-void perpetuate_limb_momentums(float dt, limb_swing_table_t *, limb_table_t *);
-void apply_gravity_to_limbs(float dt, vec3_t gravity, limb_swing_table_t *, limb_table_t *);
+void swing_limbs(float dt, vec3_t gravity, limb_swing_table_t *, limb_table_t *);
 
 
 //// Terrain
 enum { max_terrain_table_rows = 16 };
+typedef struct terrain_stream_ terrain_stream_t;
 typedef struct terrain_table_ {
 	uint16_t num_rows;
 
@@ -253,6 +421,8 @@ typedef struct terrain_table_ {
 		float x1, x2, z1, z2;
 		float height;
 	} block[max_terrain_table_rows];
+
+	terrain_stream_t *stream; // Tiles the blocks stand on (if any, else the ground is flat)
 } terrain_table_t;
 
 // Terrain CRUD
@@ -260,26 +430,195 @@ void create_terrain_block(float x1, float x2, float z1, float z2, float height,
 float get_terrain_height(float x, float z, const terrain_table_t *);
 
 // Terain rendering
-void render_terrain(const terrain_table_t *);
+void render_terrain(const terrain_table_t *, const bool visible[], debug_draw_buffer_t *);
+
+//// Terrain streaming (tiles of heights on disk, mapped in around actors)
+enum { max_resident_terrain_tiles = 64 };
+
+typedef struct terrain_stream_stats_ {
+	size_t num_tiles; // (In the file)
+	unsigned num_resident_tiles, max_resident_tiles;
+	size_t resident_bytes, memory_budget;
+	unsigned num_loads, num_releases; // So far
+} terrain_stream_stats_t;
+
+bool bake_terrain_tiles(
+	const char *path, const terrain_table_t *blocks,
+	float origin_x, float origin_z, float tile_size,
+	unsigned tiles_x, unsigned tiles_z, unsigned samples);
+terrain_stream_t *open_terrain_stream(const char *path, float radius, size_t memory_budget);
+void close_terrain_stream(terrain_stream_t *);
+void set_terrain_stream_blocking(bool, terrain_stream_t *);
+void stream_terrain_around_actors(const actor_table_t *, terrain_stream_t *);
+void wait_for_terrain_stream(terrain_stream_t *);
+void get_terrain_stream_stats(terrain_stream_t *, terrain_stream_stats_t *out);
+float get_streamed_terrain_height(float x, float z, terrain_stream_t *);
+bool is_terrain_tile_resident(float x, float z, terrain_stream_t *);
+
+//// Gait schedule
+enum { max_gait_schedule_legs = max_limb_attachment_table_rows };
+typedef struct gait_schedule_ {
+	// When each leg (by attachment index) should be looked at next
+	double wake_time[max_gait_schedule_legs];
+	uint16_t num_legs;
+
+	// Min-heap of legs ordered by wake time
+	uint16_t heap[max_gait_schedule_legs];
+	uint16_t heap_index[max_gait_schedule_legs];
+	uint16_t num_queued;
+
+	// Legs by limb id and of each actor by actor id (to find those to wake)
+	uint16_t leg_of_limb[limb_table_id_range];
+	uint16_t first_leg_of_actor[actor_table_id_range];
+	uint16_t next_leg_of_actor[max_gait_schedule_legs];
+
+	// How many of the recent changes to actors, goals and links legs have been woken for
+	uint32_t num_steered_seen, num_goal_changes_seen, num_link_changes_seen;
+
+	// Actors walking by baked poses, and how far through the cycle they are (0 to 1)
+	bool posed[max_actor_table_rows];
+	float phase[max_actor_table_rows];
+} gait_schedule_t;
+
+void schedule_leg(uint16_t leg, double wake_time, gait_schedule_t *);
+void reset_gait_schedule(gait_schedule_t *);
+bool pop_due_leg(double time, uint16_t *leg, gait_schedule_t *);
+
 
 //// Animate actors
+typedef struct gait_params_ {
+	// Speeds
+	float leg_acceleration_factor;
+	float leg_forward_speed_factor;
+	float leg_drop_speed_factor;
+
+	// Step curve positions (relative to root joint)
+	float up_x, step_height, contact_x;
+
+	// Feet may drift backwards faster than the actor moves (when dragged)
+	float foot_drift_factor;
+} gait_params_t;
+extern const gait_params_t default_gait_params;
+
 typedef struct animation_env_ {
 	const actor_table_t *actors;
 	const limb_attachment_table_t *arm_attachments;
 	const limb_attachment_table_t *leg_attachments;
 	const terrain_table_t *ground;
+	const gait_params_t *gait_params;
 	limb_table_t *limbs;
 	limb_goal_table_t *goals;
+	limb_step_table_t *steps;
+	const limb_link_table_t *links;
+	gait_schedule_t *gait;
+	double time;
+	bool timed_steps; // Step along closed form curves instead of goals
 } animation_env_i;
 
 void animate_walking_actor_legs(float dt, const animation_env_i *);
+void animate_scheduled_actor_legs(float dt, const animation_env_i *);
+float step_leg_if_ready(float dt, uint16_t leg, const animation_env_i *);
+float get_limb_goal_time_left(limb_id_t, const limb_goal_table_t *, const limb_table_t *);
 void keep_actors_actors_above_ground(float h, const terrain_table_t *, actor_table_t *);
 
+//// Gait poses (walk cycles baked at a few speeds, played back instead of stepping legs)
+enum {
+	max_gait_pose_speeds = 8,
+	num_gait_pose_phases = 32,
+	max_gait_pose_legs = 2,
+	max_gait_pose_bones = 4, // (Per leg)
+};
+typedef struct gait_pose_table_ {
+	uint16_t num_speeds, num_legs, num_bones;
+	float speed[max_gait_pose_speeds]; // Forward, lowest first
+	float period[max_gait_pose_speeds]; // Of a whole cycle (seconds)
+	float reach; // Furthest any bone gets from the actor along x or z
+
+	// Bones relative to the actor, by speed, phase, leg and bone
+	vec3_t joint_pos[max_gait_pose_speeds][num_gait_pose_phases][max_gait_pose_legs][max_gait_pose_bones];
+	quat_t orientation[max_gait_pose_speeds][num_gait_pose_phases][max_gait_pose_legs][max_gait_pose_bones];
+} gait_pose_table_t;
+
+typedef struct gait_playback_ {
+	const gait_pose_table_t *poses; // Shared, not owned (NULL to always step legs)
+	vec3_t focus; // Actors near it step their legs (like where the user is looking)
+	float focus_radius; // (0 to play back wherever the ground is flat)
+} gait_playback_t;
+
+bool bake_gait_poses(
+	const gait_params_t *, const float speeds[], size_t num_speeds, float dt,
+	gait_pose_table_t *out);
+void play_back_gaits(float dt, const gait_playback_t *, const animation_env_i *);
+
+//// IK pool (threads that move limbs by IK, stealing work from each other)
+typedef struct ik_pool_ ik_pool_t;
+
+ik_pool_t *create_ik_pool(unsigned num_threads);
+void destroy_ik_pool(ik_pool_t *);
+unsigned get_ik_pool_threads(const ik_pool_t *);
+void move_limbs_to_end_effectors_in_parallel(
+	ik_pool_t *, const uint16_t limb_index[], size_t num, limb_table_t *);
+
+//// IK budget (solving as many limbs per step as there is room for, most important first)
+typedef struct ik_budget_ {
+	unsigned max_bones; // Per step (0 for no limit)
+	double max_time; // Seconds per step (0 for no limit, otherwise results depend on timing)
+	vec3_t focus; // Limbs near it go first (like where the user is looking)
+	float focus_radius;
+} ik_budget_t;
+
+bool is_ik_budget_limited(const ik_budget_t *);
+void move_limbs_to_end_effectors_within_budget(
+	const ik_budget_t *, const uint16_t limb_index[], size_t num,
+	const limb_goal_table_t *, const limb_step_table_t *, ik_pool_t *, limb_table_t *);
+
+//// IK metrics (how close limbs got to their end effectors, and at what cost, per step)
+enum {
+	num_ik_residual_buckets = 10,
+	num_ik_clamp_buckets = 8, // (The last one is for that many or more)
+	max_ik_passes = 8,
+};
+extern const float ik_residual_bucket_limits[num_ik_residual_buckets]; // (Upper, exclusive)
+
+typedef struct ik_metrics_ {
+	uint64_t step;
+	double time;
+	uint16_t num_limbs;
+	float mean_residual, max_residual;
+	unsigned num_clamps, num_passes; // Over all limbs
+	uint16_t residual_histogram[num_ik_residual_buckets]; // Limbs by residual
+	uint16_t clamp_histogram[num_ik_clamp_buckets]; // Limbs by clamps
+	uint16_t pass_histogram[max_ik_passes + 1]; // Limbs by passes
+} ik_metrics_t;
+
+void collect_ik_metrics(uint64_t step, double time, const limb_table_t *, ik_metrics_t *out);
+void write_ik_metrics_csv_header(FILE *);
+void write_ik_metrics_csv_row(const ik_metrics_t *, FILE *);
+
+//// Secondary limb kinematics (swing, goals, steps, links and IK)
+typedef struct limb_update_env_ {
+	limb_table_t *limbs;
+	limb_swing_table_t *swings;
+	limb_goal_table_t *goals;
+	limb_step_table_t *steps;
+	const limb_link_table_t *links;
+	vec3_t gravity;
+	double time; // At the end of the update
+	ik_pool_t *ik_pool; // (NULL to move every limb on this thread)
+	const ik_budget_t *ik_budget; // (NULL to move every limb, every step)
+} limb_update_env_i;
+
+void update_limbs_phase_by_phase(float dt, const limb_update_env_i *);
+void update_limbs_fused(float dt, const limb_update_env_i *);
+
 //// Landscape (everything in game world that remains unchanged)
 typedef struct landscape_ {
 	terrain_table_t ground;
+	gait_params_t gait_params;
 } landscape_t;
 
+void create_some_terrain(landscape_t *);
+
 
 //// Population (everything in game world that changes)
 typedef struct population_ {
@@ -287,12 +626,188 @@ typedef struct population_ {
 	limb_table_t limbs;
 	limb_attachment_table_t arms, legs;
 	limb_goal_table_t limb_goals;
+	limb_step_table_t limb_steps;
 	limb_swing_table_t limb_swings;
 	limb_link_table_t limb_tip_links;
+	gait_schedule_t gait;
+	actor_grid_t actor_grid;
+	bool hold_hands;
+	bool timed_steps;
+	bool fuse_limb_updates; // Same result, one pass over the limbs
+	ik_pool_t *ik_pool; // Shared, not owned (NULL to do IK on the updating thread)
+	ik_budget_t ik_budget; // (No limits when zeroed)
+	ik_metrics_t ik_metrics; // Of the latest step
+	gait_playback_t gait_playback;
+	uint64_t num_steps;
+	double time;
 } population_t;
 
 actor_id_t create_person(vec3_t pos, float rot_y, population_t *);
+void delete_person(actor_id_t, population_t *);
 void update_population(float dt, const landscape_t *, population_t *);
+void interpolate_population(float s, const population_t *, const population_t *, population_t *out);
+
+
+//// View culling
+typedef struct frustum_ {
+	vec4_t planes[6]; // Inward normal (xyz) and offset (w)
+} frustum_t;
+typedef struct view_cull_ {
+	bool actor_visible[max_actor_table_rows];
+	bool limb_visible[max_limb_table_rows];
+	bool goal_visible[max_limb_goal_table_rows];
+	bool block_visible[max_terrain_table_rows];
+	uint16_t num_actors_culled, num_limbs_culled, num_goals_culled, num_blocks_culled;
+} view_cull_t;
+extern const float actor_bounding_radius;
+
+frustum_t frustum_from_view(
+	vec3_t eye, vec3_t target, vec3_t up,
+	float fovy, float aspect, float near, float far);
+bool sphere_in_frustum(vec3_t center, float radius, const frustum_t *);
+float get_limb_bounding_radius(uint16_t limb_index, const limb_table_t *);
+void cull_population(const frustum_t *, const population_t *, const terrain_table_t *, view_cull_t *out);
+
+
+//// Profiling
+#ifndef ENABLE_PROFILING
+#define ENABLE_PROFILING 1
+#endif
+
+enum {
+	max_profile_events = 4096,
+	max_profile_phases = 32,
+};
+typedef struct profile_event_ {
+	const char *name;
+	double begin, end;
+} profile_event_t;
+typedef struct profile_phase_ {
+	const char *name;
+	double last, average;
+	unsigned count;
+} profile_phase_t;
+
+double get_profile_clock(void);
+uint64_t begin_profile_event(const char *name);
+void end_profile_event(uint64_t handle);
+size_t count_profile_events(void);
+void clear_profile(void);
+size_t collect_profile_phases(profile_phase_t out[], size_t max);
+bool write_profile_as_chrome_trace(const char *path);
+
+// Time the statement (or block) that follows
+// (It runs once whether the event is recorded or not. Leaving the scope with
+// 'break' or 'return' skips the end of the event)
+#if ENABLE_PROFILING
+#define PROFILE_SCOPE(name) \
+	for (uint64_t prof_handle_ = begin_profile_event(name), prof_once_ = 1; prof_once_; \
+		end_profile_event(prof_handle_), prof_once_ = 0)
+#else
+#define PROFILE_SCOPE(name)
+#endif
+
+
+//// Logging
+typedef enum log_level_ {
+	ll_trace,
+	ll_debug,
+	ll_info,
+	ll_warning,
+	ll_error,
+
+	num_log_levels // Not a level :P
+} log_level_e;
+typedef enum log_category_ {
+	lc_app,
+	lc_input,
+	lc_animation,
+	lc_kinematics,
+
+	num_log_categories // Not a category :P
+} log_category_e;
+
+// Events below this level (or outside these categories) are compiled away
+#ifndef LOG_LEVEL
+#define LOG_LEVEL ll_debug
+#endif
+#ifndef LOG_CATEGORIES
+#define LOG_CATEGORIES (~0u)
+#endif
+
+// Every kind of event that can be logged (id, level, category and format)
+// (The format is only used when decoding, with one argument per conversion)
+#define LOG_EVENTS(X) \
+	X(le_move_foot_forward, ll_debug, lc_animation, "Move foot [#%u|%u] forward!") \
+	X(le_toggle_hand_holding, ll_info, lc_input, "Hand holding turned %s") \
+	X(le_toggle_timed_steps, ll_info, lc_input, "Timed steps turned %s") \
+	X(le_toggle_fused_limb_updates, ll_info, lc_input, "Fused limb updates turned %s") \
+	X(le_hold_hands, ll_debug, lc_animation, "Limbs %u and %u hold hands") \
+	X(le_let_go_of_hands, ll_debug, lc_animation, "Limbs %u and %u let go") \
+	X(le_trace_float, ll_trace, lc_kinematics, "%s():%u \t| %s = %f") \
+	X(le_trace_vec3, ll_trace, lc_kinematics, "%s():%u \t| %s = (%f, %f, %f)")
+
+#define LOG_EVENT_ID(id, level, category, format) id,
+typedef enum log_event_ {
+	LOG_EVENTS(LOG_EVENT_ID)
+
+	num_log_events // Not an event :P
+} log_event_e;
+#undef LOG_EVENT_ID
+
+#define LOG_EVENT_FILTER(id, level, category, format) \
+	id##_level = level, id##_category = category,
+enum { LOG_EVENTS(LOG_EVENT_FILTER) };
+#undef LOG_EVENT_FILTER
+
+enum {
+	max_log_args = 6,
+	max_log_records = 4096,
+};
+typedef union log_arg_ {
+	int64_t i;
+	double f;
+	const char *s; // (Only string literals or other strings that outlive the log)
+} log_arg_t;
+typedef struct log_record_ {
+	double time;
+	uint16_t event;
+	uint16_t num_args;
+	log_arg_t args[max_log_args];
+} log_record_t;
+
+void log_event(log_event_e, size_t num_args, const log_arg_t []);
+size_t count_log_records(void);
+void clear_log(void);
+size_t decode_log(FILE *);
+bool write_log(const char *path);
+
+static inline log_arg_t log_int(int64_t i) { log_arg_t a; a.i = i; return a; }
+static inline log_arg_t log_float(double f) { log_arg_t a; a.f = f; return a; }
+static inline log_arg_t log_str(const char *s) { log_arg_t a; a.s = s; return a; }
+
+// Record an event with (one or more) arguments, without formatting anything
+#ifndef __cplusplus
+#define LOG(event, ...) do { \
+	if ((int) event##_level >= (int) (LOG_LEVEL) && ((LOG_CATEGORIES) >> event##_category) & 1u) { \
+		log_arg_t log_args_[] = { LOG_ARGS(__VA_ARGS__) }; \
+		log_event(event, sizeof(log_args_) / sizeof(log_args_[0]), log_args_); \
+	} \
+} while(0)
+
+#define LOG_ARG(a) _Generic((a), \
+	float: log_float, double: log_float, \
+	char *: log_str, const char *: log_str, \
+	default: log_int)(a)
+#define LOG_ARGS(...) LOG_ARGS_N(__VA_ARGS__, 6, 5, 4, 3, 2, 1)(__VA_ARGS__)
+#define LOG_ARGS_N(_1, _2, _3, _4, _5, _6, n, ...) LOG_ARGS_##n
+#define LOG_ARGS_1(a) LOG_ARG(a)
+#define LOG_ARGS_2(a, ...) LOG_ARG(a), LOG_ARGS_1(__VA_ARGS__)
+#define LOG_ARGS_3(a, ...) LOG_ARG(a), LOG_ARGS_2(__VA_ARGS__)
+#define LOG_ARGS_4(a, ...) LOG_ARG(a), LOG_ARGS_3(__VA_ARGS__)
+#define LOG_ARGS_5(a, ...) LOG_ARG(a), LOG_ARGS_4(__VA_ARGS__)
+#define LOG_ARGS_6(a, ...) LOG_ARG(a), LOG_ARGS_5(__VA_ARGS__)
+#endif
 
 
 //// App
@@ -312,20 +827,214 @@ typedef struct app_ {
 	app_mode_e mode;
 	bool paused;
 	bool step_once;
-	float buffered_time;
+	float buffered_time, dropped_time;
+	float step_fraction; // Between previous and current frame (for rendering)
 	struct Model *actor_model;
 	landscape_t landscape;
 	population_t population_history[max_pop_history_frames];
 	vec3_t world_cursor;
 	unsigned frame_count;
+	uint64_t num_steps_taken; // (Keeps counting when stepping back)
+	bool show_profile;
+	bool show_memory_report;
+	struct input_recording_ *recording; // Where applied commands go (if anywhere)
 } app_t;
 
 
+/**
+What the renderer needs to show one frame.
+
+Captured (copied) from the app, so that rendering never has to look at
+state that the simulation is busy changing.
+**/
+typedef struct app_frame_ {
+	unsigned frame_count;
+	bool paused, show_profile, show_memory_report;
+	float buffered_fraction; // Step fraction when captured
+	float step_fraction; // Step fraction when rendered
+	float dropped_time;
+	double captured_at; // (Profile clock)
+	vec3_t world_cursor;
+	population_t prev, curr;
+	profile_phase_t sim_phases[max_profile_phases];
+	size_t num_sim_phases;
+} app_frame_t;
+
 void init_app(app_mode_e, app_t *);
+void load_app_assets(app_t *);
+void init_world(app_mode_e, landscape_t *, population_t *);
 void term_app(app_t *);
 void process_input(float dt, app_t*);
 void update_app(float dt, app_t *);
-void render_app(const struct Camera3D *, const app_t *);
+void capture_app_frame(const app_t *, app_frame_t *);
+void render_app(const struct Camera3D *, const app_t *, const app_frame_t *);
+
+//// Batch runs (many headless worlds stepped in parallel)
+typedef struct world_result_ {
+	unsigned num_steps;
+	double sim_time; // Simulated
+	double busy_time; // Spent stepping (on whichever threads)
+	uint16_t num_actors;
+	vec3_t mean_actor_position;
+	uint64_t checksum; // Of actor locations and limb end effectors
+} world_result_t;
+
+typedef struct world_ {
+	landscape_t landscape;
+	population_t population;
+	world_result_t result;
+} world_t;
+
+void run_worlds(world_t [], size_t num_worlds, unsigned num_steps, float dt, unsigned num_threads);
+void step_world(unsigned num_steps, float dt, world_t *);
+uint64_t hash_population(const population_t *);
+
+//// Memory report (how full the tables are and what the app keeps and copies)
+typedef struct table_usage_ {
+	const char *name;
+	uint16_t num_rows, peak_rows, capacity;
+	size_t bytes;
+} table_usage_t;
+
+enum { max_reported_tables = 8 };
+typedef struct memory_report_ {
+	table_usage_t tables[max_reported_tables];
+	size_t num_tables;
+	uint16_t num_bone_nodes_used, num_bone_nodes_free;
+	size_t population_bytes;
+	size_t history_bytes; // Ring of populations (for stepping back)
+	size_t bytes_copied_per_step; // Population carried over into the history
+	size_t bytes_copied_per_frame; // Frames captured for the renderer
+	size_t app_bytes;
+} memory_report_t;
+
+void report_memory(const population_t *, memory_report_t *out);
+void print_memory_report(const memory_report_t *, FILE *);
+
+//// Input commands
+typedef enum input_command_type_ {
+	ic_none = 0,
+	ic_toggle_pause,
+	ic_step_once,
+	ic_toggle_profile,
+	ic_step_back,
+	ic_step_forward,
+	ic_rewind,
+	ic_move_cursor,
+	ic_push_cursor_goal,
+	ic_tank_controls,
+	ic_toggle_hand_holding,
+	ic_toggle_timed_steps,
+	ic_toggle_fused_limb_updates,
+	ic_toggle_memory_report,
+
+	num_input_command_types // Not a command :P
+} input_command_type_e;
+enum { max_input_commands_per_frame = 32 };
+typedef struct input_command_ {
+	input_command_type_e type;
+	int count;
+	actor_id_t actor;
+	float dt;
+	vec3_t vec; // Cursor movement or tank controls (x: walk, y: turn)
+} input_command_t;
+
+size_t gather_input_commands(float dt, input_command_t out[], size_t max);
+void apply_input_command(const input_command_t *, app_t *);
+
+//// Input recording (commands in the order they were applied, by simulation step)
+typedef struct input_recording_ {
+	FILE *file;
+	uint64_t last_step;
+	size_t num_records;
+} input_recording_t;
+
+typedef struct input_replay_ {
+	FILE *file;
+	app_mode_e mode;
+	uint64_t step; // Of the last record read (or the last step, once ended)
+	bool ended;
+} input_replay_t;
+
+bool start_input_recording(const char *path, app_mode_e, input_recording_t *);
+void record_input_command(uint64_t step, const input_command_t *, input_recording_t *);
+bool stop_input_recording(uint64_t last_step, input_recording_t *);
+bool open_input_replay(const char *path, input_replay_t *);
+bool read_input_record(input_replay_t *, input_command_t *out);
+void close_input_replay(input_replay_t *);
+
+// Encoding (of recordings and exports)
+void write_varint(uint64_t, FILE *);
+void write_f32(float, FILE *);
+bool read_varint(FILE *, uint64_t *);
+bool read_f32(FILE *, float *);
+
+//// Pose export (actor locations and bone poses of every step, written on a thread of its own)
+typedef enum limb_attachment_ {
+	la_none = 0,
+	la_arm,
+	la_leg,
+
+	num_limb_attachments // Not an attachment :P
+} limb_attachment_e;
+typedef struct pose_export_ pose_export_t;
+typedef struct pose_export_stats_ {
+	uint64_t num_steps; // Exported
+	uint64_t num_dropped_steps; // While the disk could not keep up
+	uint64_t num_bytes; // Encoded (header included)
+	uint64_t num_raw_bytes; // Locations and bones would have taken as plain floats
+} pose_export_stats_t;
+
+pose_export_t *start_pose_export(const char *path, unsigned keyframe_interval);
+void export_population_poses(const population_t *, pose_export_t *);
+void get_pose_export_stats(const pose_export_t *, pose_export_stats_t *out);
+bool stop_pose_export(pose_export_t *, pose_export_stats_t *out);
+
+// Reading exported poses back (for analysis)
+typedef struct pose_frame_ {
+	uint64_t step;
+	double time;
+
+	uint16_t num_actors;
+	actor_id_t actor[max_actor_table_rows];
+	location_t location[max_actor_table_rows];
+
+	uint16_t num_limbs;
+	limb_id_t limb[max_limb_table_rows];
+	actor_id_t owner[max_limb_table_rows];
+	limb_attachment_e attachment[max_limb_table_rows];
+	vec3_t position[max_limb_table_rows];
+	quat_t orientation[max_limb_table_rows];
+	vec3_t tip_position[max_limb_table_rows];
+	uint16_t bone_start[max_limb_table_rows + 1]; // Into the bone columns
+
+	// Bones (of all limbs, limb by limb)
+	uint16_t num_bones;
+	vec3_t joint_pos[max_limb_table_segnemts];
+	quat_t bone_orientation[max_limb_table_segnemts];
+} pose_frame_t;
+
+/** Positions (quantized, by id) that the next ones are written relative to. **/
+typedef struct pose_delta_refs_ {
+	int32_t actor[actor_table_id_range][3];
+	int32_t limb[limb_table_id_range][3];
+	uint16_t actor_generation[actor_table_id_range];
+	uint16_t limb_generation[limb_table_id_range];
+	bool has_actor[actor_table_id_range];
+	bool has_limb[limb_table_id_range];
+} pose_delta_refs_t;
+
+typedef struct pose_reader_ {
+	FILE *file;
+	uint32_t units_per_meter;
+	uint8_t *chunk;
+	size_t chunk_capacity;
+	pose_delta_refs_t refs;
+} pose_reader_t;
+
+bool open_pose_reader(const char *path, pose_reader_t *);
+bool read_pose_frame(pose_reader_t *, pose_frame_t *out);
+void close_pose_reader(pose_reader_t *);
 
 //// Utils
 // Loops
@@ -0,0 +1,593 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IN_POSE_EXPORT
+#include "overview.h"
+
+// File layout:
+//   Header: magic, version, position units per meter (varint) and keyframe interval (varint)
+//   Chunks: type (byte), payload size (4 bytes, little endian) and payload (one simulation step)
+// Payload:
+//   Step (varint), time (8 bytes) and number of actors (varint), then for each actor:
+//     id and generation (varints), position (3 signed varints), orientation around y (2 bytes)
+//   Number of limbs (varint), then for each limb:
+//     id and generation (varints), attachment (byte), owner id and generation (varints, if attached),
+//     position (3 signed varints), orientation (6 bytes) and number of bones (varint),
+//     joint position (3 signed varints) and orientation (6 bytes) of each bone, tip position (3 signed varints)
+// Positions are counted in 1/units_per_meter m. Actors and limbs are relative to
+// where they were in the latest chunk they were in (since the latest keyframe),
+// or else to origo. Joints are relative to the one before (the first to the
+// limb, the tip to the last joint).
+// Orientations are the three smallest components of the quaternion (15 bits
+// each) and which one was left out (2 bits).
+static const char pose_file_magic[4] = { 'P', 'P', 'O', 'S' };
+static const uint8_t pose_file_version = 1;
+enum {
+	pose_units_per_meter = 1024,
+	pose_chunk_header_size = 5,
+	num_pose_export_buffers = 4,
+	pose_export_flush_size = 1 << 16, // Buffers are handed to the writer once this full
+	max_pose_export_buffer_size = 1 << 24, // Steps are dropped rather than growing a buffer beyond this
+};
+typedef enum pose_chunk_type_ {
+	pc_keyframe = 'K',
+	pc_delta = 'D',
+} pose_chunk_type_e;
+
+/** Encoded chunks, waiting to be written. **/
+typedef struct pose_buffer_ {
+	uint8_t *bytes;
+	size_t size, capacity;
+} pose_buffer_t;
+
+/**
+An export in progress.
+
+The simulation fills buffers in turn and hands them over to the writer
+thread, which writes them in the same order. When every other buffer is
+still waiting to be written, the one being filled just grows (up to a point).
+**/
+struct pose_export_ {
+	FILE *file;
+	unsigned keyframe_interval;
+	pose_delta_refs_t refs;
+	pose_export_stats_t stats;
+
+	pose_buffer_t buffers[num_pose_export_buffers];
+	pthread_t writer;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	uint64_t num_handed_over, num_written; // Buffers (the one being filled is next to hand over)
+	bool quit;
+	bool failed; // To write (only touched by the writer, until it is done)
+};
+
+/** Where encoded bytes are read from. **/
+typedef struct pose_cursor_ {
+	const uint8_t *at, *end;
+	bool ok;
+} pose_cursor_t;
+
+pose_buffer_t *get_pose_buffer(size_t room, pose_export_t *);
+void hand_over_pose_buffer(pose_export_t *);
+void *run_pose_writer(void *);
+void write_pose_buffer(pose_buffer_t *, pose_export_t *);
+void put_pose_varint(uint64_t, uint8_t **at);
+void put_pose_svarint(int32_t, uint8_t **at);
+void put_pose_position(vec3_t, int32_t ref[3], uint8_t **at);
+void put_pose_quat(quat_t, uint8_t **at);
+uint64_t get_pose_varint(pose_cursor_t *);
+int32_t get_pose_svarint(pose_cursor_t *);
+uint8_t get_pose_byte(pose_cursor_t *);
+vec3_t get_pose_position(uint32_t units_per_meter, int32_t ref[3], pose_cursor_t *);
+quat_t get_pose_quat(pose_cursor_t *);
+int32_t quantize_pose_coord(float, uint32_t units_per_meter);
+
+
+//// Pose export ////
+
+/**
+Start writing poses to a file (with every keyframe_interval:th step readable on its own).
+
+Returns NULL if the file could not be opened.
+**/
+pose_export_t *start_pose_export(const char *path, unsigned keyframe_interval) {
+	FILE *file = fopen(path, "wb");
+	if (!file) { return NULL; }
+
+	pose_export_t *exporter = calloc(1, sizeof(pose_export_t));
+	exporter->file = file;
+	exporter->keyframe_interval = (keyframe_interval < 1 ? 1 : keyframe_interval);
+	pthread_mutex_init(&exporter->lock, NULL);
+	pthread_cond_init(&exporter->wake, NULL);
+
+	// Header (written before the writer gets going)
+	fwrite(pose_file_magic, 1, sizeof(pose_file_magic), file);
+	fputc(pose_file_version, file);
+	write_varint(pose_units_per_meter, file);
+	write_varint(exporter->keyframe_interval, file);
+	exporter->stats.num_bytes = (uint64_t) ftell(file);
+
+	if (pthread_create(&exporter->writer, NULL, run_pose_writer, exporter) != 0) {
+		fclose(file);
+		pthread_cond_destroy(&exporter->wake);
+		pthread_mutex_destroy(&exporter->lock);
+		free(exporter);
+		return NULL;
+	}
+	return exporter;
+}
+
+
+/**
+Encode the actor locations and bone poses of the population as a chunk (without waiting for the disk).
+
+Steps that there is no room for are dropped (and counted).
+**/
+void export_population_poses(const population_t *pop, pose_export_t *exporter) {
+	const actor_table_t *actors = &pop->actors;
+	const limb_table_t *limbs = &pop->limbs;
+
+	// Make room (for the longest it could get)
+	size_t num_bones = 0;
+	FOR_ROWS(l, *limbs) { num_bones += count_limb_bones(l, limbs); }
+	size_t room = pose_chunk_header_size + 32 + 32 * actors->num_rows + 64 * limbs->num_rows + 32 * num_bones;
+	pose_buffer_t *buffer = get_pose_buffer(room, exporter);
+	if (!buffer) {
+		exporter->stats.num_dropped_steps++;
+		return;
+	}
+
+	// Who the limbs are attached to
+	limb_attachment_e attachment[max_limb_table_rows];
+	actor_id_t owner[max_limb_table_rows];
+	FOR_ROWS(l, *limbs) { attachment[l] = la_none; }
+	FOR_ROWS(a, pop->arms) {
+		uint16_t l = get_limb_index(pop->arms.limb[a], limbs);
+		attachment[l] = la_arm;
+		owner[l] = pop->arms.owner[a];
+	}
+	FOR_ROWS(a, pop->legs) {
+		uint16_t l = get_limb_index(pop->legs.limb[a], limbs);
+		attachment[l] = la_leg;
+		owner[l] = pop->legs.owner[a];
+	}
+
+	// Start over from origo every now and then
+	bool keyframe = (exporter->stats.num_steps % exporter->keyframe_interval == 0);
+	pose_delta_refs_t *refs = &exporter->refs;
+	if (keyframe) { memset(refs, 0, sizeof(*refs)); }
+
+	uint8_t *start = buffer->bytes + buffer->size;
+	uint8_t *at = start + pose_chunk_header_size;
+	put_pose_varint(pop->num_steps, &at);
+	uint64_t time_bits;
+	memcpy(&time_bits, &pop->time, sizeof(time_bits));
+	FOR_IN(i, 8) { *at++ = (uint8_t) (time_bits >> (8 * i)); }
+
+	// Actors
+	put_pose_varint(actors->num_rows, &at);
+	FOR_ROWS(a, *actors) {
+		actor_id_t id = actors->dense_id[a];
+		put_pose_varint(id.id, &at);
+		put_pose_varint(id.generation, &at);
+		if (!refs->has_actor[id.id] || refs->actor_generation[id.id] != id.generation) {
+			memset(refs->actor[id.id], 0, sizeof(refs->actor[id.id]));
+		}
+		refs->has_actor[id.id] = true;
+		refs->actor_generation[id.id] = id.generation;
+		put_pose_position(actors->location[a].position, refs->actor[id.id], &at);
+
+		float angle = fmodf(actors->location[a].orientation_y, 2 * pi);
+		if (angle < 0) { angle += 2 * pi; }
+		uint16_t turns = (uint16_t) ((uint32_t) lroundf(angle / (2 * pi) * 65536.f) & 0xffff);
+		*at++ = (uint8_t) turns;
+		*at++ = (uint8_t) (turns >> 8);
+	}
+
+	// Limbs (and their bones)
+	put_pose_varint(limbs->num_rows, &at);
+	FOR_ROWS(l, *limbs) {
+		limb_id_t id = limbs->dense_id[l];
+		put_pose_varint(id.id, &at);
+		put_pose_varint(id.generation, &at);
+		*at++ = (uint8_t) attachment[l];
+		if (attachment[l] != la_none) {
+			put_pose_varint(owner[l].id, &at);
+			put_pose_varint(owner[l].generation, &at);
+		}
+		if (!refs->has_limb[id.id] || refs->limb_generation[id.id] != id.generation) {
+			memset(refs->limb[id.id], 0, sizeof(refs->limb[id.id]));
+		}
+		refs->has_limb[id.id] = true;
+		refs->limb_generation[id.id] = id.generation;
+		put_pose_position(limbs->position[l], refs->limb[id.id], &at);
+		put_pose_quat(limbs->orientation[l], &at);
+
+		int32_t joint_ref[3];
+		memcpy(joint_ref, refs->limb[id.id], sizeof(joint_ref));
+		put_pose_varint(count_limb_bones(l, limbs), &at);
+		uint16_t root_bone = limbs->root_bone[l];
+		for (uint16_t b = root_bone; b; ) {
+			put_pose_position(limbs->bones[b].joint_pos, joint_ref, &at);
+			put_pose_quat(limbs->bones[b].orientation, &at);
+			b = limbs->bone_nodes[b].next_index;
+			if (b == root_bone) { b = 0; }
+		}
+		put_pose_position(limbs->tip_position[l], joint_ref, &at);
+	}
+
+	// Chunk header
+	size_t payload_size = at - start - pose_chunk_header_size;
+	assert((size_t) (at - start) <= room);
+	start[0] = (keyframe ? pc_keyframe : pc_delta);
+	FOR_IN(i, 4) { start[1 + i] = (uint8_t) (payload_size >> (8 * i)); }
+	buffer->size += at - start;
+
+	exporter->stats.num_steps++;
+	exporter->stats.num_bytes += at - start;
+	exporter->stats.num_raw_bytes +=
+		sizeof(uint64_t) + sizeof(double) +
+		actors->num_rows * (sizeof(actor_id_t) + sizeof(location_t)) +
+		limbs->num_rows * (sizeof(limb_id_t) + sizeof(actor_id_t) + 1 + 2 * sizeof(vec3_t) + sizeof(quat_t)) +
+		num_bones * (sizeof(vec3_t) + sizeof(quat_t));
+
+	// Let the writer have it once there is enough to bother
+	if (buffer->size >= pose_export_flush_size) { hand_over_pose_buffer(exporter); }
+}
+
+
+void get_pose_export_stats(const pose_export_t *exporter, pose_export_stats_t *out) {
+	*out = exporter->stats;
+}
+
+
+/**
+Write whatever is left, close the file and free the export.
+
+Returns false if anything could not be written.
+**/
+bool stop_pose_export(pose_export_t *exporter, pose_export_stats_t *out) {
+	if (!exporter) { return false; }
+
+	pthread_mutex_lock(&exporter->lock);
+	exporter->quit = true;
+	pthread_cond_signal(&exporter->wake);
+	pthread_mutex_unlock(&exporter->lock);
+	pthread_join(exporter->writer, NULL);
+
+	// (The writer is gone, so the last buffer is written here)
+	write_pose_buffer(&exporter->buffers[exporter->num_handed_over % num_pose_export_buffers], exporter);
+	bool ok = !exporter->failed;
+	ok &= (fclose(exporter->file) == 0);
+	if (out) { *out = exporter->stats; }
+
+	FOR_IN(b, num_pose_export_buffers) { free(exporter->buffers[b].bytes); }
+	pthread_cond_destroy(&exporter->wake);
+	pthread_mutex_destroy(&exporter->lock);
+	free(exporter);
+	return ok;
+}
+
+
+//// Pose export buffers ////
+
+/**
+Get the buffer being filled, with room for (at least) the given number of bytes.
+
+Returns NULL if the buffer would grow too large.
+**/
+pose_buffer_t *get_pose_buffer(size_t room, pose_export_t *exporter) {
+	pose_buffer_t *buffer = &exporter->buffers[exporter->num_handed_over % num_pose_export_buffers];
+	size_t size = buffer->size + room;
+	if (size <= buffer->capacity) { return buffer; }
+	if (size > max_pose_export_buffer_size) { return NULL; }
+
+	size_t capacity = (buffer->capacity ? buffer->capacity : 2 * pose_export_flush_size);
+	while (capacity < size) { capacity *= 2; }
+	uint8_t *bytes = realloc(buffer->bytes, capacity);
+	if (!bytes) { return NULL; }
+	buffer->bytes = bytes;
+	buffer->capacity = capacity;
+	return buffer;
+}
+
+
+/**
+Hand the buffer being filled over to the writer (unless it still has every other buffer to write).
+**/
+void hand_over_pose_buffer(pose_export_t *exporter) {
+	pthread_mutex_lock(&exporter->lock);
+	if (exporter->num_handed_over + 1 - exporter->num_written < num_pose_export_buffers) {
+		exporter->num_handed_over++;
+		pthread_cond_signal(&exporter->wake);
+	}
+	pthread_mutex_unlock(&exporter->lock);
+}
+
+
+/**
+Write buffers as they are handed over (until the export is stopped and there are no more).
+**/
+void *run_pose_writer(void *arg) {
+	pose_export_t *exporter = arg;
+
+	pthread_mutex_lock(&exporter->lock);
+	while (true) {
+		while (!exporter->quit && exporter->num_written == exporter->num_handed_over) {
+			pthread_cond_wait(&exporter->wake, &exporter->lock);
+		}
+		if (exporter->num_written == exporter->num_handed_over) { break; }
+		pose_buffer_t *buffer = &exporter->buffers[exporter->num_written % num_pose_export_buffers];
+		pthread_mutex_unlock(&exporter->lock);
+
+		write_pose_buffer(buffer, exporter);
+
+		pthread_mutex_lock(&exporter->lock);
+		exporter->num_written++;
+	}
+	pthread_mutex_unlock(&exporter->lock);
+	return NULL;
+}
+
+
+void write_pose_buffer(pose_buffer_t *buffer, pose_export_t *exporter) {
+	if (fwrite(buffer->bytes, 1, buffer->size, exporter->file) != buffer->size) { exporter->failed = true; }
+	buffer->size = 0;
+}
+
+
+//// Pose reader ////
+
+/**
+Open exported poses to read (checking that they are).
+**/
+bool open_pose_reader(const char *path, pose_reader_t *reader) {
+	memset(reader, 0, sizeof(*reader));
+	reader->file = fopen(path, "rb");
+	if (!reader->file) { return false; }
+
+	char magic[sizeof(pose_file_magic)];
+	uint64_t units_per_meter = 0, keyframe_interval = 0;
+	bool ok = fread(magic, 1, sizeof(magic), reader->file) == sizeof(magic);
+	ok = ok && memcmp(magic, pose_file_magic, sizeof(magic)) == 0;
+	ok = ok && fgetc(reader->file) == pose_file_version;
+	ok = ok && read_varint(reader->file, &units_per_meter) && units_per_meter > 0 && units_per_meter <= UINT32_MAX;
+	ok = ok && read_varint(reader->file, &keyframe_interval);
+	if (!ok) {
+		fclose(reader->file);
+		reader->file = NULL;
+		return false;
+	}
+	reader->units_per_meter = (uint32_t) units_per_meter;
+	return true;
+}
+
+
+/**
+Read the poses of the next exported step.
+
+Returns false at the end of the file (or where it was cut short or broken).
+**/
+bool read_pose_frame(pose_reader_t *reader, pose_frame_t *out) {
+	FILE *file = reader->file;
+	if (!file) { return false; }
+
+	// Chunk
+	int type = fgetc(file);
+	uint8_t size_bytes[4];
+	if (type != pc_keyframe && type != pc_delta) { return false; }
+	if (fread(size_bytes, 1, 4, file) != 4) { return false; }
+	uint32_t size = 0;
+	FOR_IN(i, 4) { size |= (uint32_t) size_bytes[i] << (8 * i); }
+	if (size > reader->chunk_capacity) {
+		uint8_t *chunk = realloc(reader->chunk, size);
+		if (!chunk) { return false; }
+		reader->chunk = chunk;
+		reader->chunk_capacity = size;
+	}
+	if (fread(reader->chunk, 1, size, file) != size) { return false; }
+
+	pose_delta_refs_t *refs = &reader->refs;
+	if (type == pc_keyframe) { memset(refs, 0, sizeof(*refs)); }
+	pose_cursor_t in = { reader->chunk, reader->chunk + size, true };
+	out->step = get_pose_varint(&in);
+	uint64_t time_bits = 0;
+	FOR_IN(i, 8) { time_bits |= (uint64_t) get_pose_byte(&in) << (8 * i); }
+	memcpy(&out->time, &time_bits, sizeof(out->time));
+
+	// Actors
+	uint64_t num_actors = get_pose_varint(&in);
+	if (num_actors > max_actor_table_rows) { return false; }
+	out->num_actors = (uint16_t) num_actors;
+	FOR_IN(a, out->num_actors) {
+		actor_id_t id;
+		id.id = get_pose_varint(&in);
+		id.generation = get_pose_varint(&in);
+		if (!in.ok || id.id >= actor_table_id_range) { return false; }
+		if (!refs->has_actor[id.id] || refs->actor_generation[id.id] != id.generation) {
+			memset(refs->actor[id.id], 0, sizeof(refs->actor[id.id]));
+		}
+		refs->has_actor[id.id] = true;
+		refs->actor_generation[id.id] = id.generation;
+		out->actor[a] = id;
+		out->location[a].position = get_pose_position(reader->units_per_meter, refs->actor[id.id], &in);
+
+		uint16_t turns = get_pose_byte(&in);
+		turns |= (uint16_t) get_pose_byte(&in) << 8;
+		out->location[a].orientation_y = turns * (2 * pi / 65536.f);
+	}
+
+	// Limbs (and their bones)
+	uint64_t num_limbs = get_pose_varint(&in);
+	if (num_limbs > max_limb_table_rows) { return false; }
+	out->num_limbs = (uint16_t) num_limbs;
+	out->num_bones = 0;
+	FOR_IN(l, out->num_limbs) {
+		limb_id_t id;
+		id.id = get_pose_varint(&in);
+		id.generation = get_pose_varint(&in);
+		uint8_t attachment = get_pose_byte(&in);
+		if (!in.ok || id.id >= limb_table_id_range || attachment >= num_limb_attachments) { return false; }
+		out->limb[l] = id;
+		out->attachment[l] = attachment;
+		out->owner[l] = (actor_id_t) { 0, 0 };
+		if (attachment != la_none) {
+			out->owner[l].id = get_pose_varint(&in);
+			out->owner[l].generation = get_pose_varint(&in);
+		}
+
+		if (!refs->has_limb[id.id] || refs->limb_generation[id.id] != id.generation) {
+			memset(refs->limb[id.id], 0, sizeof(refs->limb[id.id]));
+		}
+		refs->has_limb[id.id] = true;
+		refs->limb_generation[id.id] = id.generation;
+		out->position[l] = get_pose_position(reader->units_per_meter, refs->limb[id.id], &in);
+		out->orientation[l] = get_pose_quat(&in);
+
+		int32_t joint_ref[3];
+		memcpy(joint_ref, refs->limb[id.id], sizeof(joint_ref));
+		uint64_t num_bones = get_pose_varint(&in);
+		if (num_bones > max_limb_table_segnemts - out->num_bones) { return false; }
+		out->bone_start[l] = out->num_bones;
+		FOR_IN(b, num_bones) {
+			out->joint_pos[out->num_bones] = get_pose_position(reader->units_per_meter, joint_ref, &in);
+			out->bone_orientation[out->num_bones] = get_pose_quat(&in);
+			out->num_bones++;
+		}
+		out->tip_position[l] = get_pose_position(reader->units_per_meter, joint_ref, &in);
+	}
+	out->bone_start[out->num_limbs] = out->num_bones;
+
+	return in.ok && in.at == in.end;
+}
+
+
+void close_pose_reader(pose_reader_t *reader) {
+	if (reader->file) { fclose(reader->file); }
+	free(reader->chunk);
+	reader->file = NULL;
+	reader->chunk = NULL;
+	reader->chunk_capacity = 0;
+}
+
+
+//// Pose encoding ////
+
+/** Unsigned LEB128 (like write_varint(), but to memory). **/
+void put_pose_varint(uint64_t v, uint8_t **at) {
+	while (v >= 0x80) {
+		*(*at)++ = (uint8_t) (v | 0x80);
+		v >>= 7;
+	}
+	*(*at)++ = (uint8_t) v;
+}
+
+
+/** Zig-zag (so that small negative numbers stay short too). **/
+void put_pose_svarint(int32_t v, uint8_t **at) {
+	put_pose_varint(((uint32_t) v << 1) ^ (uint32_t) (v >> 31), at);
+}
+
+
+/**
+Quantize a position and write how far it is from the reference (which then becomes the reference).
+**/
+void put_pose_position(vec3_t pos, int32_t ref[3], uint8_t **at) {
+	float coords[3] = { pos.x, pos.y, pos.z };
+	FOR_IN(i, 3) {
+		int32_t q = quantize_pose_coord(coords[i], pose_units_per_meter);
+		put_pose_svarint(q - ref[i], at);
+		ref[i] = q;
+	}
+}
+
+
+/**
+The three smallest components (flipped so that the largest is positive) and which one was left out.
+**/
+void put_pose_quat(quat_t q, uint8_t **at) {
+	float c[4] = { q.x, q.y, q.z, q.w };
+	float length = sqrtf(c[0] * c[0] + c[1] * c[1] + c[2] * c[2] + c[3] * c[3]);
+	int largest = 0;
+	FOR_RANGE(i, 1, 4) { if (fabsf(c[i]) > fabsf(c[largest])) { largest = i; } }
+	float scale = (length > 0 ? 1.f / length : 0.f) * (c[largest] < 0 ? -1.f : 1.f);
+
+	// (The others are within +/- 1/sqrt(2))
+	uint64_t bits = (uint64_t) largest;
+	int shift = 2;
+	FOR_IN(i, 4) {
+		if (i == largest) { continue; }
+		float v = minf(maxf(c[i] * scale * sqrtf(2.f), -1.f), 1.f);
+		bits |= (uint64_t) lroundf((v + 1.f) * 0.5f * 32767.f) << shift;
+		shift += 15;
+	}
+	FOR_IN(i, 6) { *(*at)++ = (uint8_t) (bits >> (8 * i)); }
+}
+
+
+int32_t quantize_pose_coord(float v, uint32_t units_per_meter) {
+	return (int32_t) lroundf(v * units_per_meter);
+}
+
+
+//// Pose decoding ////
+
+uint8_t get_pose_byte(pose_cursor_t *in) {
+	if (in->at >= in->end) {
+		in->ok = false;
+		return 0;
+	}
+	return *in->at++;
+}
+
+
+uint64_t get_pose_varint(pose_cursor_t *in) {
+	uint64_t v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		uint8_t c = get_pose_byte(in);
+		v |= (uint64_t) (c & 0x7f) << shift;
+		if (!(c & 0x80)) { return v; }
+	}
+	in->ok = false;
+	return 0;
+}
+
+
+int32_t get_pose_svarint(pose_cursor_t *in) {
+	uint32_t v = (uint32_t) get_pose_varint(in);
+	return (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+}
+
+
+vec3_t get_pose_position(uint32_t units_per_meter, int32_t ref[3], pose_cursor_t *in) {
+	float coords[3];
+	FOR_IN(i, 3) {
+		ref[i] += get_pose_svarint(in);
+		coords[i] = (float) ref[i] / units_per_meter;
+	}
+	return vec3(coords[0], coords[1], coords[2]);
+}
+
+
+quat_t get_pose_quat(pose_cursor_t *in) {
+	uint64_t bits = 0;
+	FOR_IN(i, 6) { bits |= (uint64_t) get_pose_byte(in) << (8 * i); }
+
+	float c[4], sum = 0;
+	int largest = (int) (bits & 3), shift = 2;
+	FOR_IN(i, 4) {
+		if (i == largest) { continue; }
+		float v = (float) ((bits >> shift) & 0x7fff) / 32767.f * 2.f - 1.f;
+		c[i] = v / sqrtf(2.f);
+		sum += c[i] * c[i];
+		shift += 15;
+	}
+	c[largest] = sqrtf(maxf(1.f - sum, 0.f));
+	return (quat_t) {{ c[0], c[1], c[2], c[3] }};
+}
@@ -0,0 +1,242 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+
+#define IN_PROFILING
+#include "overview.h"
+
+enum { max_profile_threads = 16 };
+
+/** Everything profiled by a single thread. **/
+typedef struct profile_buffer_ {
+	profile_event_t events[max_profile_events];
+	uint64_t num_events; // (Ever begun, so it never wraps around to 0)
+
+	profile_phase_t phases[max_profile_phases];
+	unsigned num_phases;
+} profile_buffer_t;
+
+static profile_buffer_t profile_buffers[max_profile_threads];
+static atomic_uint num_profile_buffers = 0; // (Ever claimed)
+static atomic_uint profile_buffers_in_use = 0; // One bit per buffer (of threads still running)
+static _Thread_local profile_buffer_t *thread_profile_buffer = NULL;
+static pthread_once_t profile_buffer_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t profile_buffer_key;
+static atomic_flag profile_buffers_ran_out = ATOMIC_FLAG_INIT;
+
+static atomic_flag profile_epoch_taken = ATOMIC_FLAG_INIT;
+static double profile_epoch = 0;
+
+profile_buffer_t *get_thread_profile_buffer(void);
+void create_profile_buffer_key(void);
+void release_profile_buffer(void *);
+void accumulate_profile_phase(profile_buffer_t *, const char *name, double duration);
+
+
+//// Profile clock ////
+
+/**
+Seconds since the first time the profile clock was read.
+
+(Read it once before starting other threads)
+**/
+double get_profile_clock(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	double now = (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+	if (!atomic_flag_test_and_set(&profile_epoch_taken)) { profile_epoch = now; }
+	return now - profile_epoch;
+}
+
+
+//// Profile buffers ////
+
+/**
+Get the profile buffer of the calling thread (claiming one on first use).
+
+Buffers of threads that have exited are claimed again (keeping their events),
+so only threads running at the same time count towards max_profile_threads.
+Returns NULL (and warns the first time) if every buffer is already taken.
+**/
+profile_buffer_t *get_thread_profile_buffer(void) {
+	if (!thread_profile_buffer) {
+		pthread_once(&profile_buffer_key_once, create_profile_buffer_key);
+
+		// Claim the first free buffer
+		unsigned in_use = atomic_load(&profile_buffers_in_use);
+		unsigned i;
+		do {
+			i = 0;
+			while (i < max_profile_threads && (in_use & (1u << i))) { i++; }
+			if (i == max_profile_threads) {
+				if (!atomic_flag_test_and_set(&profile_buffers_ran_out)) {
+					fprintf(stderr, "More than %d threads profiling at once (the rest are not profiled)\n", max_profile_threads);
+				}
+				return NULL;
+			}
+		} while (!atomic_compare_exchange_weak(&profile_buffers_in_use, &in_use, in_use | (1u << i)));
+
+		// Count it among those to write out
+		unsigned num = atomic_load(&num_profile_buffers);
+		while (num < i + 1 && !atomic_compare_exchange_weak(&num_profile_buffers, &num, i + 1)) {}
+
+		thread_profile_buffer = &profile_buffers[i];
+		pthread_setspecific(profile_buffer_key, thread_profile_buffer);
+	}
+	return thread_profile_buffer;
+}
+
+
+void create_profile_buffer_key(void) {
+	pthread_key_create(&profile_buffer_key, release_profile_buffer);
+}
+
+
+/**
+Let another thread have the buffer (once the thread that had it exits).
+**/
+void release_profile_buffer(void *buffer) {
+	unsigned i = (profile_buffer_t *) buffer - profile_buffers;
+	atomic_fetch_and(&profile_buffers_in_use, ~(1u << i));
+}
+
+
+//// Profile events ////
+
+/**
+Record the start of a profiled scope.
+
+Returns a handle to pass on to end_profile_event() (0 if it is not recorded).
+**/
+uint64_t begin_profile_event(const char *name) {
+	profile_buffer_t *buffer = get_thread_profile_buffer();
+	if (!buffer) { return 0; }
+
+	uint64_t handle = ++buffer->num_events;
+	profile_event_t *event = &buffer->events[(handle - 1) % max_profile_events];
+	event->name = name;
+	event->begin = get_profile_clock();
+	event->end = event->begin;
+	return handle;
+}
+
+
+/**
+Record the end of a profiled scope.
+**/
+void end_profile_event(uint64_t handle) {
+	profile_buffer_t *buffer = thread_profile_buffer;
+	if (!buffer || handle == 0) { return; }
+
+	profile_event_t *event = &buffer->events[(handle - 1) % max_profile_events];
+	event->end = get_profile_clock();
+	accumulate_profile_phase(buffer, event->name, event->end - event->begin);
+}
+
+
+/**
+Number of events currently kept in the ring buffers (of all threads).
+**/
+size_t count_profile_events(void) {
+	size_t num = 0;
+	unsigned num_buffers = atomic_load(&num_profile_buffers);
+	if (num_buffers > max_profile_threads) { num_buffers = max_profile_threads; }
+	FOR_IN(b, num_buffers) {
+		uint64_t n = profile_buffers[b].num_events;
+		num += (n < max_profile_events ? n : max_profile_events);
+	}
+	return num;
+}
+
+
+/**
+Forget all recorded events and phase statistics (in all threads).
+
+(Only safe while no other thread is profiling)
+**/
+void clear_profile(void) {
+	FOR_IN(b, max_profile_threads) {
+		profile_buffers[b].num_events = 0;
+		profile_buffers[b].num_phases = 0;
+	}
+}
+
+
+//// Profile phases ////
+
+/**
+Update the running statistics of the phase with the given name.
+
+(Names are expected to be string literals, so comparing pointers is enough)
+**/
+void accumulate_profile_phase(profile_buffer_t *buffer, const char *name, double duration) {
+	profile_phase_t *phase = NULL;
+	FOR_IN(i, buffer->num_phases) {
+		if (buffer->phases[i].name == name) { phase = &buffer->phases[i]; break; }
+	}
+
+	// Start tracking a new phase (if there is room)
+	if (!phase) {
+		if (buffer->num_phases >= max_profile_phases) { return; }
+		phase = &buffer->phases[buffer->num_phases++];
+		phase->name = name;
+		phase->count = 0;
+		phase->average = duration;
+	}
+
+	// Exponential moving average keeps it steady enough to read
+	phase->last = duration;
+	phase->average += (duration - phase->average) * 0.05;
+	phase->count++;
+}
+
+
+/**
+Collect the calling threads phase statistics in the order they were first seen.
+**/
+size_t collect_profile_phases(profile_phase_t out[], size_t max) {
+	profile_buffer_t *buffer = thread_profile_buffer;
+	if (!buffer) { return 0; }
+
+	size_t n = (buffer->num_phases < max ? buffer->num_phases : max);
+	FOR_IN(i, n) { out[i] = buffer->phases[i]; }
+	return n;
+}
+
+
+//// Chrome trace export ////
+
+/**
+Write all events in the ring buffers as Chrome 'trace_event' JSON.
+
+Open the result in chrome://tracing (or https://ui.perfetto.dev).
+(Only safe while no other thread is profiling)
+**/
+bool write_profile_as_chrome_trace(const char *path) {
+	FILE *file = fopen(path, "w");
+	if (!file) { return false; }
+
+	fprintf(file, "{\"traceEvents\":[\n");
+	bool first_written = false;
+	unsigned num_buffers = atomic_load(&num_profile_buffers);
+	if (num_buffers > max_profile_threads) { num_buffers = max_profile_threads; }
+	FOR_IN(b, num_buffers) {
+		const profile_buffer_t *buffer = &profile_buffers[b];
+
+		// Oldest event first
+		unsigned num = (buffer->num_events < max_profile_events ? buffer->num_events : max_profile_events);
+		uint64_t first = buffer->num_events - num;
+		FOR_IN(i, num) {
+			const profile_event_t *event = &buffer->events[(first + i) % max_profile_events];
+			fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}\n",
+				(first_written ? "," : ""),
+				event->name, b, event->begin * 1e6, (event->end - event->begin) * 1e6);
+			first_written = true;
+		}
+	}
+	fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+
+	return fclose(file) == 0;
+}
@@ -0,0 +1,215 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define IN_RECORDING
+#include "overview.h"
+
+// File layout:
+//   Header: magic, version and app mode
+//   Records: type (byte), steps since the previous record (varint), arguments of the type
+//   End: a record of type ic_none (with the steps taken after the last command)
+static const char input_recording_magic[4] = { 'P', 'R', 'E', 'C' };
+static const uint8_t input_recording_version = 1;
+
+
+//// Input recording ////
+
+/**
+Start writing applied input commands to a file.
+**/
+bool start_input_recording(const char *path, app_mode_e mode, input_recording_t *recording) {
+	recording->file = fopen(path, "wb");
+	recording->last_step = 0;
+	recording->num_records = 0;
+	if (!recording->file) { return false; }
+
+	fwrite(input_recording_magic, 1, sizeof(input_recording_magic), recording->file);
+	fputc(input_recording_version, recording->file);
+	fputc((uint8_t) mode, recording->file);
+	return true;
+}
+
+
+/**
+Write a command (applied right before the given simulation step).
+
+Commands that do nothing are left out.
+**/
+void record_input_command(uint64_t step, const input_command_t *command, input_recording_t *recording) {
+	assert(command->type < num_input_command_types);
+	assert(step >= recording->last_step);
+	if (command->type == ic_none) { return; }
+
+	FILE *file = recording->file;
+	fputc((uint8_t) command->type, file);
+	write_varint(step - recording->last_step, file);
+	recording->last_step = step;
+	recording->num_records++;
+
+	switch (command->type) {
+		case ic_step_back:
+		case ic_step_forward:
+		case ic_rewind: {
+			write_varint((uint64_t) command->count, file);
+		} break;
+		case ic_move_cursor: {
+			write_f32(command->vec.x, file);
+			write_f32(command->vec.y, file);
+			write_f32(command->vec.z, file);
+		} break;
+		case ic_tank_controls: {
+			write_varint(command->actor.id, file);
+			write_varint(command->actor.generation, file);
+			write_f32(command->dt, file);
+			write_f32(command->vec.x, file);
+			write_f32(command->vec.y, file);
+		} break;
+		default: {} break;
+	}
+}
+
+
+/**
+Mark where the recording ends (so that replays take the steps after the last command too).
+**/
+bool stop_input_recording(uint64_t last_step, input_recording_t *recording) {
+	assert(last_step >= recording->last_step);
+	fputc(ic_none, recording->file);
+	write_varint(last_step - recording->last_step, recording->file);
+	recording->last_step = last_step;
+
+	bool ok = !ferror(recording->file);
+	ok &= (fclose(recording->file) == 0);
+	recording->file = NULL;
+	return ok;
+}
+
+
+//// Input replay ////
+
+/**
+Open a recording to replay (checking that it is one).
+**/
+bool open_input_replay(const char *path, input_replay_t *replay) {
+	replay->file = fopen(path, "rb");
+	replay->step = 0;
+	replay->ended = false;
+	if (!replay->file) { return false; }
+
+	char magic[sizeof(input_recording_magic)];
+	int version = 0, mode = 0;
+	bool ok = fread(magic, 1, sizeof(magic), replay->file) == sizeof(magic);
+	ok = ok && memcmp(magic, input_recording_magic, sizeof(magic)) == 0;
+	ok = ok && (version = fgetc(replay->file)) == input_recording_version;
+	ok = ok && (mode = fgetc(replay->file)) >= 0 && mode < num_app_modes;
+	if (!ok) {
+		fclose(replay->file);
+		replay->file = NULL;
+		return false;
+	}
+	replay->mode = mode;
+	return true;
+}
+
+
+/**
+Read the next command (to apply right before simulation step 'replay->step').
+
+Returns false once the recording has ended. By then 'replay->step' is the
+number of steps that were taken in all (unless the recording was cut short).
+**/
+bool read_input_record(input_replay_t *replay, input_command_t *out) {
+	if (replay->ended) { return false; }
+	FILE *file = replay->file;
+
+	int type = fgetc(file);
+	uint64_t steps = 0;
+	if (type < 0 || type >= num_input_command_types || !read_varint(file, &steps)) {
+		replay->ended = true;
+		return false;
+	}
+	replay->step += steps;
+	if (type == ic_none) {
+		replay->ended = true;
+		return false;
+	}
+
+	*out = (input_command_t){ type };
+	bool ok = true;
+	switch (out->type) {
+		case ic_step_back:
+		case ic_step_forward:
+		case ic_rewind: {
+			uint64_t count = 0;
+			ok = read_varint(file, &count);
+			out->count = (int) count;
+		} break;
+		case ic_move_cursor: {
+			ok = read_f32(file, &out->vec.x) && read_f32(file, &out->vec.y) && read_f32(file, &out->vec.z);
+		} break;
+		case ic_tank_controls: {
+			uint64_t id = 0, generation = 0;
+			ok = read_varint(file, &id) && read_varint(file, &generation) &&
+				read_f32(file, &out->dt) && read_f32(file, &out->vec.x) && read_f32(file, &out->vec.y);
+			out->actor.id = (uint16_t) id;
+			out->actor.generation = (uint16_t) generation;
+		} break;
+		default: {} break;
+	}
+	if (!ok) { replay->ended = true; }
+	return ok;
+}
+
+
+void close_input_replay(input_replay_t *replay) {
+	if (replay->file) { fclose(replay->file); }
+	replay->file = NULL;
+}
+
+
+//// Encoding ////
+
+/** Unsigned LEB128 (7 bits at the time, low bits first). **/
+void write_varint(uint64_t v, FILE *file) {
+	while (v >= 0x80) {
+		fputc((uint8_t) (v | 0x80), file);
+		v >>= 7;
+	}
+	fputc((uint8_t) v, file);
+}
+
+
+bool read_varint(FILE *file, uint64_t *out) {
+	uint64_t v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		int c = fgetc(file);
+		if (c < 0) { return false; }
+		v |= (uint64_t) (c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			*out = v;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/** Bits of the float, little endian. **/
+void write_f32(float f, FILE *file) {
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	FOR_IN(i, 4) { fputc((uint8_t) (bits >> (8 * i)), file); }
+}
+
+
+bool read_f32(FILE *file, float *out) {
+	uint32_t bits = 0;
+	FOR_IN(i, 4) {
+		int c = fgetc(file);
+		if (c < 0) { return false; }
+		bits |= (uint32_t) c << (8 * i);
+	}
+	memcpy(out, &bits, sizeof(bits));
+	return true;
+}
@@ -1,3 +1,4 @@
+#include <assert.h>
 #include <stdio.h>
 #include <raylib.h>
 
@@ -6,42 +7,95 @@
 
 #define DRAW_COORDINATE_SYSTEM_HELPERS 1
 
+#define DD_COLOR(c) ((debug_draw_color_t){ (c).r, (c).g, (c).b, (c).a })
+#define RL_COLOR(c) ((Color){ (c).r, (c).g, (c).b, (c).a })
+
+// Same clipping distances as raylib uses for perspective projection
+static const float view_near_distance = 0.01f;
+static const float view_far_distance = 1000.f;
+
 
 //// Rendering ////
 
-void render_orientation_gizmo(float l, vec3_t pos, quat_t ori);
 void draw_matrix_as_text(const char* title, mat4_t m, float x, float y, float s, Color c);
+float render_profile_phases(const profile_phase_t [], size_t, float x, float y, float s);
+float render_memory_report(const memory_report_t *, float x, float y, float s);
 
 /**
 Render all the things.
+
+Everything that changes comes from the captured frame. Only things that stay
+the same after init (like the landscape) are read from the app itself.
+
+Debug geometry is first recorded into a command buffer and then submitted
+in one go (grouped by primitive type).
 **/
-void render_app(const struct Camera3D *camera,  const app_t *app) {
-	const population_t *pop = &app->population_history[app->frame_count % max_pop_history_frames];
+void render_app(const struct Camera3D *camera, const app_t *app, const app_frame_t *frame) {
+	const population_t *pop = &frame->curr;
+
+	// Show the world somewhere between the two latest simulation steps
+	static population_t interpolated_pop;
+	if (frame->frame_count > 0 && frame->step_fraction < 1.f) {
+		PROFILE_SCOPE("interpolate_population") {
+			interpolate_population(frame->step_fraction, &frame->prev, &frame->curr, &interpolated_pop);
+		}
+		pop = &interpolated_pop;
+	}
 
-	// Render something at origo
-	BeginMode3D(*camera);
+	// Skip whatever the camera can't see
+	static view_cull_t cull;
+	PROFILE_SCOPE("cull_population") {
+		float aspect = (float) GetScreenWidth() / (float) GetScreenHeight();
+		frustum_t frustum = frustum_from_view(
+			vec3(camera->position.x, camera->position.y, camera->position.z),
+			vec3(camera->target.x, camera->target.y, camera->target.z),
+			vec3(camera->up.x, camera->up.y, camera->up.z),
+			camera->fovy, aspect, view_near_distance, view_far_distance);
+		cull_population(&frustum, pop, &app->landscape.ground, &cull);
+	}
+
+	// Record what to draw
+	static debug_draw_buffer_t dd;
+	clear_debug_draw_buffer(&dd);
 	{
-		render_actors(app->actor_model, &pop->actors);
+		PROFILE_SCOPE("render_actors") {
+			render_actors(&pop->actors, cull.actor_visible, &dd);
+		}
 
-		DrawSphere(app->world_cursor.rl, 0.1f, GOLD);
+		push_debug_sphere(frame->world_cursor, 0.1f, DD_COLOR(GOLD), &dd);
 		{
-			vec3_t shadow = app->world_cursor;
-			float x = app->world_cursor.x;
-			float z = app->world_cursor.z;
+			vec3_t shadow = frame->world_cursor;
+			float x = frame->world_cursor.x;
+			float z = frame->world_cursor.z;
 			shadow.y = get_terrain_height(x, z, &app->landscape.ground);
-			DrawSphere(shadow.rl, 0.1f, ORANGE);
+			push_debug_sphere(shadow, 0.1f, DD_COLOR(ORANGE), &dd);
 		}
 
-		render_limb_skeletons(&pop->limbs);
-		render_limb_goals(&pop->limb_goals, &pop->limbs);
+		PROFILE_SCOPE("render_limb_skeletons") {
+			render_limb_skeletons(&pop->limbs, cull.limb_visible, &dd);
+		}
+		PROFILE_SCOPE("render_limb_goals") {
+			render_limb_goals(&pop->limb_goals, &pop->limbs, cull.goal_visible, &dd);
+		}
 
 #if DRAW_COORDINATE_SYSTEM_HELPERS
-		DrawCube(vec3(5,0,0).rl, 1.f, .1f, .1f, RED);
-		DrawCube(vec3(0,5,0).rl, .1f, 1.f, .1f, GREEN);
-		DrawCube(vec3(0,0,5).rl, .1f, .1f, 1.f, BLUE);
+		push_debug_box(vec3(5,0,0), vec3(1.f, .1f, .1f), DD_COLOR(RED), &dd);
+		push_debug_box(vec3(0,5,0), vec3(.1f, 1.f, .1f), DD_COLOR(GREEN), &dd);
+		push_debug_box(vec3(0,0,5), vec3(.1f, .1f, 1.f), DD_COLOR(BLUE), &dd);
 #endif // DRAW_COORDINATE_SYSTEM_HELPERS
 
-		render_terrain(&app->landscape.ground);
+		PROFILE_SCOPE("render_terrain") {
+			render_terrain(&app->landscape.ground, cull.block_visible, &dd);
+		}
+	}
+
+	// Draw it
+	BeginMode3D(*camera);
+	{
+		PROFILE_SCOPE("submit_debug_draw_buffer") {
+			sort_debug_draw_buffer(&dd);
+			submit_debug_draw_buffer(app->actor_model, &dd);
+		}
 
 		DrawGrid(20, 1.f);
 	}
@@ -56,77 +110,115 @@ void render_app(const struct Camera3D *camera,  const app_t *app) {
 	// Frame count
 	{
 		char str[128];
-		snprintf(str, 128, "Frame:\n #%02u", app->frame_count);
+		snprintf(str, 128, "Frame:\n #%02u (+%.2f)\nDropped: %.2fs",
+			frame->frame_count, frame->step_fraction, frame->dropped_time);
 		DrawText(str, 0, 24, 20, DARKGREEN);
 	}
+
+	// Cull counts
+	{
+		char str[128];
+		snprintf(str, 128, "Culled: %u/%u actors, %u/%u limbs, %u/%u goals",
+			cull.num_actors_culled, pop->actors.num_rows,
+			cull.num_limbs_culled, pop->limbs.num_rows,
+			cull.num_goals_culled, pop->limb_goals.num_rows);
+		DrawText(str, 0, 92, 10, DARKGREEN);
+	}
+
+	// Phase timings
+	// (Simulation phases come with the frame, rendering phases are our own)
+	if (frame->show_profile) {
+		float y = 106;
+		y = render_profile_phases(frame->sim_phases, frame->num_sim_phases, 0, y, 10);
+
+		profile_phase_t phases[max_profile_phases];
+		size_t num_phases = collect_profile_phases(phases, max_profile_phases);
+
+		// Skip phases that are already listed (when sharing a thread)
+		size_t num_render_phases = 0;
+		FOR_IN(i, num_phases) {
+			bool listed = false;
+			FOR_IN(j, frame->num_sim_phases) { listed |= (phases[i].name == frame->sim_phases[j].name); }
+			if (!listed) { phases[num_render_phases++] = phases[i]; }
+		}
+		y = render_profile_phases(phases, num_render_phases, 0, y, 10);
+
+		char str[64];
+		snprintf(str, 64, "Debug draw: %u commands (%u dropped)", dd.num_commands, dd.num_dropped);
+		DrawText(str, 0, y, 10, DARKGRAY);
+	}
+
+	// Table occupancy and memory usage (of the latest step)
+	if (frame->show_memory_report) {
+		memory_report_t report;
+		report_memory(&frame->curr, &report);
+		render_memory_report(&report, GetScreenWidth() - 300, 24, 10);
+	}
 }
 
 /**
 Render actors in table.
-(Expects to be called inside raylibs 'Draw3D' mode)
 **/
-void render_actors(const Model* actor_model, const actor_table_t *table) {
+void render_actors(const actor_table_t *table, const bool visible[], debug_draw_buffer_t *dd) {
 	FOR_ROWS(a, *table){
-		Model model = *actor_model;
-		model.transform = mat4_transpose(table->to_world[a]).rl;
-		DrawModel(model, vec3(0,0,0).rl, 1.0f, BLUE);
+		if (!visible[a]) { continue; }
+
+		push_debug_actor(table->location[a], DD_COLOR(BLUE), dd);
 
 		vec3_t nose_pos = mat4_mul_vec3(table->to_world[a], vec3(0.4, 0.5, 0), 1.f);
-		DrawSphere(nose_pos.rl, 0.2, PINK);
+		push_debug_sphere(nose_pos, 0.2, DD_COLOR(PINK), dd);
 	}
 }
 
-void render_limb_skeletons(const limb_table_t *table) {
-	void render_bone_joint_orientations(vec3_t, bone_t [], size_t);
-
+void render_limb_skeletons(const limb_table_t *table, const bool visible[], debug_draw_buffer_t *dd) {
 	FOR_ROWS(l, *table) {
+		if (!visible[l]) { continue; }
 		limb_id_t limb = get_limb_id(l, table);
 
 		// Render root
 		const vec3_t root_pos = table->position[l];
 		const quat_t root_ori = table->orientation[l];
-		render_orientation_gizmo(0.6, root_pos, root_ori);
-		DrawSphere(root_pos.rl, 0.15, BLACK);
+		push_debug_gizmo(root_pos, root_ori, 0.6, dd);
+		push_debug_sphere(root_pos, 0.15, DD_COLOR(BLACK), dd);
 
 		// Render individual end effectors
 		const vec3_t end_effector_pos = table->end_effector[l];
-		DrawSphere(end_effector_pos.rl, 0.05, GOLD);
+		push_debug_sphere(end_effector_pos, 0.05, DD_COLOR(GOLD), dd);
 
-		// Render distance from limb tip to end effector
-		const vec3_t limb_tip_pos = get_limb_tip_position(limb, table);
-		DrawLine3D(end_effector_pos.rl, limb_tip_pos.rl, PURPLE);
-
-		// Render bones in their current positions
+		// Render bones (and their orientation) in their current positions
+		vec3_t limb_tip_pos = root_pos;
 		int bone = table->root_bone[l];
 		while (bone) {
-			bone_t seg = table->bones[bone];
+			const bone_t *seg = &table->bones[bone];
 			vec3_t tip_pos = get_bone_tip_position(bone, table);
-			DrawLine3D(seg.joint_pos.rl, tip_pos.rl, GRAY);
-			DrawSphere(seg.joint_pos.rl, 0.10, MAROON);
-			DrawSphere(tip_pos.rl, 0.05, MAROON);
+			push_debug_line(seg->joint_pos, tip_pos, DD_COLOR(GRAY), dd);
+			push_debug_sphere(seg->joint_pos, 0.10, DD_COLOR(MAROON), dd);
+			push_debug_sphere(tip_pos, 0.05, DD_COLOR(MAROON), dd);
+			push_debug_gizmo(seg->joint_pos, seg->orientation, 0.3, dd);
+			limb_tip_pos = tip_pos;
 
 			// Next bone (if any)
 			bone = table->bone_nodes[bone].next_index;
 			if (bone == table->root_bone[l]) { bone = 0; }
 		}
 
-		// Render limb bones orientation gizmoz
-		bone_t bones[32];
-		size_t num_bones = collect_bones(limb, table, bones, 32);
-		render_bone_joint_orientations(root_pos, bones, num_bones);
+		// Render distance from limb tip to end effector
+		push_debug_line(end_effector_pos, limb_tip_pos, DD_COLOR(PURPLE), dd);
 
 		// Render pairing
 		limb_id_t paired_limb = table->paired_with[l];
 		if (limb.id < paired_limb.id) {
 			vec3_t other_root_pos = get_limb_position(paired_limb, table);
-			DrawLine3D(root_pos.rl, other_root_pos.rl, BLACK);
+			push_debug_line(root_pos, other_root_pos, DD_COLOR(BLACK), dd);
 		}
 	}
 }
 
 
-void render_limb_goals(const limb_goal_table_t *goals, const limb_table_t *limbs) {
+void render_limb_goals(const limb_goal_table_t *goals, const limb_table_t *limbs, const bool visible[], debug_draw_buffer_t *dd) {
 	FOR_ROWS(goal_index, *goals) {
+		if (!visible[goal_index]) { continue; }
+
 		// Get the data
 		limb_id_t limb = goals->dense_id[goal_index];
 		int limb_index = get_limb_index(limb, limbs);
@@ -136,27 +228,20 @@ void render_limb_goals(const limb_goal_table_t *goals, const limb_table_t *limbs
 		// Render the remaining curve
 		FOR_RANGE(i, goals->curve_index[goal_index], goals->curve_length[goal_index]) {
 			vec3_t curve_pos = goals->curve_points[goal_index][i];
-			DrawLine3D(prev_pos.rl, curve_pos.rl, LIME);
-			DrawSphere(curve_pos.rl, threshold, LIME);
+			push_debug_line(prev_pos, curve_pos, DD_COLOR(LIME), dd);
+			push_debug_sphere(curve_pos, threshold, DD_COLOR(LIME), dd);
 			prev_pos = curve_pos;
 		}
 	}
 }
 
 
-void render_bone_joint_orientations(vec3_t origin_pos, bone_t bones[], size_t num_bones) {
-	// Draw joint spaces
-	FOR_IN(i, num_bones) {
-		vec3_t joint_pos = bones[i].joint_pos;
-		quat_t joint_ori = bones[i].orientation;
-		render_orientation_gizmo(0.3, joint_pos, joint_ori);
-	}
-}
-
 //// Landscape ////
 
-void render_terrain(const terrain_table_t *table) {
+void render_terrain(const terrain_table_t *table, const bool visible[], debug_draw_buffer_t *dd) {
 	FOR_ROWS(i, *table) {
+		if (!visible[i]) { continue; }
+
 		vec3_t center = {
 			(table->block[i].x1 + table->block[i].x2)/2.f,
 			table->block[i].height/2.f,
@@ -169,19 +254,53 @@ void render_terrain(const terrain_table_t *table) {
 		};
 		Color color = GRAY;
 		color.g = 128 + (127.f * table->block[i].height * 2.f);
-		DrawCubeV(center.rl, size.rl, color);
+		push_debug_box(center, size, DD_COLOR(color), dd);
 	}
 }
 
 
-//// Helpers ////
+//// Debug draw ////
 
-void render_orientation_gizmo(float l, vec3_t pos, quat_t ori) {
-	DrawLine3D(pos.rl, vec3_add(pos, quat_rotate_vec3(ori, vec3(l,0,0))).rl, RED);
-	DrawLine3D(pos.rl, vec3_add(pos, quat_rotate_vec3(ori, vec3(0,l,0))).rl, GREEN);
-	DrawLine3D(pos.rl, vec3_add(pos, quat_rotate_vec3(ori, vec3(0,0,l))).rl, BLUE);
+/**
+Draw all commands in the (sorted) buffer.
+(Expects to be called inside raylibs 'Draw3D' mode)
+**/
+void submit_debug_draw_buffer(const Model *actor_model, const debug_draw_buffer_t *dd) {
+	FOR_IN(i, dd->num_commands) {
+		const debug_draw_command_t *command = &dd->commands[dd->order[i]];
+		Color color = RL_COLOR(command->color);
+		switch (command->type) {
+			case dd_line: {
+				DrawLine3D(command->a.rl, command->b.rl, color);
+			} break;
+			case dd_sphere: {
+				DrawSphere(command->a.rl, command->size, color);
+			} break;
+			case dd_gizmo: {
+				vec3_t pos = command->a;
+				quat_t ori = command->ori;
+				float l = command->size;
+				DrawLine3D(pos.rl, vec3_add(pos, quat_rotate_vec3(ori, vec3(l,0,0))).rl, RED);
+				DrawLine3D(pos.rl, vec3_add(pos, quat_rotate_vec3(ori, vec3(0,l,0))).rl, GREEN);
+				DrawLine3D(pos.rl, vec3_add(pos, quat_rotate_vec3(ori, vec3(0,0,l))).rl, BLUE);
+			} break;
+			case dd_box: {
+				DrawCubeV(command->a.rl, command->b.rl, color);
+			} break;
+			case dd_actor: {
+				location_t location = { command->a, command->size };
+				Model model = *actor_model;
+				model.transform = mat4_transpose(to_world_from_location(location)).rl;
+				DrawModel(model, vec3(0,0,0).rl, 1.0f, color);
+			} break;
+			default: { assert(false); } break;
+		}
+	}
 }
 
+
+//// Helpers ////
+
 void draw_matrix_as_text(const char* title, mat4_t m, float x, float y, float s, Color c) {
 	char str[1024];
 	snprintf(str, 1024, "%s:\n"
@@ -197,3 +316,49 @@ void draw_matrix_as_text(const char* title, mat4_t m, float x, float y, float s,
 		);
 	DrawText(str, x, y, s, c);
 }
+
+/**
+List the time spent in every profiled phase (last and average, in milliseconds).
+
+Returns where the list ended.
+**/
+float render_profile_phases(const profile_phase_t phases[], size_t num_phases, float x, float y, float s) {
+	FOR_IN(i, num_phases) {
+		char str[128];
+		snprintf(str, 128, "%6.3f ms (avg %6.3f) %s",
+			phases[i].last * 1000.0, phases[i].average * 1000.0, phases[i].name);
+		DrawText(str, x, y, s, DARKGRAY);
+		y += s + 2;
+	}
+	return y;
+}
+
+
+/**
+List how full every table is and what the app keeps and copies.
+
+Returns where the list ended.
+**/
+float render_memory_report(const memory_report_t *report, float x, float y, float s) {
+	char str[128];
+	FOR_IN(t, report->num_tables) {
+		const table_usage_t *u = &report->tables[t];
+		snprintf(str, 128, "%s: %u rows (peak %u) of %u, %.1f KiB",
+			u->name, u->num_rows, u->peak_rows, u->capacity, u->bytes / 1024.0);
+		DrawText(str, x, y, s, DARKGRAY);
+		y += s + 2;
+	}
+
+	snprintf(str, 128, "Bone nodes: %u used, %u free", report->num_bone_nodes_used, report->num_bone_nodes_free);
+	DrawText(str, x, y, s, DARKGRAY);
+	y += s + 2;
+	snprintf(str, 128, "History: %.1f MiB (%.1f KiB per population)",
+		report->history_bytes / (1024.0 * 1024.0), report->population_bytes / 1024.0);
+	DrawText(str, x, y, s, DARKGRAY);
+	y += s + 2;
+	snprintf(str, 128, "Copied: %.1f KiB per step, %.1f KiB per frame",
+		report->bytes_copied_per_step / 1024.0, report->bytes_copied_per_frame / 1024.0);
+	DrawText(str, x, y, s, DARKGRAY);
+	y += s + 2;
+	return y;
+}
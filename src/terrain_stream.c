@@ -0,0 +1,543 @@
+#define _POSIX_C_SOURCE 200809L
+#include <assert.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IN_TERRAIN_STREAM
+#include "overview.h"
+
+// File layout:
+//   Header: see below
+//   Tile index: one terrain_tile_info_t per tile (row by row, x fastest)
+//   Tiles: 'samples' x 'samples' heights each (x fastest), starting at 'tiles_offset'
+//          and 'tile_stride' apart (both multiples of 4096, so tiles map on their own)
+// Heights are mapped as they are, so the file only works on machines with the
+// byte order (and floats) it was baked on.
+static const char terrain_file_magic[4] = { 'P', 'T', 'E', 'R' };
+static const uint32_t terrain_file_version = 1;
+enum { terrain_file_alignment = 4096 };
+
+typedef struct terrain_file_header_ {
+	char magic[4];
+	uint32_t version;
+	uint32_t tiles_x, tiles_z;
+	uint32_t samples; // Per side of a tile (the edges are shared with the neighbours)
+	float tile_size;
+	float origin_x, origin_z; // Corner of the first tile
+	float byte_order; // 1.0 (as written)
+	uint32_t tile_stride;
+	uint64_t tiles_offset;
+} terrain_file_header_t;
+
+typedef struct terrain_tile_info_ {
+	float mean_height; // (What the tile reads as while it is not resident)
+	float max_height;
+} terrain_tile_info_t;
+
+/**
+A resident tile.
+
+Only the loader changes slots. Readers count themselves in, so that a tile
+is never unmapped under them.
+**/
+typedef struct terrain_slot_ {
+	int32_t tile; // (-1 if free)
+	const float *heights;
+	void *mapping;
+	size_t mapping_size;
+	uint32_t last_wanted; // Round of requests the tile was last wanted in
+	atomic_uint num_readers;
+} terrain_slot_t;
+
+struct terrain_stream_ {
+	// File (the header and the tile index stay mapped)
+	int file;
+	void *index_mapping;
+	size_t index_mapping_size;
+	const terrain_file_header_t *header;
+	const terrain_tile_info_t *tile_info;
+	size_t num_tiles, tile_bytes, page_size;
+	float radius;
+	bool blocking;
+
+	// Where each tile is (slot index, or -1 while it is not resident)
+	atomic_int *tile_slot;
+	terrain_slot_t slots[max_resident_terrain_tiles];
+	unsigned max_resident;
+
+	// Loader thread and what it has been asked for (nearest tiles first)
+	pthread_t loader;
+	pthread_mutex_t lock;
+	pthread_cond_t wake, done;
+	uint32_t request_round, done_round;
+	int32_t wanted[max_resident_terrain_tiles];
+	size_t num_wanted;
+	bool quit;
+	terrain_stream_stats_t stats; // (Under lock)
+};
+
+void *run_terrain_loader(void *);
+void load_wanted_terrain_tiles(uint32_t round, const int32_t wanted[], size_t num, terrain_stream_t *);
+bool map_terrain_tile(int32_t tile, terrain_slot_t *, const terrain_stream_t *);
+void release_terrain_slot(terrain_slot_t *, terrain_stream_t *);
+size_t gather_wanted_terrain_tiles(const actor_table_t *, const terrain_stream_t *, int32_t out[], size_t max);
+float sample_terrain_tile(const float heights[], unsigned samples, float u, float v);
+
+
+//// Baking ////
+
+/**
+Sample the height of terrain blocks into a tiled terrain file.
+
+Tiles cover 'tile_size' by 'tile_size' each, from (origin_x, origin_z) and on.
+**/
+bool bake_terrain_tiles(
+		const char *path, const terrain_table_t *blocks,
+		float origin_x, float origin_z, float tile_size,
+		unsigned tiles_x, unsigned tiles_z, unsigned samples) {
+	assert(!blocks->stream);
+	assert(samples >= 2 && tiles_x > 0 && tiles_z > 0);
+
+	size_t num_tiles = (size_t) tiles_x * tiles_z;
+	size_t tile_bytes = (size_t) samples * samples * sizeof(float);
+	size_t index_end = sizeof(terrain_file_header_t) + num_tiles * sizeof(terrain_tile_info_t);
+	terrain_file_header_t header = {
+		.version = terrain_file_version,
+		.tiles_x = tiles_x, .tiles_z = tiles_z,
+		.samples = samples,
+		.tile_size = tile_size,
+		.origin_x = origin_x, .origin_z = origin_z,
+		.byte_order = 1.f,
+		.tile_stride = (tile_bytes + terrain_file_alignment - 1) / terrain_file_alignment * terrain_file_alignment,
+		.tiles_offset = (index_end + terrain_file_alignment - 1) / terrain_file_alignment * terrain_file_alignment,
+	};
+	memcpy(header.magic, terrain_file_magic, sizeof(header.magic));
+
+	FILE *file = fopen(path, "wb");
+	if (!file) { return false; }
+	terrain_tile_info_t *info = calloc(num_tiles, sizeof(terrain_tile_info_t));
+	float *heights = calloc(header.tile_stride, 1);
+	bool ok = info && heights;
+
+	// Tiles first (the index is known once they are)
+	ok = ok && fseek(file, (long) header.tiles_offset, SEEK_SET) == 0;
+	for (size_t t = 0; ok && t < num_tiles; t++) {
+		float x0 = origin_x + (t % tiles_x) * tile_size;
+		float z0 = origin_z + (t / tiles_x) * tile_size;
+		double sum = 0;
+		info[t].max_height = -INFINITY;
+		FOR_IN(j, samples) {
+			FOR_IN(i, samples) {
+				float x = x0 + tile_size * i / (samples - 1);
+				float z = z0 + tile_size * j / (samples - 1);
+				float h = get_terrain_height(x, z, blocks);
+				heights[j * samples + i] = h;
+				sum += h;
+				info[t].max_height = maxf(info[t].max_height, h);
+			}
+		}
+		info[t].mean_height = sum / (samples * samples);
+		ok = fwrite(heights, 1, header.tile_stride, file) == header.tile_stride;
+	}
+
+	ok = ok && fseek(file, 0, SEEK_SET) == 0;
+	ok = ok && fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fwrite(info, sizeof(terrain_tile_info_t), num_tiles, file) == num_tiles;
+	ok &= (fclose(file) == 0);
+	free(heights);
+	free(info);
+	return ok;
+}
+
+
+//// Terrain stream ////
+
+/**
+Open a tiled terrain file to stream tiles from (within 'radius' of actors).
+
+Tiles are mapped in on a loader thread of the stream's own, keeping no more
+than 'memory_budget' bytes of them resident. Returns NULL if the file is no
+terrain file, the budget does not fit a single tile (or the loader could not
+be started).
+**/
+terrain_stream_t *open_terrain_stream(const char *path, float radius, size_t memory_budget) {
+	int file = open(path, O_RDONLY);
+	if (file < 0) { return NULL; }
+
+	// Check the header, then map it along with the tile index
+	terrain_file_header_t header;
+	bool ok = pread(file, &header, sizeof(header), 0) == sizeof(header);
+	ok = ok && memcmp(header.magic, terrain_file_magic, sizeof(header.magic)) == 0;
+	ok = ok && header.version == terrain_file_version && header.byte_order == 1.f;
+	ok = ok && header.samples >= 2 && header.tiles_x > 0 && header.tiles_z > 0;
+	ok = ok && header.tile_stride >= (size_t) header.samples * header.samples * sizeof(float);
+	size_t num_tiles = (size_t) header.tiles_x * header.tiles_z;
+	size_t index_size = sizeof(header) + num_tiles * sizeof(terrain_tile_info_t);
+	ok = ok && header.tiles_offset >= index_size;
+	ok = ok && memory_budget >= (size_t) header.samples * header.samples * sizeof(float); // (At least a tile)
+	struct stat file_stat;
+	ok = ok && fstat(file, &file_stat) == 0;
+	ok = ok && (uint64_t) file_stat.st_size >= header.tiles_offset + (num_tiles - 1) * header.tile_stride +
+		(uint64_t) header.samples * header.samples * sizeof(float);
+	void *index = (ok ? mmap(NULL, index_size, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED);
+	if (index == MAP_FAILED) {
+		close(file);
+		return NULL;
+	}
+
+	terrain_stream_t *stream = calloc(1, sizeof(terrain_stream_t));
+	stream->file = file;
+	stream->index_mapping = index;
+	stream->index_mapping_size = index_size;
+	stream->header = index;
+	stream->tile_info = (const terrain_tile_info_t *) (stream->header + 1);
+	stream->num_tiles = num_tiles;
+	stream->tile_bytes = (size_t) header.samples * header.samples * sizeof(float);
+	stream->page_size = (size_t) sysconf(_SC_PAGESIZE);
+	stream->radius = radius;
+
+	// Nothing is resident to begin with
+	stream->tile_slot = malloc(num_tiles * sizeof(atomic_int));
+	FOR_IN(t, num_tiles) { atomic_init(&stream->tile_slot[t], -1); }
+	FOR_IN(s, max_resident_terrain_tiles) {
+		stream->slots[s].tile = -1;
+		atomic_init(&stream->slots[s].num_readers, 0);
+	}
+	size_t max_resident = memory_budget / stream->tile_bytes;
+	stream->max_resident = (max_resident < max_resident_terrain_tiles ? max_resident : max_resident_terrain_tiles);
+	stream->stats.num_tiles = num_tiles;
+	stream->stats.max_resident_tiles = stream->max_resident;
+	stream->stats.memory_budget = memory_budget;
+
+	pthread_mutex_init(&stream->lock, NULL);
+	pthread_cond_init(&stream->wake, NULL);
+	pthread_cond_init(&stream->done, NULL);
+	if (pthread_create(&stream->loader, NULL, run_terrain_loader, stream) != 0) {
+		stream->quit = true;
+		close_terrain_stream(stream);
+		return NULL;
+	}
+	return stream;
+}
+
+
+void close_terrain_stream(terrain_stream_t *stream) {
+	if (!stream) { return; }
+
+	// (The loader is only missing if it never started)
+	pthread_mutex_lock(&stream->lock);
+	bool started = !stream->quit;
+	stream->quit = true;
+	pthread_cond_broadcast(&stream->wake);
+	pthread_cond_broadcast(&stream->done);
+	pthread_mutex_unlock(&stream->lock);
+	if (started) { pthread_join(stream->loader, NULL); }
+
+	FOR_IN(s, max_resident_terrain_tiles) {
+		if (stream->slots[s].tile >= 0) { release_terrain_slot(&stream->slots[s], stream); }
+	}
+	pthread_cond_destroy(&stream->done);
+	pthread_cond_destroy(&stream->wake);
+	pthread_mutex_destroy(&stream->lock);
+	munmap(stream->index_mapping, stream->index_mapping_size);
+	close(stream->file);
+	free(stream->tile_slot);
+	free(stream);
+}
+
+
+/**
+Have the stream wait for the tiles it asks for (so that where tiles are
+not yet loaded never depends on timing, like when replaying).
+**/
+void set_terrain_stream_blocking(bool blocking, terrain_stream_t *stream) {
+	stream->blocking = blocking;
+}
+
+
+/**
+Ask for the tiles around actors (nearest first) to be made resident.
+
+The loader is only bothered if they differ from those asked for last time.
+**/
+void stream_terrain_around_actors(const actor_table_t *actors, terrain_stream_t *stream) {
+	int32_t wanted[max_resident_terrain_tiles];
+	size_t num_wanted = gather_wanted_terrain_tiles(actors, stream, wanted, stream->max_resident);
+
+	pthread_mutex_lock(&stream->lock);
+	bool same = num_wanted == stream->num_wanted && memcmp(wanted, stream->wanted, num_wanted * sizeof(int32_t)) == 0;
+	if (!same) {
+		memcpy(stream->wanted, wanted, num_wanted * sizeof(int32_t));
+		stream->num_wanted = num_wanted;
+		stream->request_round++;
+		pthread_cond_signal(&stream->wake);
+	}
+	pthread_mutex_unlock(&stream->lock);
+
+	if (stream->blocking) { wait_for_terrain_stream(stream); }
+}
+
+
+/**
+Wait until the loader has dealt with what it was asked for last.
+**/
+void wait_for_terrain_stream(terrain_stream_t *stream) {
+	pthread_mutex_lock(&stream->lock);
+	while (!stream->quit && stream->done_round != stream->request_round) {
+		pthread_cond_wait(&stream->done, &stream->lock);
+	}
+	pthread_mutex_unlock(&stream->lock);
+}
+
+
+void get_terrain_stream_stats(terrain_stream_t *stream, terrain_stream_stats_t *out) {
+	pthread_mutex_lock(&stream->lock);
+	*out = stream->stats;
+	pthread_mutex_unlock(&stream->lock);
+}
+
+
+/**
+Tiles within the radius of any actor, nearest first (as many as fit).
+**/
+size_t gather_wanted_terrain_tiles(const actor_table_t *actors, const terrain_stream_t *stream, int32_t out[], size_t max) {
+	const terrain_file_header_t *h = stream->header;
+	const float r = stream->radius;
+	float distance[max_resident_terrain_tiles];
+	size_t num = 0;
+
+	FOR_ROWS(a, *actors) {
+		vec3_t p = actors->location[a].position;
+		int tx1 = (int) floorf((p.x - r - h->origin_x) / h->tile_size);
+		int tx2 = (int) floorf((p.x + r - h->origin_x) / h->tile_size);
+		int tz1 = (int) floorf((p.z - r - h->origin_z) / h->tile_size);
+		int tz2 = (int) floorf((p.z + r - h->origin_z) / h->tile_size);
+		if (tx1 < 0) { tx1 = 0; }
+		if (tz1 < 0) { tz1 = 0; }
+		if (tx2 >= (int) h->tiles_x) { tx2 = h->tiles_x - 1; }
+		if (tz2 >= (int) h->tiles_z) { tz2 = h->tiles_z - 1; }
+
+		for (int tz = tz1; tz <= tz2; tz++) {
+			for (int tx = tx1; tx <= tx2; tx++) {
+				// Distance to the nearest point of the tile
+				float x0 = h->origin_x + tx * h->tile_size, z0 = h->origin_z + tz * h->tile_size;
+				float dx = maxf(maxf(x0 - p.x, p.x - (x0 + h->tile_size)), 0);
+				float dz = maxf(maxf(z0 - p.z, p.z - (z0 + h->tile_size)), 0);
+				float d = sqrtf(dx * dx + dz * dz);
+				if (d > r) { continue; }
+
+				// Take it out if it is already there (further away), then put it in its place
+				int32_t tile = tz * h->tiles_x + tx;
+				size_t i = 0;
+				while (i < num && out[i] != tile) { i++; }
+				if (i < num && distance[i] <= d) { continue; }
+				if (i < num) {
+					memmove(&out[i], &out[i + 1], (num - i - 1) * sizeof(int32_t));
+					memmove(&distance[i], &distance[i + 1], (num - i - 1) * sizeof(float));
+					num--;
+				}
+				size_t j = num;
+				while (j > 0 && distance[j - 1] > d) { j--; }
+				if (j >= max) { continue; }
+				if (num == max) { num--; }
+				memmove(&out[j + 1], &out[j], (num - j) * sizeof(int32_t));
+				memmove(&distance[j + 1], &distance[j], (num - j) * sizeof(float));
+				out[j] = tile;
+				distance[j] = d;
+				num++;
+			}
+		}
+	}
+	return num;
+}
+
+
+//// Terrain loader ////
+
+/**
+Make the tiles asked for resident whenever asked (until the stream is closed).
+**/
+void *run_terrain_loader(void *arg) {
+	terrain_stream_t *stream = arg;
+	int32_t wanted[max_resident_terrain_tiles];
+
+	pthread_mutex_lock(&stream->lock);
+	while (true) {
+		while (!stream->quit && stream->done_round == stream->request_round) {
+			pthread_cond_wait(&stream->wake, &stream->lock);
+		}
+		if (stream->quit) { break; }
+		uint32_t round = stream->request_round;
+		size_t num_wanted = stream->num_wanted;
+		memcpy(wanted, stream->wanted, num_wanted * sizeof(int32_t));
+		pthread_mutex_unlock(&stream->lock);
+
+		load_wanted_terrain_tiles(round, wanted, num_wanted, stream);
+
+		pthread_mutex_lock(&stream->lock);
+		stream->done_round = round;
+		pthread_cond_broadcast(&stream->done);
+	}
+	pthread_mutex_unlock(&stream->lock);
+	return NULL;
+}
+
+
+/**
+Map in the wanted tiles that are not resident yet (nearest first).
+
+Room is made by releasing the tiles that have gone longest without being
+wanted. Tiles that are no longer wanted stay until their room is needed.
+**/
+void load_wanted_terrain_tiles(uint32_t round, const int32_t wanted[], size_t num, terrain_stream_t *stream) {
+	FOR_IN(i, num) {
+		int s = atomic_load(&stream->tile_slot[wanted[i]]);
+		if (s >= 0) { stream->slots[s].last_wanted = round; }
+	}
+
+	unsigned num_loads = 0, num_releases = 0;
+	FOR_IN(i, num) {
+		int32_t tile = wanted[i];
+		if (atomic_load(&stream->tile_slot[tile]) >= 0) { continue; }
+
+		// Take a free slot, or the one wanted the longest time ago (but not now)
+		terrain_slot_t *slot = NULL;
+		FOR_IN(s, stream->max_resident) {
+			terrain_slot_t *candidate = &stream->slots[s];
+			if (candidate->tile < 0) {
+				slot = candidate;
+				break;
+			}
+			if (candidate->last_wanted == round) { continue; }
+			if (!slot || candidate->last_wanted < slot->last_wanted) { slot = candidate; }
+		}
+		if (!slot) { break; }
+		if (slot->tile >= 0) {
+			release_terrain_slot(slot, stream);
+			num_releases++;
+		}
+
+		if (!map_terrain_tile(tile, slot, stream)) { continue; }
+		slot->last_wanted = round;
+		atomic_store(&stream->tile_slot[tile], (int) (slot - stream->slots));
+		num_loads++;
+	}
+
+	pthread_mutex_lock(&stream->lock);
+	stream->stats.num_loads += num_loads;
+	stream->stats.num_releases += num_releases;
+	stream->stats.num_resident_tiles += num_loads - num_releases;
+	stream->stats.resident_bytes = stream->stats.num_resident_tiles * stream->tile_bytes;
+	pthread_mutex_unlock(&stream->lock);
+}
+
+
+/**
+Map a tile into the slot, and touch its pages (so that they are read in now,
+rather than by whoever samples the tile first).
+**/
+bool map_terrain_tile(int32_t tile, terrain_slot_t *slot, const terrain_stream_t *stream) {
+	const terrain_file_header_t *h = stream->header;
+	size_t offset = h->tiles_offset + (size_t) tile * h->tile_stride;
+	size_t page_offset = offset / stream->page_size * stream->page_size;
+	size_t size = offset - page_offset + stream->tile_bytes;
+
+	void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, stream->file, (off_t) page_offset);
+	if (mapping == MAP_FAILED) { return false; }
+	posix_madvise(mapping, size, POSIX_MADV_WILLNEED);
+	volatile const char *bytes = mapping;
+	for (size_t b = 0; b < size; b += stream->page_size) { (void) bytes[b]; }
+
+	slot->tile = tile;
+	slot->mapping = mapping;
+	slot->mapping_size = size;
+	slot->heights = (const float *) ((const char *) mapping + (offset - page_offset));
+	return true;
+}
+
+
+/**
+Take the tile of the slot out of the stream and unmap it (once nobody is reading it).
+**/
+void release_terrain_slot(terrain_slot_t *slot, terrain_stream_t *stream) {
+	atomic_store(&stream->tile_slot[slot->tile], -1);
+	while (atomic_load(&slot->num_readers) > 0) { sched_yield(); }
+
+	munmap(slot->mapping, slot->mapping_size);
+	slot->tile = -1;
+	slot->heights = NULL;
+	slot->mapping = NULL;
+}
+
+
+//// Terrain sampling ////
+
+/**
+Get the height of the streamed terrain at (x,z).
+
+Tiles that are not resident read as the mean height of the tile (from the
+index, which always is). Outside the tiles the height is 0.
+**/
+float get_streamed_terrain_height(float x, float z, terrain_stream_t *stream) {
+	const terrain_file_header_t *h = stream->header;
+	float u = (x - h->origin_x) / h->tile_size;
+	float v = (z - h->origin_z) / h->tile_size;
+	if (!(u >= 0 && v >= 0 && u <= h->tiles_x && v <= h->tiles_z)) { return 0; }
+	unsigned tx = (unsigned) u, tz = (unsigned) v;
+	if (tx == h->tiles_x) { tx--; }
+	if (tz == h->tiles_z) { tz--; }
+	int32_t tile = tz * h->tiles_x + tx;
+
+	// Count in as a reader, then make sure the tile is still there
+	// (either the loader sees the count, or this sees the tile gone)
+	int s = atomic_load(&stream->tile_slot[tile]);
+	if (s < 0) { return stream->tile_info[tile].mean_height; }
+	terrain_slot_t *slot = &stream->slots[s];
+	atomic_fetch_add(&slot->num_readers, 1);
+	float height;
+	if (atomic_load(&stream->tile_slot[tile]) == s) {
+		height = sample_terrain_tile(slot->heights, h->samples, u - tx, v - tz);
+	} else {
+		height = stream->tile_info[tile].mean_height;
+	}
+	atomic_fetch_sub(&slot->num_readers, 1);
+	return height;
+}
+
+
+/**
+Is the tile at (x,z) resident (or would its height be a stand-in)?
+**/
+bool is_terrain_tile_resident(float x, float z, terrain_stream_t *stream) {
+	const terrain_file_header_t *h = stream->header;
+	float u = (x - h->origin_x) / h->tile_size;
+	float v = (z - h->origin_z) / h->tile_size;
+	if (!(u >= 0 && v >= 0 && u < h->tiles_x && v < h->tiles_z)) { return false; }
+	int32_t tile = (unsigned) v * h->tiles_x + (unsigned) u;
+	return atomic_load(&stream->tile_slot[tile]) >= 0;
+}
+
+
+/** Bilinear, with (u,v) from 0 to 1 across the tile. **/
+float sample_terrain_tile(const float heights[], unsigned samples, float u, float v) {
+	float fx = minf(maxf(u, 0), 1) * (samples - 1), fz = minf(maxf(v, 0), 1) * (samples - 1);
+	unsigned i = (unsigned) fx, j = (unsigned) fz;
+	if (i > samples - 2) { i = samples - 2; }
+	if (j > samples - 2) { j = samples - 2; }
+	fx -= i;
+	fz -= j;
+
+	const float *row0 = &heights[j * samples + i], *row1 = row0 + samples;
+	float h0 = row0[0] + (row0[1] - row0[0]) * fx;
+	float h1 = row1[0] + (row1[1] - row1[0]) * fx;
+	return h0 + (h1 - h0) * fz;
+}
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
 #include <catch2/catch.hpp>
 #include <raylib.h>
 
@@ -225,4 +229,1620 @@ SCENARIO("Joint constraints") {
 			}
 		}
 	}
+
+	GIVEN("A leg with a hinged hip and knee, turned around y") {
+		quat_t ori = quat_from_axis_angle(vec3_positive_y, 0.7f);
+		vec3_t root = vec3(1,2,3);
+		limb_id_t leg = create_limb(root, ori, &limbs);
+		uint16_t hip = add_bone_to_limb(leg, vec3(1.1f,1.25f,3), &limbs);
+		apply_hinge_constraint(hip, -0.6f * pi, 0.4f * pi, &limbs);
+		uint16_t l = get_limb_index(leg, &limbs);
+		CHECK(limbs.ik_solver[l] == iks_fabrik);
+		uint16_t knee = add_bone_to_limb(leg, vec3(1,0.5f,3), &limbs);
+		CHECK(limbs.ik_solver[l] == iks_fabrik);
+		apply_hinge_constraint(knee, -0.9f * pi, 0, &limbs);
+
+		THEN("It is solved in closed form") {
+			CHECK(limbs.ik_solver[l] == iks_two_hinges);
+		}
+
+		WHEN("Reaching for points all around it") {
+			bone_t start[2];
+			REQUIRE(collect_bones(leg, &limbs, start, 2) == 2);
+			vec3_t root_forward = quat_rotate_vec3(ori, vec3_positive_x);
+			vec3_t root_up = quat_rotate_vec3(ori, vec3_positive_y);
+
+			float worse_by = 0; // (Than FABRIK)
+			bool in_limits = true, lengths_kept = true;
+			FOR_IN(x, 17) FOR_IN(y, 17) FOR_IN(z, 3) {
+				vec3_t end = vec3_add(root, vec3(-1.6f + 0.2f * x, -1.6f + 0.2f * y, -0.2f + 0.2f * z));
+				bone_t closed[2] = {start[0], start[1]}, fabrik[2] = {start[0], start[1]};
+				reposition_two_hinged_bones(root, ori, end, closed);
+				FOR_IN(i, 3) { reposition_bones_with_fabrik(root, ori, end, fabrik, 2); }
+				float d = vec3_distance(get_bone_tip(closed[1]), end) - vec3_distance(get_bone_tip(fabrik[1]), end);
+				worse_by = std::max(worse_by, d);
+
+				// Hinge angles (like the FABRIK constraints measure them)
+				vec3_t thigh = quat_rotate_vec3(closed[0].orientation, vec3_positive_x);
+				vec3_t thigh_up = quat_rotate_vec3(closed[0].orientation, vec3_positive_y);
+				vec3_t shin = quat_rotate_vec3(closed[1].orientation, vec3_positive_x);
+				float hip_ang = atan2f(vec3_dot(thigh, root_up), vec3_dot(thigh, root_forward));
+				float knee_ang = atan2f(vec3_dot(shin, thigh_up), vec3_dot(shin, thigh));
+				in_limits &= (hip_ang > -0.6f * pi - 1e-3f && hip_ang < 0.4f * pi + 1e-3f);
+				in_limits &= (knee_ang > -0.9f * pi - 1e-3f && knee_ang < 1e-3f);
+				lengths_kept &= vec3_distance(closed[1].joint_pos, get_bone_tip(closed[0])) < 1e-4f;
+				lengths_kept &= vec3_distance(closed[0].joint_pos, root) < 1e-4f;
+			}
+
+			THEN("The tip gets at least as close as with FABRIK") {
+				CHECK(worse_by < 1e-4f);
+			}
+
+			THEN("The hinges keep within their limits and the bones together") {
+				CHECK(in_limits);
+				CHECK(lengths_kept);
+			}
+		}
+
+		WHEN("Reaching for where the hinges can take the tip") {
+			float l1 = limbs.bones[hip].distance, l2 = limbs.bones[knee].distance;
+			float hip_ang = -0.4f * pi, knee_ang = -0.5f;
+			vec3_t local = vec3(
+				l1 * cosf(hip_ang) + l2 * cosf(hip_ang + knee_ang),
+				l1 * sinf(hip_ang) + l2 * sinf(hip_ang + knee_ang), 0);
+			vec3_t end = vec3_add(root, quat_rotate_vec3(ori, local));
+			move_limb_directly_to(leg, end, &limbs);
+
+			THEN("It gets there in one pass") {
+				CHECK(vec3_distance(get_limb_tip_position(leg, &limbs), end) < 1e-4f);
+				CHECK(limbs.ik_clamps[l] == 0);
+				CHECK(limbs.ik_passes[l] == 1);
+			}
+		}
+
+		AND_GIVEN("A foot as well") {
+			add_bone_to_limb(leg, vec3(1.2f,0.5f,3), &limbs);
+
+			THEN("It goes through FABRIK again") {
+				CHECK(limbs.ik_solver[l] == iks_fabrik);
+			}
+		}
+	}
+}
+
+SCENARIO("Phase profiling") {
+	clear_profile();
+
+	GIVEN("A profiled scope with a nested one") {
+		int num_runs = 0;
+		PROFILE_SCOPE("outer") {
+			PROFILE_SCOPE("inner") {
+				volatile int spin = 0;
+				FOR_IN(i, 1000) { spin += i; }
+				num_runs++;
+			}
+		}
+
+		THEN("The profiled body ran exactly once") {
+			CHECK(num_runs == 1);
+		}
+
+		THEN("Both phases are tracked (if profiling is enabled)") {
+			profile_phase_t phases[max_profile_phases];
+			size_t num_phases = collect_profile_phases(phases, max_profile_phases);
+#if ENABLE_PROFILING
+			REQUIRE(num_phases == 2);
+			CHECK(std::string(phases[0].name) == "inner");
+			CHECK(std::string(phases[1].name) == "outer");
+			CHECK(phases[1].last >= phases[0].last);
+			CHECK(count_profile_events() == 2);
+#else
+			CHECK(num_phases == 0);
+#endif
+		}
+
+		THEN("The events can be written as a Chrome trace") {
+			CHECK(write_profile_as_chrome_trace("test_trace.json"));
+		}
+	}
+
+	GIVEN("An event that was not recorded (like when every buffer is taken)") {
+		end_profile_event(0);
+
+		THEN("ending it records nothing") {
+			CHECK(count_profile_events() == 0);
+		}
+	}
+
+	GIVEN("Many more threads than profile buffers, one after the other") {
+		const int num_threads = 40;
+		FOR_IN(t, num_threads) {
+			std::thread thread([]() {
+				PROFILE_SCOPE("thread") {}
+			});
+			thread.join();
+		}
+
+		THEN("every one of them gets profiled (if profiling is enabled)") {
+#if ENABLE_PROFILING
+			CHECK(count_profile_events() == num_threads);
+#else
+			CHECK(count_profile_events() == 0);
+#endif
+		}
+	}
+}
+
+SCENARIO("Population interpolation") {
+	static population_t from, to, out;
+	from = population_t{};
+	init_limb_table(&from.limbs);
+
+	GIVEN("A person that has moved between two frames") {
+		create_person(vec3(0,3,0), 0, &from);
+		to = from;
+		to.actors.location[0].position = vec3(2,3,0);
+		to.limbs.position[0] = vec3_add(from.limbs.position[0], vec3(2,0,0));
+
+		WHEN("interpolating half way") {
+			interpolate_population(0.5, &from, &to, &out);
+
+			THEN("the person is half way there") {
+				CHECK(out.actors.location[0].position == vec3(1,3,0));
+				CHECK(out.actors.to_world[0].m14 == 1);
+				CHECK(out.limbs.position[0] == vec3_add(from.limbs.position[0], vec3(1,0,0)));
+			}
+		}
+
+		WHEN("interpolating all the way") {
+			interpolate_population(1, &from, &to, &out);
+
+			THEN("the result is the later frame") {
+				CHECK(out.actors.location[0].position == to.actors.location[0].position);
+				CHECK(out.limbs.position[0] == to.limbs.position[0]);
+			}
+		}
+	}
+}
+
+SCENARIO("Debug draw buffer") {
+	static debug_draw_buffer_t dd;
+	clear_debug_draw_buffer(&dd);
+
+	GIVEN("A limb with two bones") {
+		static limb_table_t limbs;
+		init_limb_table(&limbs);
+		limb_id_t arm = create_limb(vec3_origo, quat_identity, &limbs);
+		add_bone_to_limb(arm, vec3(2,0,0), &limbs);
+		add_bone_to_limb(arm, vec3(4,0,0), &limbs);
+
+		WHEN("its skeleton is recorded") {
+			const bool visible[] = { true }; // (Only one limb)
+			render_limb_skeletons(&limbs, visible, &dd);
+
+			THEN("every part of it is drawn") {
+				CHECK(dd.num_of_type[dd_line] == 3); // Bones and distance to end effector
+				CHECK(dd.num_of_type[dd_sphere] == 6); // Root, end effector and joints
+				CHECK(dd.num_of_type[dd_gizmo] == 3); // Root and bones
+				CHECK(dd.num_dropped == 0);
+			}
+
+			THEN("sorting groups the commands by type (keeping their order)") {
+				sort_debug_draw_buffer(&dd);
+				FOR_RANGE(i, 1, dd.num_commands) {
+					const debug_draw_command_t &prev = dd.commands[dd.order[i-1]];
+					const debug_draw_command_t &curr = dd.commands[dd.order[i]];
+					CHECK(prev.type <= curr.type);
+					if (prev.type == curr.type) { CHECK(dd.order[i-1] < dd.order[i]); }
+				}
+			}
+		}
+	}
+
+	GIVEN("A full buffer") {
+		FOR_IN(i, max_debug_draw_commands) {
+			push_debug_sphere(vec3_origo, 1, debug_draw_color_t{ 0, 0, 0, 255 }, &dd);
+		}
+
+		WHEN("pushing one more command") {
+			push_debug_line(vec3_origo, vec3(1,0,0), debug_draw_color_t{ 0, 0, 0, 255 }, &dd);
+
+			THEN("it is dropped (and counted)") {
+				CHECK(dd.num_commands == max_debug_draw_commands);
+				CHECK(dd.num_of_type[dd_line] == 0);
+				CHECK(dd.num_dropped == 1);
+			}
+		}
+
+		WHEN("pushing more commands than a 16 bit count can hold") {
+			FOR_IN(i, 70000) {
+				push_debug_line(vec3_origo, vec3(1,0,0), debug_draw_color_t{ 0, 0, 0, 255 }, &dd);
+			}
+
+			THEN("every one of them is counted") {
+				CHECK(dd.num_dropped == 70000);
+			}
+		}
+	}
+}
+
+SCENARIO("View frustum culling") {
+	GIVEN("A camera at origo looking along the x-axis") {
+		frustum_t frustum = frustum_from_view(vec3_origo, vec3(1,0,0), vec3_positive_y, 90, 1, 0.1, 100);
+
+		THEN("spheres in front of it are inside") {
+			CHECK(sphere_in_frustum(vec3(10,0,0), 0.5, &frustum));
+			CHECK(sphere_in_frustum(vec3(10,9,-9), 0.5, &frustum));
+		}
+
+		THEN("spheres behind, beside or beyond it are outside") {
+			CHECK_FALSE(sphere_in_frustum(vec3(-10,0,0), 0.5, &frustum));
+			CHECK_FALSE(sphere_in_frustum(vec3(10,12,0), 0.5, &frustum));
+			CHECK_FALSE(sphere_in_frustum(vec3(10,0,12), 0.5, &frustum));
+			CHECK_FALSE(sphere_in_frustum(vec3(110,0,0), 0.5, &frustum));
+		}
+
+		THEN("spheres reaching into it are inside") {
+			CHECK(sphere_in_frustum(vec3(10,12,0), 3, &frustum));
+			CHECK(sphere_in_frustum(vec3(-1,0,0), 2, &frustum));
+		}
+
+		WHEN("culling a population with one person in view and one behind the camera") {
+			static population_t pop;
+			pop = population_t{};
+			init_limb_table(&pop.limbs);
+			create_person(vec3(10,0,0), 0, &pop);
+			create_person(vec3(-10,0,0), 0, &pop);
+			terrain_table_t ground = {};
+
+			static view_cull_t cull;
+			cull_population(&frustum, &pop, &ground, &cull);
+
+			THEN("only the person behind is culled") {
+				CHECK(cull.actor_visible[0]);
+				CHECK_FALSE(cull.actor_visible[1]);
+				CHECK(cull.num_actors_culled == 1);
+				CHECK(cull.num_limbs_culled == pop.limbs.num_rows / 2);
+			}
+		}
+	}
+}
+
+SCENARIO("Event log") {
+	clear_log();
+
+	GIVEN("A couple of logged events") {
+		log_arg_t move_args[] = { log_int(3), log_int(7) };
+		log_event(le_move_foot_forward, 2, move_args);
+		log_arg_t trace_args[] = { log_str("test"), log_int(42), log_str("x"), log_float(0.5) };
+		log_event(le_trace_float, 4, trace_args);
+
+		THEN("they are recorded without being formatted") {
+			CHECK(count_log_records() == 2);
+		}
+
+		THEN("decoding them formats their arguments") {
+			FILE *file = tmpfile();
+			REQUIRE(file);
+			CHECK(decode_log(file) == 2);
+
+			char text[512] = {};
+			rewind(file);
+			size_t len = fread(text, 1, sizeof(text) - 1, file);
+			fclose(file);
+			std::string log(text, len);
+			CHECK(log.find("Move foot [#3|7] forward!") != std::string::npos);
+			CHECK(log.find("test():42 \t| x = 0.500000") != std::string::npos);
+		}
+	}
+
+	GIVEN("Many more threads than log buffers, one after the other") {
+		const int num_threads = 40;
+		FOR_IN(t, num_threads) {
+			std::thread thread([t]() {
+				log_arg_t args[] = { log_int(t), log_int(0) };
+				log_event(le_move_foot_forward, 2, args);
+			});
+			thread.join();
+		}
+
+		THEN("every one of them gets to log (in a buffer left by an earlier one)") {
+			CHECK(count_log_records() == num_threads);
+		}
+	}
+}
+
+SCENARIO("Gait schedule") {
+	static population_t polled, scheduled;
+	static terrain_table_t ground;
+	ground = terrain_table_t{};
+	create_terrain_block(4, 6, -10, 10, 0.25, &ground);
+
+	polled = population_t{};
+	init_limb_table(&polled.limbs);
+	FOR_IN(i, 4) {
+		actor_id_t actor = create_person(vec3(0, 3, 2.5f * i), 0, &polled);
+		set_actor_velocity(actor, vec3(0.5f + 0.5f * i, 0, 0), &polled.actors);
+	}
+	scheduled = polled;
+
+	// Like update_population(), but with the chosen way of animating legs
+	auto step = [&](float dt, bool use_schedule, population_t *pop) {
+		move_actors(dt, &pop->actors);
+		calculate_actor_transforms(&pop->actors);
+		reposition_attached_limbs(&pop->legs, &pop->actors, &pop->limbs);
+		animation_env_i env = {
+			&pop->actors, &pop->arms, &pop->legs, &ground, &default_gait_params,
+			&pop->limbs, &pop->limb_goals, &pop->limb_steps, &pop->limb_tip_links,
+			&pop->gait, pop->time, pop->timed_steps
+		};
+		if (use_schedule) { animate_scheduled_actor_legs(dt, &env); }
+		else { animate_walking_actor_legs(dt, &env); }
+		keep_actors_actors_above_ground(3.0, &ground, &pop->actors);
+		move_limbs_toward_goals(dt, &pop->limb_goals, &pop->limbs);
+		move_limbs_along_steps(pop->time + dt, &pop->limb_steps, &pop->limbs);
+		move_limbs_directly_to_end_effectors(&pop->limbs);
+		delete_accomplished_limb_goals(&pop->limbs, &pop->limb_goals);
+		delete_finished_limb_steps(pop->time + dt, &pop->limb_steps);
+		pop->time += dt;
+	};
+
+	GIVEN("A row of people walking (and turning halfway through)") {
+		const float dt = 1.f / 60.f;
+		FOR_IN(s, 600) {
+			if (s == 300) {
+				set_actor_rotation(get_actor_id(1, &polled.actors), 0.5f, &polled.actors);
+				set_actor_rotation(get_actor_id(1, &scheduled.actors), 0.5f, &scheduled.actors);
+			}
+			step(dt, false, &polled);
+			step(dt, true, &scheduled);
+		}
+
+		THEN("the people have been walking") {
+			limb_id_t first_leg = polled.legs.limb[0];
+			CHECK(get_limb_end_effector_position(first_leg, &polled.limbs).x > 1);
+		}
+
+		THEN("following the schedule moves every foot just like polling does") {
+			REQUIRE(scheduled.limb_goals.num_rows == polled.limb_goals.num_rows);
+			FOR_ROWS(l, polled.limbs) {
+				CHECK(scheduled.limbs.end_effector[l] == polled.limbs.end_effector[l]);
+			}
+			CHECK(memcmp(&scheduled.limbs, &polled.limbs, sizeof(limb_table_t)) == 0);
+		}
+	}
+
+	GIVEN("A row of people walking (with feet sent back by hand now and then)") {
+		const float dt = 1.f / 60.f;
+		double max_wait_after_goal = 0;
+		unsigned num_sent_back = 0;
+		FOR_IN(s, 600) {
+			uint16_t leg = (s / 10) % polled.legs.num_rows;
+			bool send_back = (s % 10 == 5 && !has_limb_goal(polled.legs.limb[leg], &polled.limb_goals));
+			if (send_back) {
+				num_sent_back++;
+				// (Like setting an end effector goal from the world cursor, but fast)
+				limb_id_t limb = polled.legs.limb[leg];
+				vec3_t pos = vec3_add(get_limb_end_effector_position(limb, &polled.limbs), vec3(-1, 0, 0));
+				push_limb_goal(limb, pos, 20, 400, &polled.limb_goals);
+				push_limb_goal(limb, pos, 20, 400, &scheduled.limb_goals);
+			}
+			step(dt, false, &polled);
+			step(dt, true, &scheduled);
+			if (send_back) {
+				max_wait_after_goal = std::max(max_wait_after_goal, scheduled.gait.wake_time[leg] - scheduled.time);
+			}
+		}
+
+		THEN("legs with new goals are looked at again once they could be done") {
+			CHECK(num_sent_back > 0);
+			CHECK(max_wait_after_goal < 0.25);
+		}
+
+		THEN("following the schedule moves every foot just like polling does") {
+			REQUIRE(scheduled.limb_goals.num_rows == polled.limb_goals.num_rows);
+			CHECK(memcmp(&scheduled.limbs, &polled.limbs, sizeof(limb_table_t)) == 0);
+		}
+	}
+
+	GIVEN("A row of people walking, the first of them speeding up") {
+		const float dt = 1.f / 60.f;
+		FOR_IN(s, 100) { step(dt, true, &scheduled); }
+		double wake_before[2] = { scheduled.gait.wake_time[0], scheduled.gait.wake_time[1] };
+		set_actor_velocity(get_actor_id(0, &scheduled.actors), vec3(3, 0, 0), &scheduled.actors);
+		step(dt, true, &scheduled);
+
+		THEN("its legs are looked at again right away") {
+			REQUIRE(wake_before[0] > scheduled.time);
+			REQUIRE(wake_before[1] > scheduled.time);
+			CHECK(scheduled.gait.wake_time[0] != wake_before[0]);
+			CHECK(scheduled.gait.wake_time[1] != wake_before[1]);
+		}
+	}
+
+	GIVEN("A row of people walking with timed steps") {
+		polled.timed_steps = scheduled.timed_steps = true;
+		const float dt = 1.f / 60.f;
+		size_t max_num_steps = 0;
+		FOR_IN(s, 600) {
+			step(dt, false, &polled);
+			step(dt, true, &scheduled);
+			if (polled.limb_steps.num_rows > max_num_steps) { max_num_steps = polled.limb_steps.num_rows; }
+		}
+
+		THEN("the people have been stepping without any goals") {
+			CHECK(max_num_steps > 0);
+			CHECK(polled.limb_goals.num_rows == 0);
+		}
+
+		THEN("following the schedule moves every foot just like polling does") {
+			REQUIRE(scheduled.limb_steps.num_rows == polled.limb_steps.num_rows);
+			CHECK(memcmp(&scheduled.limbs, &polled.limbs, sizeof(limb_table_t)) == 0);
+		}
+	}
+}
+
+SCENARIO("Fused limb updates") {
+	static population_t phased, fused;
+	static terrain_table_t ground;
+	ground = terrain_table_t{};
+	create_terrain_block(4, 6, -10, 10, 0.25, &ground);
+
+	phased = population_t{};
+	init_limb_table(&phased.limbs);
+	FOR_IN(i, 4) {
+		actor_id_t actor = create_person(vec3(0, 3, 1.5f * i), 0, &phased);
+		set_actor_velocity(actor, vec3(1, 0, 0), &phased.actors);
+	}
+	phased.hold_hands = true;
+
+	// Like update_population(), but with the chosen way of updating limbs
+	static ik_budget_t budget;
+	budget = ik_budget_t{};
+	auto step = [&](float dt, population_t *pop) {
+		move_actors(dt, &pop->actors);
+		calculate_actor_transforms(&pop->actors);
+		build_actor_grid(actor_grid_cell_size, &pop->actors, &pop->actor_grid);
+		reposition_attached_limbs(&pop->arms, &pop->actors, &pop->limbs);
+		reposition_attached_limbs(&pop->legs, &pop->actors, &pop->limbs);
+		hold_hands_with_nearby_actors(&pop->actors, &pop->actor_grid, &pop->arms, &pop->limbs, &pop->limb_tip_links);
+		animation_env_i env = {
+			&pop->actors, &pop->arms, &pop->legs, &ground, &default_gait_params,
+			&pop->limbs, &pop->limb_goals, &pop->limb_steps, &pop->limb_tip_links,
+			&pop->gait, pop->time, pop->timed_steps
+		};
+		animate_scheduled_actor_legs(dt, &env);
+		keep_actors_actors_above_ground(3.0, &ground, &pop->actors);
+		limb_update_env_i limb_env = {
+			&pop->limbs, &pop->limb_swings, &pop->limb_goals, &pop->limb_steps,
+			&pop->limb_tip_links, vec3(0,-4,0), pop->time + dt, NULL, &budget
+		};
+		if (pop->fuse_limb_updates) { update_limbs_fused(dt, &limb_env); }
+		else { update_limbs_phase_by_phase(dt, &limb_env); }
+		pop->time += dt;
+	};
+
+	GIVEN("People holding hands and walking (with goals and then with timed steps)") {
+		fused = phased;
+		fused.fuse_limb_updates = true;
+		const float dt = 1.f / 60.f;
+		FOR_IN(s, 600) {
+			if (s == 300) { phased.timed_steps = fused.timed_steps = true; }
+			step(dt, &phased);
+			step(dt, &fused);
+		}
+
+		THEN("they have been holding hands") {
+			CHECK(phased.limb_tip_links.num_rows > 0);
+		}
+
+		THEN("every limb and swing is bit for bit the same") {
+			CHECK(memcmp(&fused.limbs, &phased.limbs, sizeof(limb_table_t)) == 0);
+			CHECK(memcmp(&fused.limb_swings, &phased.limb_swings, sizeof(limb_swing_table_t)) == 0);
+		}
+
+		THEN("so is every goal and step still around") {
+			// (Rows left behind by deletion may differ)
+			const limb_goal_table_t &g1 = fused.limb_goals, &g2 = phased.limb_goals;
+			REQUIRE(g1.num_rows == g2.num_rows);
+			FOR_ROWS(g, g1) {
+				CHECK(g1.dense_id[g].id == g2.dense_id[g].id);
+				CHECK(g1.curve_index[g] == g2.curve_index[g]);
+				CHECK(memcmp(&g1.velocity[g], &g2.velocity[g], sizeof(vec3_t)) == 0);
+			}
+			const limb_step_table_t &s1 = fused.limb_steps, &s2 = phased.limb_steps;
+			REQUIRE(s1.num_rows == s2.num_rows);
+			FOR_ROWS(i, s1) {
+				CHECK(s1.dense_id[i].id == s2.dense_id[i].id);
+				CHECK(s1.start_time[i] == s2.start_time[i]);
+			}
+		}
+	}
+
+	GIVEN("People holding hands and walking, with IK for only a few bones per step") {
+		budget.max_bones = 12;
+		fused = phased;
+		fused.fuse_limb_updates = true;
+		const float dt = 1.f / 60.f;
+		unsigned max_bones_moved = 0, num_linked_skips = 0;
+		FOR_IN(s, 300) {
+			step(dt, &phased);
+			step(dt, &fused);
+
+			// (Only the most important limb may go over budget on its own)
+			unsigned num_bones = 0, max_limb_bones = 0;
+			FOR_ROWS(l, fused.limbs) {
+				unsigned limb_bones = count_limb_bones(l, &fused.limbs);
+				if (fused.limbs.ik_passes[l] > 0) { num_bones += limb_bones; }
+				if (fused.limbs.ik_passes[l] > 0) { max_limb_bones = std::max(max_limb_bones, limb_bones); }
+				bool linked = limb_has_link(fused.limbs.dense_id[l], &fused.limb_tip_links);
+				if (linked && fused.limbs.ik_skipped_steps[l] > 0) { num_linked_skips++; }
+			}
+			if (num_bones > budget.max_bones) { num_bones -= max_limb_bones; }
+			max_bones_moved = std::max(max_bones_moved, num_bones);
+		}
+
+		THEN("linked limbs wait for their turn too") {
+			CHECK(fused.limb_tip_links.num_rows > 0);
+			CHECK(num_linked_skips > 0);
+			CHECK(max_bones_moved <= budget.max_bones);
+		}
+
+		THEN("every limb is bit for bit the same") {
+			CHECK(memcmp(&fused.limbs, &phased.limbs, sizeof(limb_table_t)) == 0);
+		}
+	}
+}
+
+SCENARIO("Generational ids") {
+	static population_t pop;
+	pop = population_t{};
+	init_limb_table(&pop.limbs);
+
+	GIVEN("A limb that has been deleted") {
+		limb_id_t first = create_limb(vec3(0, 0, 0), quat_identity, &pop.limbs);
+		add_bone_to_limb(first, vec3(0, 1, 0), &pop.limbs);
+		delete_limb(first, &pop.limbs);
+
+		THEN("its id is dead") {
+			CHECK_FALSE(limb_exists(first, &pop.limbs));
+		}
+
+		WHEN("another limb is created") {
+			limb_id_t second = create_limb(vec3(0, 0, 0), quat_identity, &pop.limbs);
+
+			THEN("it reuses the id as a new generation") {
+				CHECK(second.id == first.id);
+				CHECK(second.generation != first.generation);
+				CHECK(limb_exists(second, &pop.limbs));
+				CHECK_FALSE(limb_exists(first, &pop.limbs));
+			}
+		}
+
+		THEN("ids from far outside the table are not around either") {
+			limb_id_t bogus = { 60000, 0 };
+			CHECK_FALSE(limb_exists(bogus, &pop.limbs));
+		}
+	}
+
+	GIVEN("People coming and going for a long time") {
+		actor_id_t stayer = create_person(vec3(0, 3, 0), 0, &pop);
+		actor_id_t last_goer = stayer;
+		FOR_IN(i, 5000) {
+			actor_id_t goer = create_person(vec3(0, 3, 2), 0, &pop);
+			link_limb_to(pop.arms.limb[2], pop.arms.limb[0], &pop.limb_tip_links);
+			link_limb_to(pop.arms.limb[0], pop.arms.limb[2], &pop.limb_tip_links);
+			put_limb_goal(pop.legs.limb[2], vec3(1, 0, 2), 1, 1, &pop.limb_goals);
+			delete_person(goer, &pop);
+			last_goer = goer;
+		}
+
+		THEN("ids never run out and only the one who stayed is left") {
+			CHECK(pop.actors.num_rows == 1);
+			CHECK(pop.limbs.num_rows == 4);
+			CHECK(pop.arms.num_rows == 2);
+			CHECK(pop.legs.num_rows == 2);
+			CHECK(pop.limb_swings.num_rows == 2);
+			CHECK(pop.limb_goals.num_rows == 0);
+			CHECK(pop.limb_tip_links.num_rows == 0);
+			CHECK(actor_exists(stayer, &pop.actors));
+			CHECK_FALSE(actor_exists(last_goer, &pop.actors));
+		}
+
+		THEN("the rest still holds together") {
+			FOR_ROWS(la, pop.arms) { CHECK(limb_exists(pop.arms.limb[la], &pop.limbs)); }
+			limb_id_t arm = pop.arms.limb[0];
+			CHECK(get_limb_index(pop.limbs.paired_with[get_limb_index(arm, &pop.limbs)], &pop.limbs) < 4);
+			limb_update_env_i env = {
+				&pop.limbs, &pop.limb_swings, &pop.limb_goals, &pop.limb_steps,
+				&pop.limb_tip_links, vec3(0,-4,0), 0
+			};
+			update_limbs_fused(1.f / 60.f, &env);
+		}
+	}
+}
+
+SCENARIO("Link islands") {
+	static limb_table_t limbs, reordered;
+	static limb_link_table_t links, reordered_links;
+	init_limb_table(&limbs);
+	links = limb_link_table_t{};
+
+	// Bent arms reaching toward each other (two of them are linked to a third)
+	limb_id_t arms[5];
+	FOR_IN(i, 5) {
+		arms[i] = create_limb(vec3(1.5f * i, 2, 0), quat_identity, &limbs);
+		add_bone_to_limb(arms[i], vec3(1.5f * i, 1.2f, 0.6f), &limbs);
+		add_bone_to_limb(arms[i], vec3(1.5f * i, 0.4f, 0), &limbs);
+	}
+	link_limb_to(arms[0], arms[1], &links);
+	link_limb_to(arms[1], arms[0], &links);
+	link_limb_to(arms[2], arms[4], &links);
+	link_limb_to(arms[3], arms[4], &links);
+
+	GIVEN("The links") {
+		link_islands_t islands;
+		find_link_islands(&links, &limbs, &islands);
+
+		THEN("limbs linked directly or through others share an island") {
+			REQUIRE(islands.num_islands == 2);
+			CHECK(islands.island_start[1] - islands.island_start[0] == 2);
+			CHECK(islands.island_start[2] - islands.island_start[1] == 3);
+			CHECK(islands.island_of[get_limb_index(arms[0], &limbs)] == islands.island_of[get_limb_index(arms[1], &limbs)]);
+			CHECK(islands.island_of[get_limb_index(arms[2], &limbs)] == islands.island_of[get_limb_index(arms[3], &limbs)]);
+		}
+	}
+
+	WHEN("linked limbs move together") {
+		reordered = limbs;
+		FOR_IN(i, 3) {
+			move_linked_limbs_together(&links, &limbs);
+			move_limbs_directly_to_end_effectors(&limbs);
+		}
+
+		THEN("the tips of each island meet within a few steps") {
+			vec3_t tip_0 = get_limb_tip_position(arms[0], &limbs);
+			CHECK(vec3_distance(tip_0, get_limb_tip_position(arms[1], &limbs)) < 0.01f);
+			vec3_t tip_4 = get_limb_tip_position(arms[4], &limbs);
+			CHECK(vec3_distance(tip_4, get_limb_tip_position(arms[2], &limbs)) < 0.01f);
+			CHECK(vec3_distance(tip_4, get_limb_tip_position(arms[3], &limbs)) < 0.01f);
+		}
+
+		THEN("the order of the links makes no difference") {
+			reordered_links = limb_link_table_t{};
+			for (int l = links.num_rows - 1; l >= 0; l--) {
+				link_limb_to(links.dense_id[l], links.other_limb[l], &reordered_links);
+			}
+			FOR_IN(i, 3) {
+				move_linked_limbs_together(&reordered_links, &reordered);
+				move_limbs_directly_to_end_effectors(&reordered);
+			}
+			CHECK(memcmp(&reordered, &limbs, sizeof(limb_table_t)) == 0);
+		}
+	}
+}
+
+SCENARIO("Limb swing") {
+	static limb_table_t limbs;
+	static limb_swing_table_t swings;
+	init_limb_table(&limbs);
+	swings = limb_swing_table_t{};
+	const float dt = 1.f / 60.f;
+	const vec3_t gravity = vec3(0, -10, 0);
+
+	GIVEN("An arm held out straight to the side") {
+		limb_id_t arm = create_limb(vec3(0, 2, 0), quat_identity, &limbs);
+		uint16_t upper = add_bone_to_limb(arm, vec3(1, 2, 0), &limbs);
+		add_bone_to_limb(arm, vec3(2, 2, 0), &limbs);
+		create_limb_swing(arm, &limbs, &swings);
+
+		WHEN("it is let go") {
+			FOR_IN(i, 30) { swing_limbs(dt, gravity, &swings, &limbs); }
+			vec3_t elbow = get_bone_tip_position(upper, &limbs);
+			vec3_t tip = get_limb_tip_position(arm, &limbs);
+
+			THEN("it falls without coming apart") {
+				CHECK(tip.y < 1.5f);
+				CHECK(vec3_distance(vec3(0, 2, 0), elbow) == Approx(1).epsilon(0.01));
+				CHECK(vec3_distance(elbow, tip) == Approx(1).epsilon(0.01));
+				CHECK(vec3_distance(get_limb_end_effector_position(arm, &limbs), tip) < 0.001f);
+			}
+		}
+	}
+
+	GIVEN("An arm hanging straight down") {
+		limb_id_t arm = create_limb(vec3(0, 2, 0), quat_identity, &limbs);
+		add_bone_to_limb(arm, vec3(0, 1, 0), &limbs);
+		add_bone_to_limb(arm, vec3(0, 0, 0), &limbs);
+		create_limb_swing(arm, &limbs, &swings);
+
+		WHEN("nothing moves it") {
+			FOR_IN(i, 60) { swing_limbs(dt, gravity, &swings, &limbs); }
+
+			THEN("it stays put") {
+				CHECK(vec3_distance(get_limb_tip_position(arm, &limbs), vec3(0, 0, 0)) < 0.01f);
+			}
+		}
+
+		WHEN("its root is carried along") {
+			limbs.position[get_limb_index(arm, &limbs)] = vec3(0.5, 2, 0);
+			swing_limbs(dt, gravity, &swings, &limbs);
+
+			THEN("the hand lags behind (and then swings back and forth)") {
+				float x = get_limb_tip_position(arm, &limbs).x;
+				CHECK(x < 0.5f);
+				bool passed_root = false;
+				FOR_IN(i, 120) {
+					swing_limbs(dt, gravity, &swings, &limbs);
+					passed_root |= get_limb_tip_position(arm, &limbs).x > 0.5f;
+				}
+				CHECK(passed_root);
+			}
+		}
+	}
+}
+
+SCENARIO("Timed steps") {
+	static limb_step_table_t steps;
+	static limb_table_t limbs;
+	steps = limb_step_table_t{};
+	init_limb_table(&limbs);
+	limb_id_t limb = create_limb(vec3(0, 1, 0), quat_identity, &limbs);
+	add_bone_to_limb(limb, vec3(0, 0, 0), &limbs);
+
+	GIVEN("A step over a bump, starting a second in") {
+		const vec3_t points[] = { vec3(0, 0, 0), vec3(0, 1, 0), vec3(2, 1, 0), vec3(2, 0, 0) };
+		put_limb_step(limb, 1.0, 0.5f, points, &steps);
+		REQUIRE(has_limb_step(limb, &steps));
+
+		THEN("the foot follows the curve by time alone") {
+			CHECK(get_limb_step_position(0, 0.5, &steps) == points[0]);
+			CHECK(get_limb_step_position(0, 1.25, &steps) == vec3(1, 0.75f, 0));
+			CHECK(get_limb_step_position(0, 9.0, &steps) == points[3]);
+			CHECK(get_limb_step_time_left(limb, 1.25, &steps) == Approx(0.25));
+		}
+
+		WHEN("the end effector is moved along in small and big updates") {
+			FOR_IN(i, 10) { move_limbs_along_steps(1.0 + 0.03 * i, &steps, &limbs); }
+			move_limbs_along_steps(1.3, &steps, &limbs);
+			vec3_t small = get_limb_end_effector_position(limb, &limbs);
+			move_limbs_along_steps(1.05, &steps, &limbs);
+			move_limbs_along_steps(1.3, &steps, &limbs);
+			vec3_t big = get_limb_end_effector_position(limb, &limbs);
+
+			THEN("it ends up at the exact same place") {
+				CHECK(memcmp(&small, &big, sizeof(vec3_t)) == 0);
+			}
+		}
+
+		WHEN("the time is up") {
+			delete_finished_limb_steps(1.4, &steps);
+			THEN("the step is kept until then") { CHECK(has_limb_step(limb, &steps)); }
+
+			delete_finished_limb_steps(1.5, &steps);
+			THEN("it's deleted without looking at the foot") { CHECK(!has_limb_step(limb, &steps)); }
+		}
+	}
+}
+
+SCENARIO("Actor grid") {
+	static actor_table_t actors;
+	static actor_grid_t grid;
+	actors = actor_table_t{};
+
+	GIVEN("Actors scattered around (some far away)") {
+		FOR_IN(i, 100) {
+			float x = (float) ((i * 37) % 41) - 20.f;
+			float z = (float) ((i * 53) % 29) - 14.f;
+			create_actor(vec3(x, 3, z), 0, &actors);
+		}
+		create_actor(vec3(500, 3, -500), 0, &actors);
+		build_actor_grid(actor_grid_cell_size, &actors, &grid);
+
+		THEN("a radius query finds exactly the actors within the radius") {
+			vec3_t pos = vec3(1.5f, 3, -2.5f);
+			float radius = 6.f;
+			uint16_t found[max_actor_table_rows];
+			size_t num_found = find_actors_within(pos, radius, &actors, &grid, found, max_actor_table_rows);
+
+			size_t num_expected = 0;
+			FOR_ROWS(a, actors) {
+				bool within = vec3_distance(actors.location[a].position, pos) <= radius;
+				num_expected += within;
+				size_t times_found = 0;
+				for (size_t f = 0; f < num_found; f++) { times_found += (found[f] == a); }
+				CHECK(times_found == (within ? 1 : 0));
+			}
+			CHECK(num_found == num_expected);
+		}
+
+		THEN("a k-nearest query finds the closest actors, closest first") {
+			vec3_t pos = vec3(-3.f, 3, 7.f);
+			uint16_t nearest[5];
+			REQUIRE(find_nearest_actors(pos, 5, &actors, &grid, nearest) == 5);
+
+			float kth_distance = vec3_distance(actors.location[nearest[4]].position, pos);
+			size_t num_closer = 0;
+			FOR_ROWS(a, actors) {
+				num_closer += (vec3_distance(actors.location[a].position, pos) < kth_distance);
+			}
+			CHECK(num_closer <= 4);
+			FOR_RANGE(i, 1, 5) {
+				CHECK(vec3_distance(actors.location[nearest[i-1]].position, pos) <=
+					vec3_distance(actors.location[nearest[i]].position, pos));
+			}
+		}
+
+		THEN("the far away actor can still be found") {
+			uint16_t nearest[1];
+			REQUIRE(find_nearest_actors(vec3(400, 3, -400), 1, &actors, &grid, nearest) == 1);
+			CHECK(nearest[0] == 100);
+		}
+	}
+}
+
+SCENARIO("Hand holding") {
+	static population_t pop;
+	pop = population_t{};
+	init_limb_table(&pop.limbs);
+
+	GIVEN("A row of people side by side (and one far away)") {
+		FOR_IN(i, 3) { create_person(vec3(0, 3, 2.5f * i), 0, &pop); }
+		create_person(vec3(100, 3, 0), 0, &pop);
+		build_actor_grid(actor_grid_cell_size, &pop.actors, &pop.actor_grid);
+
+		WHEN("they look for hands to hold") {
+			hold_hands_with_nearby_actors(&pop.actors, &pop.actor_grid, &pop.arms, &pop.limbs, &pop.limb_tip_links);
+
+			THEN("neighbours hold hands (both ways)") {
+				CHECK(pop.limb_tip_links.num_rows == 4);
+				FOR_ROWS(l, pop.limb_tip_links) {
+					limb_id_t limb = pop.limb_tip_links.dense_id[l];
+					limb_id_t other = pop.limb_tip_links.other_limb[l];
+					REQUIRE(limb_has_link(other, &pop.limb_tip_links));
+					CHECK(pop.limb_tip_links.other_limb[pop.limb_tip_links.sparse_id[other.id]].id == limb.id);
+				}
+			}
+
+			THEN("the one far away holds no hands") {
+				CHECK_FALSE(limb_has_link(pop.arms.limb[6], &pop.limb_tip_links));
+				CHECK_FALSE(limb_has_link(pop.arms.limb[7], &pop.limb_tip_links));
+			}
+
+			AND_WHEN("one of them walks away") {
+				pop.actors.location[0].position = vec3(-50, 3, 0);
+				calculate_actor_transforms(&pop.actors);
+				reposition_attached_limbs(&pop.arms, &pop.actors, &pop.limbs);
+				build_actor_grid(actor_grid_cell_size, &pop.actors, &pop.actor_grid);
+				hold_hands_with_nearby_actors(&pop.actors, &pop.actor_grid, &pop.arms, &pop.limbs, &pop.limb_tip_links);
+
+				THEN("they let go of each other") {
+					CHECK_FALSE(limb_has_link(pop.arms.limb[0], &pop.limb_tip_links));
+					CHECK_FALSE(limb_has_link(pop.arms.limb[1], &pop.limb_tip_links));
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("Batch runs") {
+	const int num_worlds = 5;
+	static world_t worlds[num_worlds], alone[num_worlds];
+
+	GIVEN("Rows of walking actors with different step heights") {
+		FOR_IN(w, num_worlds) {
+			worlds[w] = world_t{};
+			init_world(am_actor_row, &worlds[w].landscape, &worlds[w].population);
+			worlds[w].landscape.gait_params.step_height = 0.25f + 0.125f * w;
+			alone[w] = worlds[w];
+		}
+
+		WHEN("they are run as a batch (on more than one thread)") {
+			run_worlds(worlds, num_worlds, 150, 1.f/60.f, 3);
+
+			THEN("every world took every step") {
+				FOR_IN(w, num_worlds) {
+					CHECK(worlds[w].result.num_steps == 150);
+					CHECK(worlds[w].result.sim_time == Approx(2.5));
+					CHECK(worlds[w].result.num_actors == worlds[w].population.actors.num_rows);
+					CHECK(worlds[w].result.mean_actor_position.x > 0);
+				}
+			}
+
+			THEN("each world ends up as if it was stepped on its own") {
+				FOR_IN(w, num_worlds) {
+					step_world(150, 1.f/60.f, &alone[w]);
+					CHECK(worlds[w].result.checksum == hash_population(&alone[w].population));
+				}
+			}
+
+			THEN("step heights make a difference") {
+				CHECK(worlds[0].result.checksum != worlds[num_worlds - 1].result.checksum);
+			}
+		}
+	}
+}
+
+SCENARIO("Input recording") {
+	const char *path = "test_input_recording.bin";
+
+	GIVEN("Some commands recorded between steps") {
+		input_command_t commands[] = {
+			{ ic_toggle_hand_holding },
+			{ ic_tank_controls, .actor = { 1, 2 }, .dt = 1.f/144.f, .vec = vec3(1, -1, 0) },
+			{ ic_none },
+			{ ic_move_cursor, .vec = vec3(0.25f, -0.5f, 1e-3f) },
+			{ ic_step_back, .count = 10 },
+		};
+		uint64_t steps[] = { 0, 0, 3, 300, 70000 };
+
+		input_recording_t recording;
+		REQUIRE(start_input_recording(path, am_actor_row, &recording));
+		FOR_IN(i, 5) { record_input_command(steps[i], &commands[i], &recording); }
+		CHECK(recording.num_records == 4);
+		REQUIRE(stop_input_recording(70042, &recording));
+
+		WHEN("it is replayed") {
+			input_replay_t replay;
+			REQUIRE(open_input_replay(path, &replay));
+			CHECK(replay.mode == am_actor_row);
+
+			THEN("the same commands come back (without the empty one) at the same steps") {
+				input_command_t c;
+				FOR_IN(i, 5) {
+					if (commands[i].type == ic_none) { continue; }
+					REQUIRE(read_input_record(&replay, &c));
+					CHECK(replay.step == steps[i]);
+					CHECK(c.type == commands[i].type);
+					CHECK(c.count == commands[i].count);
+					CHECK(c.actor.id == commands[i].actor.id);
+					CHECK(c.actor.generation == commands[i].actor.generation);
+					CHECK(c.dt == commands[i].dt);
+					CHECK(c.vec == commands[i].vec);
+				}
+				CHECK_FALSE(read_input_record(&replay, &c));
+				CHECK(replay.step == 70042);
+			}
+			close_input_replay(&replay);
+		}
+	}
+
+	GIVEN("A file that is not a recording") {
+		FILE *file = fopen(path, "wb");
+		fputs("Hello!", file);
+		fclose(file);
+
+		THEN("it is not replayed") {
+			input_replay_t replay;
+			CHECK_FALSE(open_input_replay(path, &replay));
+		}
+	}
+	remove(path);
+}
+
+SCENARIO("Fast math") {
+	GIVEN("The approximations") {
+		THEN("1/sqrt is close over many orders of magnitude") {
+			float worst = 0;
+			for (float x = 1e-6f; x < 1e6f; x *= 1.01f) {
+				double exact = 1 / sqrt((double) x);
+				worst = maxf(worst, (float) (fabs(fast_rsqrtf(x) - exact) / exact));
+			}
+			CHECK(worst < 5e-7f);
+		}
+
+		THEN("atan2 is close all the way around") {
+			float worst = 0;
+			for (float r : { 1e-3f, 1.f, 1e3f }) {
+				FOR_IN(i, 3600) {
+					double a = i * (2 * M_PI / 3600) - M_PI;
+					float x = r * (float) cos(a), y = r * (float) sin(a);
+					worst = maxf(worst, (float) fabs(fast_atan2f(y, x) - atan2((double) y, (double) x)));
+				}
+			}
+			CHECK(worst < 3e-6f);
+			CHECK(fast_atan2f(0, 0) == 0);
+		}
+
+		THEN("sine and cosine are close within four turns") {
+			float worst = 0;
+			for (float a = -4 * tau; a < 4 * tau; a += 0.001f) {
+				float s, c;
+				fast_sincosf(a, &s, &c);
+				worst = maxf(worst, (float) fabs(s - sin((double) a)));
+				worst = maxf(worst, (float) fabs(c - cos((double) a)));
+			}
+			CHECK(worst < 1e-6f);
+		}
+	}
+
+	GIVEN("A robot arm with hinged joints (in whichever math mode this is built with)") {
+		static limb_table_t limbs;
+		init_limb_table(&limbs);
+		limb_id_t robot = create_limb(vec3_origo, quat_identity, &limbs);
+		uint16_t bones[4];
+		FOR_IN(i, 4) {
+			bones[i] = add_bone_to_limb(robot, vec3(0, 3 * (i + 1), 0), &limbs);
+			apply_hinge_constraint(bones[i], -pi/2, +pi/2, &limbs);
+		}
+
+		WHEN("it reaches for target after target") {
+			const vec3_t targets[] = { vec3(4, 6, 0), vec3(-5, 3, 0), vec3(2, 9, 0), vec3(0, 11.5f, 0) };
+			float worst_miss = 0, worst_stretch = 0, worst_twist = 0;
+			FOR_IN(round, 50) {
+				for (vec3_t target : targets) {
+					move_limb_directly_to(robot, target, &limbs);
+					worst_miss = maxf(worst_miss, vec3_distance(get_limb_tip_position(robot, &limbs), target));
+					FOR_IN(i, 4) {
+						vec3_t joint = get_bone_joint_position(bones[i], &limbs);
+						vec3_t tip = get_bone_tip_position(bones[i], &limbs);
+						worst_stretch = maxf(worst_stretch, fabsf(vec3_distance(joint, tip) - 3));
+						const quat_t q = limbs.bones[bones[i]].orientation;
+						worst_twist = maxf(worst_twist, fabsf(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w - 1));
+					}
+				}
+			}
+
+			THEN("it stays within tolerance") {
+				CHECK(worst_miss < 0.1f);
+				CHECK(worst_stretch < 1e-4f);
+				CHECK(worst_twist < 1e-4f);
+			}
+		}
+	}
+}
+
+SCENARIO("IK pool") {
+	ik_pool_t *pool = create_ik_pool(3);
+	CHECK(get_ik_pool_threads(pool) == 3);
+
+	GIVEN("A limb forest with end effectors out of reach and within") {
+		static landscape_t land;
+		static population_t pop;
+		static limb_table_t serial;
+		pop = population_t{};
+		init_world(am_limb_forest, &land, &pop);
+		uint16_t all[max_limb_table_rows];
+		FOR_ROWS(l, pop.limbs) {
+			all[l] = l;
+			pop.limbs.end_effector[l] = vec3_add(pop.limbs.position[l], vec3(l % 3, 1 + l % 7, 1));
+		}
+		serial = pop.limbs;
+
+		WHEN("it is moved by the pool and on a single thread") {
+			move_limbs_to_end_effectors_in_parallel(pool, all, pop.limbs.num_rows, &pop.limbs);
+			move_limbs_directly_to_end_effectors(&serial);
+
+			THEN("every bone ends up exactly the same") {
+				CHECK(memcmp(pop.limbs.bones, serial.bones, sizeof(serial.bones)) == 0);
+			}
+		}
+	}
+
+	GIVEN("Two rows of actors holding hands, one doing IK on the pool") {
+		static world_t worlds[2];
+		FOR_IN(w, 2) {
+			worlds[w] = world_t{};
+			init_world(am_actor_row, &worlds[w].landscape, &worlds[w].population);
+			worlds[w].population.hold_hands = true;
+		}
+		worlds[1].population.ik_pool = pool;
+
+		WHEN("both take the same steps (fused and phase by phase)") {
+			step_world(60, 1.f/60.f, &worlds[0]);
+			step_world(60, 1.f/60.f, &worlds[1]);
+			FOR_IN(w, 2) { worlds[w].population.fuse_limb_updates = false; }
+			step_world(60, 1.f/60.f, &worlds[0]);
+			step_world(60, 1.f/60.f, &worlds[1]);
+
+			THEN("they end up the same") {
+				CHECK(hash_population(&worlds[0].population) == hash_population(&worlds[1].population));
+				CHECK(memcmp(worlds[0].population.limbs.bones, worlds[1].population.limbs.bones,
+					sizeof(worlds[0].population.limbs.bones)) == 0);
+			}
+		}
+	}
+	destroy_ik_pool(pool);
+}
+
+SCENARIO("IK metrics") {
+	static limb_table_t limbs;
+	init_limb_table(&limbs);
+
+	GIVEN("A free arm and a hinged arm") {
+		limb_id_t free_arm = create_limb(vec3_origo, quat_identity, &limbs);
+		add_bone_to_limb(free_arm, vec3(1,0,0), &limbs);
+		add_bone_to_limb(free_arm, vec3(2,0,0), &limbs);
+		limb_id_t hinged_arm = create_limb(vec3(0,5,0), quat_identity, &limbs);
+		uint16_t bone = add_bone_to_limb(hinged_arm, vec3(1,5,0), &limbs);
+		apply_hinge_constraint(bone, -pi/4, pi/4, &limbs);
+
+		WHEN("one reaches within range and the other beyond its hinge") {
+			move_limb_directly_to(free_arm, vec3(1,1,0), &limbs);
+			move_limb_directly_to(hinged_arm, vec3(0,6,0), &limbs);
+			uint16_t f = get_limb_index(free_arm, &limbs), h = get_limb_index(hinged_arm, &limbs);
+
+			THEN("the residuals say how far each tip is from its target") {
+				CHECK(limbs.ik_residual[f] < 0.001f);
+				CHECK(limbs.ik_residual[h] == Approx(vec3_distance(get_limb_tip_position(hinged_arm, &limbs), vec3(0,6,0))));
+				CHECK(limbs.ik_residual[h] > 0.5f);
+			}
+
+			THEN("only the hinged arm was clamped") {
+				CHECK(limbs.ik_clamps[f] == 0);
+				CHECK(limbs.ik_clamps[h] > 0);
+			}
+
+			THEN("the passes say how soon each tip got close enough (if it ever did)") {
+				CHECK(limbs.ik_passes[f] > 0);
+				CHECK(limbs.ik_passes[f] < limbs.ik_passes[h]);
+				CHECK(limbs.ik_passes[h] <= max_ik_passes);
+			}
+
+			AND_WHEN("the metrics are collected") {
+				ik_metrics_t m;
+				limbs.end_effector[f] = vec3(1,1,0);
+				limbs.end_effector[h] = vec3(0,6,0);
+				collect_ik_metrics(7, 0.5, &limbs, &m);
+
+				THEN("every limb is in every histogram once") {
+					unsigned num_r = 0, num_c = 0, num_p = 0;
+					FOR_IN(b, num_ik_residual_buckets) { num_r += m.residual_histogram[b]; }
+					FOR_IN(b, num_ik_clamp_buckets) { num_c += m.clamp_histogram[b]; }
+					FOR_IN(p, max_ik_passes + 1) { num_p += m.pass_histogram[p]; }
+					CHECK(m.num_limbs == 2);
+					CHECK(num_r == 2);
+					CHECK(num_c == 2);
+					CHECK(num_p == 2);
+					CHECK(m.clamp_histogram[0] == 1);
+					CHECK(m.max_residual == limbs.ik_residual[h]);
+					CHECK(m.num_passes == (unsigned) limbs.ik_passes[f] + limbs.ik_passes[h]);
+					CHECK(m.pass_histogram[limbs.ik_passes[f]] == 1);
+					CHECK(m.pass_histogram[limbs.ik_passes[h]] == 1);
+				}
+
+				THEN("they are written to CSV with as many values as columns") {
+					FILE *file = tmpfile();
+					write_ik_metrics_csv_header(file);
+					write_ik_metrics_csv_row(&m, file);
+					rewind(file);
+					char header[2048], row[2048];
+					REQUIRE(fgets(header, sizeof(header), file));
+					REQUIRE(fgets(row, sizeof(row), file));
+					fclose(file);
+					CHECK(std::count(header, header + strlen(header), ',') == std::count(row, row + strlen(row), ','));
+					CHECK(strncmp(row, "7,0.5", 5) == 0);
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("Memory report") {
+	static landscape_t land;
+	static population_t pop;
+	land = landscape_t{};
+	pop = population_t{};
+	init_world(am_actor_row, &land, &pop);
+
+	GIVEN("A row of actors") {
+		memory_report_t report;
+		report_memory(&pop, &report);
+
+		THEN("every table is reported with its rows and capacity") {
+			REQUIRE(report.num_tables > 0);
+			CHECK(report.tables[0].num_rows == pop.actors.num_rows);
+			CHECK(report.tables[1].num_rows == pop.limbs.num_rows);
+			for (size_t t = 0; t < report.num_tables; t++) {
+				CHECK(report.tables[t].num_rows <= report.tables[t].peak_rows);
+				CHECK(report.tables[t].peak_rows <= report.tables[t].capacity);
+			}
+		}
+
+		THEN("bone nodes in use are those of the limbs") {
+			unsigned num_bones = 0;
+			bone_t bones[32];
+			FOR_ROWS(l, pop.limbs) { num_bones += collect_bones(pop.limbs.dense_id[l], &pop.limbs, bones, 32); }
+			CHECK(report.num_bone_nodes_used == num_bones);
+			CHECK(report.num_bone_nodes_used + report.num_bone_nodes_free == max_limb_table_segnemts - 1);
+		}
+
+		WHEN("an actor is deleted") {
+			uint16_t num_actors = pop.actors.num_rows;
+			unsigned used_before = report.num_bone_nodes_used;
+			delete_person(pop.actors.dense_id[0], &pop);
+			report_memory(&pop, &report);
+
+			THEN("rows go down but the peak stays") {
+				CHECK(report.tables[0].num_rows == num_actors - 1);
+				CHECK(report.tables[0].peak_rows == num_actors);
+				CHECK(report.num_bone_nodes_used < used_before);
+			}
+		}
+	}
+}
+
+SCENARIO("IK budget") {
+	static landscape_t land;
+	static population_t pop;
+	static limb_table_t unlimited;
+	land = landscape_t{};
+	pop = population_t{};
+	init_world(am_limb_forest, &land, &pop);
+	limb_table_t *limbs = &pop.limbs;
+	const limb_goal_table_t *goals = &pop.limb_goals;
+	const limb_step_table_t *steps = &pop.limb_steps;
+
+	uint16_t all[max_limb_table_rows];
+	FOR_ROWS(l, *limbs) {
+		all[l] = l;
+		limbs->end_effector[l] = vec3_add(limbs->position[l], vec3(0.5f, 1, 0.5f));
+	}
+	unlimited = *limbs;
+
+	GIVEN("No limits") {
+		ik_budget_t budget = {};
+		CHECK_FALSE(is_ik_budget_limited(&budget));
+
+		THEN("every limb is moved, just like without a budget") {
+			move_limbs_to_end_effectors_within_budget(&budget, all, limbs->num_rows, goals, steps, NULL, limbs);
+			move_limbs_directly_to_end_effectors(&unlimited);
+			CHECK(memcmp(limbs->bones, unlimited.bones, sizeof(unlimited.bones)) == 0);
+		}
+	}
+
+	GIVEN("A budget of 20 bones per step") {
+		ik_budget_t budget = {};
+		budget.max_bones = 20;
+
+		AND_GIVEN("one limb far from its end effector") {
+			uint16_t far = 7;
+			limbs->end_effector[far] = vec3_add(limbs->position[far], vec3(0, 0, 40));
+
+			WHEN("a step is taken") {
+				move_limbs_to_end_effectors_within_budget(&budget, all, limbs->num_rows, goals, steps, NULL, limbs);
+
+				THEN("that limb goes first and the rest that fit follow") {
+					CHECK(limbs->ik_passes[far] > 0);
+					unsigned num_bones = 0, num_moved = 0;
+					FOR_ROWS(l, *limbs) {
+						if (limbs->ik_passes[l] == 0) {
+							CHECK(limbs->ik_skipped_steps[l] == 1);
+							continue;
+						}
+						num_bones += count_limb_bones(l, limbs);
+						num_moved++;
+					}
+					CHECK((num_bones <= budget.max_bones || num_moved == 1));
+					CHECK(num_moved < limbs->num_rows);
+				}
+			}
+		}
+
+		WHEN("enough steps are taken") {
+			bool moved[max_limb_table_rows] = {};
+			FOR_IN(step, 60) {
+				move_limbs_to_end_effectors_within_budget(&budget, all, limbs->num_rows, goals, steps, NULL, limbs);
+				FOR_ROWS(l, *limbs) { moved[l] |= (limbs->ik_passes[l] > 0); }
+			}
+
+			THEN("every limb has had its turn") {
+				FOR_ROWS(l, *limbs) {
+					CHECK(moved[l]);
+					CHECK(limbs->ik_skipped_steps[l] < 60);
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("Limb tip cache") {
+	static landscape_t land;
+	static population_t pop, before, halfway;
+	land = landscape_t{};
+	pop = population_t{};
+	init_world(am_actor_row, &land, &pop);
+
+	// Tips as worked out from the bones themselves
+	auto check_tips = [](const limb_table_t *limbs) {
+		FOR_ROWS(l, *limbs) {
+			uint16_t root_bone = limbs->root_bone[l];
+			vec3_t tip = limbs->position[l];
+			for (uint16_t b = root_bone; b; ) {
+				tip = get_bone_tip(limbs->bones[b]);
+				CHECK(vec3_distance(get_bone_tip_position(b, limbs), tip) < 1e-4f);
+				b = limbs->bone_nodes[b].next_index;
+				if (b == root_bone) { b = 0; }
+			}
+			CHECK(vec3_distance(get_limb_tip_position(limbs->dense_id[l], limbs), tip) < 1e-4f);
+		}
+	};
+
+	GIVEN("A row of walking actors") {
+		THEN("tips are known from the start") {
+			check_tips(&pop.limbs);
+		}
+
+		WHEN("they walk for a while") {
+			FOR_IN(i, 30) { update_population(1 / 60.f, &land, &pop); }
+			before = pop;
+			update_population(1 / 60.f, &land, &pop);
+
+			THEN("tips follow the bones") {
+				check_tips(&pop.limbs);
+			}
+
+			AND_WHEN("a frame in between steps is interpolated") {
+				interpolate_population(0.5f, &before, &pop, &halfway);
+
+				THEN("its tips follow the interpolated bones") {
+					check_tips(&halfway.limbs);
+				}
+			}
+
+			AND_WHEN("an actor is deleted") {
+				delete_person(pop.actors.dense_id[0], &pop);
+
+				THEN("tips move along with the rows of the limbs") {
+					check_tips(&pop.limbs);
+				}
+			}
+		}
+	}
+}
+
+SCENARIO("Terrain streaming") {
+	static landscape_t land;
+	static actor_table_t actors;
+	land = landscape_t{};
+	actors = actor_table_t{};
+	create_some_terrain(&land);
+
+	// 8 x 8 tiles of 4 x 4 m (sampled every 0.5 m), from (-16,-16) to (+16,+16)
+	const char *path = "terrain_streaming_test.tiles";
+	REQUIRE(bake_terrain_tiles(path, &land.ground, -16, -16, 4, 8, 8, 9));
+	const size_t tile_bytes = 9 * 9 * sizeof(float);
+
+	GIVEN("A stream with room for 4 tiles") {
+		terrain_stream_t *stream = open_terrain_stream(path, 2, 4 * tile_bytes);
+		REQUIRE(stream);
+		set_terrain_stream_blocking(true, stream);
+		terrain_table_t ground = {};
+		ground.stream = stream;
+
+		THEN("tiles that are not loaded read as their mean height") {
+			CHECK_FALSE(is_terrain_tile_resident(5, 1, stream));
+			float h = get_terrain_height(5, 1, &ground);
+			CHECK(h > 0.f);
+			CHECK(h < 0.25f);
+			CHECK(get_terrain_height(-100, 0, &ground) == 0.f);
+		}
+
+		WHEN("an actor stands on the stairs") {
+			create_actor(vec3(5, 3, 1), 0, &actors);
+			stream_terrain_around_actors(&actors, stream);
+
+			THEN("the ground around it is loaded, and as high as the blocks") {
+				CHECK(is_terrain_tile_resident(5, 1, stream));
+				CHECK(get_terrain_height(5, 1, &ground) == Approx(0.10f));
+				CHECK(get_terrain_height(7, 1, &ground) == Approx(0.25f));
+				CHECK(get_terrain_height(5, 1, &ground) == Approx(get_terrain_height(5, 1, &land.ground)));
+			}
+
+			AND_WHEN("it walks far away") {
+				actors.location[0].position = vec3(-13, 3, -13);
+				stream_terrain_around_actors(&actors, stream);
+
+				THEN("tiles it left are released to stay within the budget") {
+					terrain_stream_stats_t stats;
+					get_terrain_stream_stats(stream, &stats);
+					CHECK(stats.max_resident_tiles == 4);
+					CHECK(stats.num_resident_tiles <= 4);
+					CHECK(stats.resident_bytes <= stats.memory_budget);
+					CHECK(stats.num_releases > 0);
+					CHECK(is_terrain_tile_resident(-13, -13, stream));
+					CHECK_FALSE(is_terrain_tile_resident(5, 1, stream));
+				}
+			}
+		}
+
+		close_terrain_stream(stream);
+	}
+
+	GIVEN("A budget too small for a single tile") {
+		THEN("the terrain can not be streamed") {
+			CHECK(open_terrain_stream(path, 2, tile_bytes - 1) == NULL);
+		}
+	}
+
+	GIVEN("A file that is no terrain file") {
+		FILE *file = fopen(path, "wb");
+		fputs("Not terrain", file);
+		fclose(file);
+
+		THEN("it can not be streamed from") {
+			CHECK(open_terrain_stream(path, 1, 1024 * 1024) == NULL);
+		}
+	}
+
+	std::remove(path);
+}
+
+SCENARIO("Gait poses") {
+	static gait_pose_table_t poses;
+	static landscape_t land;
+	static population_t pop;
+	const float speeds[] = { 0.5f, 1.0f, 1.5f };
+	REQUIRE(bake_gait_poses(&default_gait_params, speeds, 3, 1 / 60.f, &poses));
+
+	THEN("a whole cycle was baked at every speed") {
+		CHECK(poses.num_speeds == 3);
+		CHECK(poses.num_legs == 2);
+		FOR_IN(s, poses.num_speeds) { CHECK(poses.period[s] > 0.f); }
+		CHECK(poses.reach > 0.f);
+	}
+
+	GIVEN("Actors walking on flat ground, far from the focus") {
+		land = landscape_t{};
+		pop = population_t{};
+		init_limb_table(&pop.limbs);
+		FOR_IN(i, 3) {
+			actor_id_t actor = create_person(vec3(0, 3, 2.5f * i), 0, &pop);
+			set_actor_velocity(actor, vec3(0.5f + 0.5f * i, 0, 0), &pop.actors);
+		}
+		pop.gait_playback.poses = &poses;
+		pop.gait_playback.focus = vec3(0, 0, -100);
+		pop.gait_playback.focus_radius = 10;
+
+		AND_GIVEN("a block next to the last one") {
+			create_terrain_block(-1, 40, 4.5f, 5.5f, 0.25f, &land.ground);
+			FOR_IN(i, 60) { update_population(1 / 60.f, &land, &pop); }
+
+			THEN("the others are posed, but it steps its legs") {
+				CHECK(pop.gait.posed[0]);
+				CHECK(pop.gait.posed[1]);
+				CHECK_FALSE(pop.gait.posed[2]);
+			}
+
+			THEN("posed legs reach their tips without IK") {
+				FOR_ROWS(l, pop.limbs) {
+					if (!pop.limbs.posed[l]) { continue; }
+					CHECK(pop.limbs.ik_passes[l] == 0);
+					CHECK(vec3_distance(pop.limbs.tip_position[l], pop.limbs.end_effector[l]) < 1e-5f);
+				}
+			}
+
+			AND_WHEN("the focus comes near") {
+				pop.gait_playback.focus = vec3(0, 0, 0);
+				pop.gait_playback.focus_radius = 100;
+				bool stepped = false;
+				FOR_IN(i, 60) {
+					update_population(1 / 60.f, &land, &pop);
+					stepped |= (pop.limb_goals.num_rows + pop.limb_steps.num_rows > 0);
+				}
+
+				THEN("every leg is stepped again") {
+					FOR_ROWS(a, pop.actors) { CHECK_FALSE(pop.gait.posed[a]); }
+					FOR_ROWS(l, pop.limbs) { CHECK_FALSE(pop.limbs.posed[l]); }
+					CHECK(stepped);
+				}
+			}
+		}
+
+		AND_GIVEN("two more legs on the first one") {
+			actor_id_t actor = get_actor_id(0, &pop.actors);
+			FOR_IN(i, 2) {
+				vec3_t root = vec3(0, 2, 0.5f * i);
+				limb_id_t leg = create_limb(root, quat_identity, &pop.limbs);
+				add_bone_to_limb(leg, vec3_add(root, vec3(0, -1.5f, 0)), &pop.limbs);
+				attach_limb_to_actor(leg, actor, &pop.limbs, &pop.actors, &pop.legs);
+			}
+			FOR_IN(i, 60) { update_population(1 / 60.f, &land, &pop); }
+
+			THEN("it is not posed (like the poses were baked for fewer legs), but the others are") {
+				CHECK_FALSE(pop.gait.posed[0]);
+				CHECK(pop.gait.posed[1]);
+				CHECK(pop.gait.posed[2]);
+			}
+		}
+	}
+}
+
+SCENARIO("Pose export") {
+	static landscape_t land;
+	static population_t pop, steps[6];
+	static pose_reader_t reader;
+	static pose_frame_t frame;
+	land = landscape_t{};
+	pop = population_t{};
+	init_world(am_actor_row, &land, &pop);
+	const char *path = "pose_export_test.poses";
+	const float unit = 1.f / 1024;
+
+	GIVEN("Six steps exported, with a keyframe every fourth") {
+		pose_export_t *exporter = start_pose_export(path, 4);
+		REQUIRE(exporter);
+		FOR_IN(s, 6) {
+			update_population(1 / 60.f, &land, &pop);
+			export_population_poses(&pop, exporter);
+			steps[s] = pop;
+		}
+		pose_export_stats_t stats;
+		REQUIRE(stop_pose_export(exporter, &stats));
+
+		THEN("every step was written, in less than half the space of plain floats") {
+			CHECK(stats.num_steps == 6);
+			CHECK(stats.num_dropped_steps == 0);
+			CHECK(stats.num_bytes * 2 < stats.num_raw_bytes);
+		}
+
+		THEN("they read back as they were (but for rounding)") {
+			REQUIRE(open_pose_reader(path, &reader));
+			FOR_IN(s, 6) {
+				const population_t *p = &steps[s];
+				REQUIRE(read_pose_frame(&reader, &frame));
+				CHECK(frame.step == p->num_steps);
+				CHECK(frame.time == p->time);
+				REQUIRE(frame.num_actors == p->actors.num_rows);
+				FOR_ROWS(a, p->actors) {
+					CHECK(frame.actor[a].id == p->actors.dense_id[a].id);
+					CHECK(vec3_distance(frame.location[a].position, p->actors.location[a].position) < unit);
+					CHECK(cosf(frame.location[a].orientation_y - p->actors.location[a].orientation_y) > 0.9999f);
+				}
+				REQUIRE(frame.num_limbs == p->limbs.num_rows);
+				FOR_ROWS(l, p->limbs) {
+					CHECK(frame.limb[l].id == p->limbs.dense_id[l].id);
+					CHECK(vec3_distance(frame.position[l], p->limbs.position[l]) < unit);
+					CHECK(vec3_distance(frame.tip_position[l], p->limbs.tip_position[l]) < unit);
+
+					bone_t bones[8];
+					int num_bones = (int) collect_bones(p->limbs.dense_id[l], &p->limbs, bones, 8);
+					REQUIRE(frame.bone_start[l + 1] - frame.bone_start[l] == num_bones);
+					FOR_IN(b, num_bones) {
+						uint16_t fb = frame.bone_start[l] + b;
+						quat_t q1 = frame.bone_orientation[fb], q2 = bones[b].orientation;
+						CHECK(vec3_distance(frame.joint_pos[fb], bones[b].joint_pos) < unit);
+						CHECK(fabsf(q1.x * q2.x + q1.y * q2.y + q1.z * q2.z + q1.w * q2.w) > 0.9999f);
+					}
+				}
+				FOR_ROWS(a, p->legs) {
+					uint16_t l = get_limb_index(p->legs.limb[a], &p->limbs);
+					CHECK(frame.attachment[l] == la_leg);
+					CHECK(frame.owner[l].id == p->legs.owner[a].id);
+				}
+			}
+			CHECK_FALSE(read_pose_frame(&reader, &frame));
+			close_pose_reader(&reader);
+		}
+
+		AND_WHEN("the file is cut short") {
+			FILE *file = fopen(path, "rb");
+			std::vector<char> bytes(1 << 20);
+			bytes.resize(fread(bytes.data(), 1, bytes.size(), file));
+			fclose(file);
+			file = fopen(path, "wb");
+			fwrite(bytes.data(), 1, bytes.size() - 10, file);
+			fclose(file);
+
+			THEN("the steps before the cut can still be read") {
+				REQUIRE(open_pose_reader(path, &reader));
+				size_t num_read = 0;
+				while (read_pose_frame(&reader, &frame)) { num_read++; }
+				CHECK(num_read == 5);
+				close_pose_reader(&reader);
+			}
+		}
+	}
+
+	GIVEN("A file that is no pose file") {
+		FILE *file = fopen(path, "wb");
+		fputs("Not poses", file);
+		fclose(file);
+
+		THEN("it can not be read from") {
+			CHECK_FALSE(open_pose_reader(path, &reader));
+		}
+	}
+
+	std::remove(path);
 }